@@ -1,17 +1,48 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <concepts>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
 #include <ranges>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "simd.h"
+
+// Contiguous ranges of trivially copyable elements copied to a contiguous range of the same type are copied as bytes:
+// with memmove, or with the stream_copy kernels from simd.h when the copy is larger than simd::stream_copy_threshold.
+template <class I, class S, class O>
+concept simd_copyable = std::contiguous_iterator<I> and std::sized_sentinel_for<S, I> and std::contiguous_iterator<O> and
+                        std::same_as<std::iter_value_t<I>, std::iter_value_t<O>> and
+                        std::is_trivially_copyable_v<std::iter_value_t<I>>;
 
 template <std::input_iterator I, std::sentinel_for<I> S, std::weakly_incrementable O>
     requires std::indirectly_copyable<I, O>
 O copy(I first, S last, O output) {
-    while (first != last) {
-        *output = *first;
-        ++first;
-        ++output;
+    if constexpr (simd_copyable<I, S, O>) {
+        auto n = static_cast<std::size_t>(last - first);
+        auto bytes = n * sizeof(std::iter_value_t<I>);
+        if (bytes >= simd::stream_copy_threshold) {
+            simd::stream_copy(std::to_address(output), std::to_address(first), n);
+        } else if (n != 0) {
+            // the C library has a memmove tuned for every cpu, and the pointers of an empty range may be null
+            std::memmove(std::to_address(output), std::to_address(first), bytes);
+        }
+        return output + static_cast<std::iter_difference_t<O>>(n);
+    } else {
+        while (first != last) {
+            *output = *first;
+            ++first;
+            ++output;
+        }
+        return output;
     }
-    return output;
 }
 
 template <std::ranges::input_range R, std::weakly_incrementable O>
@@ -23,12 +54,24 @@ O copy(R &&range, O output) {
 template <std::input_iterator I, std::sentinel_for<I> S, std::weakly_incrementable O, class Fn, class T = std::iter_value_t<I>>
     requires std::indirectly_writable<O, std::invoke_result_t<Fn, T>>
 O transform(I first, S last, O output, Fn fn) {
-    while (first != last) {
-        *output = fn(*first);
-        ++first;
-        ++output;
+    if constexpr (std::same_as<Fn, std::identity> and std::indirectly_copyable<I, O>) {
+        return ::copy(first, last, output);
+    } else if constexpr (std::random_access_iterator<I> and std::sized_sentinel_for<S, I> and
+                         std::random_access_iterator<O>) {
+        // the count is known before the loop, the compiler can vectorize it without comparing with last every time
+        auto n = last - first;
+        for (std::iter_difference_t<I> i = 0; i < n; ++i) {
+            output[static_cast<std::iter_difference_t<O>>(i)] = fn(first[i]);
+        }
+        return output + static_cast<std::iter_difference_t<O>>(n);
+    } else {
+        while (first != last) {
+            *output = fn(*first);
+            ++first;
+            ++output;
+        }
+        return output;
     }
-    return output;
 }
 
 template <std::ranges::input_range R, std::weakly_incrementable O, class Fn, class I = std::ranges::iterator_t<R>, class T = std::iter_value_t<I>>
@@ -48,9 +91,77 @@ concept reducible = requires(T x, T y) {
 template <class Fn, class T, class... Args>
 concept returns_t = std::regular_invocable<Fn, Args...> and std::same_as<std::invoke_result_t<Fn, Args...>, T>;
 
+template <class Op, class T>
+concept multiplies_op = std::same_as<Op, std::multiplies<>> or std::same_as<Op, std::multiplies<T>>;
+
+template <class Op, class T>
+concept plus_op = std::same_as<Op, std::plus<>> or std::same_as<Op, std::plus<T>>;
+
+// Contiguous float and double ranges that are multiplied element-wise and summed can use the FMA kernels from simd.h.
+// We can only recognize the standard function objects, a lambda doing the same thing uses the generic version.
+// The kernels are picked at runtime for the cpu we run on, see simd::kernels().
+template <class I, class S, class BinaryOp, class ReduceOp, class T>
+concept simd_inner_product = std::contiguous_iterator<I> and std::sized_sentinel_for<S, I> and
+                             std::same_as<std::iter_value_t<I>, T> and simd::dot_element<T> and
+                             multiplies_op<BinaryOp, T> and plus_op<ReduceOp, T>;
+
+// Contiguous float and double ranges can be summed with the SIMD kernels.
+template <class I, class S, class T>
+concept simd_summable = std::contiguous_iterator<I> and std::sized_sentinel_for<S, I> and
+                        std::same_as<std::iter_value_t<I>, T> and simd::dot_element<T>;
+
+// Contiguous ranges of integers, floats and doubles can be searched with the SIMD kernels, with a bound or with
+// std::unreachable_sentinel. A value of a different type would need the conversions of operator==, we leave that to the
+// generic version.
+template <class I, class S, class T>
+concept simd_searchable = std::contiguous_iterator<I> and
+                          (std::sized_sentinel_for<S, I> or std::same_as<S, std::unreachable_sentinel_t>) and
+                          std::same_as<std::iter_value_t<I>, T> and simd::find_element<T>;
+
+// An integer value of another type with the same signedness compares equal to the element with the same value, so it
+// can be searched for as an element. A value that doesn't fit in the element type is in no range.
+template <class I, class S, class T, class V = std::iter_value_t<I>>
+concept simd_searchable_as_element = std::contiguous_iterator<I> and
+                                     (std::sized_sentinel_for<S, I> or std::same_as<S, std::unreachable_sentinel_t>) and
+                                     std::integral<V> and std::integral<T> and simd::find_element<V> and
+                                     not std::same_as<V, bool> and not std::same_as<T, bool> and
+                                     std::is_signed_v<V> == std::is_signed_v<T>;
+
+namespace detail {
+
+// leaf(Lo), ..., leaf(Lo + Count - 1) combined with reduceOp in a balanced tree, expanded at compile time
+template <std::size_t Lo, std::size_t Count, class Leaf, class ReduceOp>
+auto tree_reduce(Leaf &leaf, ReduceOp &reduceOp) {
+    if constexpr (Count == 1) {
+        return leaf(std::integral_constant<std::size_t, Lo>{});
+    } else {
+        constexpr std::size_t half = Count / 2;
+        return reduceOp(tree_reduce<Lo, half>(leaf, reduceOp), tree_reduce<Lo + half, Count - half>(leaf, reduceOp));
+    }
+}
+
+} // namespace detail
+
+// A left fold, init = fn(init, x) for every element in order, so fn may be an accumulator like
+// [](double acc, double x) { return acc + x * x; }. Only for std::plus and std::multiplies on arithmetic types, whose
+// order doesn't matter to us, random access ranges reduce 8 elements in a tree before adding them to init, like
+// faster_reduce, so the operations wait for one another once every 8 elements, and contiguous float and double ranges
+// summed with std::plus use the SIMD kernels.
 template <std::input_iterator I, std::sentinel_for<I> S, class ReduceOp, class T = std::iter_value_t<I>>
     requires returns_t<ReduceOp, T, T, T>
 T reduce(I first, S last, T init, ReduceOp fn) {
+    if constexpr (simd_summable<I, S, T> and plus_op<ReduceOp, T>) {
+        return init + simd::sum(std::to_address(first), static_cast<std::size_t>(last - first));
+    } else if constexpr (std::random_access_iterator<I> and std::sized_sentinel_for<S, I> and
+                         std::is_arithmetic_v<T> and (plus_op<ReduceOp, T> or multiplies_op<ReduceOp, T>)) {
+        auto element = [&first](auto k) {
+            return T(first[static_cast<std::iter_difference_t<I>>(k)]);
+        };
+        while (last - first >= 8) {
+            init = fn(init, detail::tree_reduce<0, 8>(element, fn));
+            first += 8;
+        }
+    }
     while (first != last) {
         init = fn(init, *first);
         ++first;
@@ -61,6 +172,9 @@ T reduce(I first, S last, T init, ReduceOp fn) {
 template <std::input_iterator I, std::sentinel_for<I> S, class T = std::iter_value_t<I>>
     requires reducible<T>
 T reduce(I first, S last) {
+    if constexpr (simd_summable<I, S, T>) {
+        return simd::sum(std::to_address(first), static_cast<std::size_t>(last - first));
+    }
     T init{};
     while (first != last) {
         init += *first;
@@ -68,11 +182,57 @@ T reduce(I first, S last) {
     }
     return init;
     // Or we can just call
-    return reduce(first, last, T{}, std::plus<>());
+    return ::reduce(first, last, T{}, std::plus<>());
+}
+
+template <std::ranges::input_range R, class I = std::ranges::iterator_t<R>, class T = std::iter_value_t<I>>
+    requires reducible<T>
+T reduce(R &&range) {
+    return ::reduce(std::ranges::begin(range), std::ranges::end(range));
+}
+
+template <std::ranges::input_range R, class ReduceOp, class I = std::ranges::iterator_t<R>, class T = std::iter_value_t<I>>
+    requires returns_t<ReduceOp, T, T, T>
+T reduce(R &&range, T init, ReduceOp fn) {
+    return ::reduce(std::ranges::begin(range), std::ranges::end(range), init, fn);
 }
 
 template <std::input_iterator I, std::sentinel_for<I> S, class T = std::iter_value_t<I>>
 I find(I first, S last, const T &value) {
+    if constexpr (simd_searchable<I, S, T>) {
+        auto address = std::to_address(first);
+        if constexpr (std::same_as<S, std::unreachable_sentinel_t>) {
+            return first + (simd::find_unbounded(address, value) - address);
+        } else {
+            return first + (simd::find(address, address + (last - first), value) - address);
+        }
+    } else if constexpr (simd_searchable_as_element<I, S, T>) {
+        using V = std::iter_value_t<I>;
+        if constexpr (not std::same_as<S, std::unreachable_sentinel_t>) {
+            // with the same signedness, only the values that fit come back unchanged
+            if (static_cast<T>(static_cast<V>(value)) != value) {
+                return std::ranges::next(first, last);
+            }
+        }
+        return ::find(first, last, static_cast<V>(value));
+    } else if constexpr (std::random_access_iterator<I> and std::sized_sentinel_for<S, I>) {
+        // 4 comparisons for every test of the count, like std::find in libstdc++
+        for (auto n = last - first; n >= 4; n -= 4) {
+            if (first[0] == value) {
+                return first;
+            }
+            if (first[1] == value) {
+                return first + 1;
+            }
+            if (first[2] == value) {
+                return first + 2;
+            }
+            if (first[3] == value) {
+                return first + 3;
+            }
+            first += 4;
+        }
+    }
     while (first != last) {
         if (*first == value) {
             break;
@@ -84,7 +244,8 @@ I find(I first, S last, const T &value) {
 
 template <std::ranges::input_range R, class I = std::ranges::iterator_t<R>, class T = std::iter_value_t<I>>
 I find(R &&range, const T &value) {
-    return find(std::ranges::begin(range), std::ranges::end(range), value);
+    // qualified, for std iterators argument dependent lookup would find std::find, which is more specialized
+    return ::find(std::ranges::begin(range), std::ranges::end(range), value);
 }
 
 template <std::input_iterator I, std::sentinel_for<I> S, class BinaryOp, class ReduceOp, class T = std::iter_value_t<I>>
@@ -100,23 +261,73 @@ T reduce(I first1, S last1, I first2, T init, BinaryOp binaryOp, ReduceOp reduce
 
 template <std::input_iterator I, std::sentinel_for<I> S, class T = std::iter_value_t<I>>
 T inner_product(I first1, S last1, I first2) {
-    return reduce(first1, last1, first2, T{}, std::multiplies<>{}, std::plus<>{});
+    if constexpr (simd_inner_product<I, S, std::multiplies<>, std::plus<>, T>) {
+        return simd::dot(std::to_address(first1), std::to_address(first2), static_cast<std::size_t>(last1 - first1));
+    }
+    return ::reduce(first1, last1, first2, T{}, std::multiplies<>{}, std::plus<>{});
+}
+
+// both ranges have the same iterator type, the second one is at least as long as the first one
+template <std::ranges::input_range R1, std::ranges::input_range R2, class I = std::ranges::iterator_t<R1>,
+          class T = std::iter_value_t<I>>
+    requires std::same_as<I, std::ranges::iterator_t<R2>>
+T inner_product(R1 &&range1, R2 &&range2) {
+    return ::inner_product(std::ranges::begin(range1), std::ranges::end(range1), std::ranges::begin(range2));
 }
 
+// Takes N elements of each range per step. Their N products are split into Accumulators groups of consecutive
+// elements, every group is added in a balanced tree and goes to its own accumulator, and the accumulators are added at
+// the end. With one accumulator every step waits for the previous one once, with more the steps overlap, but each
+// accumulator needs a register. The best N and Accumulators depend on the element type and the cpu, test_unroll_sweep
+// in main.cpp measures them. The order of the operations changes, so reduceOp must be associative and commutative.
+// This always expands the requested tree, also where fast_reduce and faster_reduce would call the SIMD kernels.
+template <std::size_t N, std::size_t Accumulators = 1, std::input_iterator I, std::sentinel_for<I> S, class BinaryOp,
+          class ReduceOp, class T = std::iter_value_t<I>>
+    requires(N > 0 and Accumulators > 0 and N % Accumulators == 0) and returns_t<BinaryOp, T, T, T> and
+            returns_t<ReduceOp, T, T, T>
+T unrolled_reduce(I first1, S last1, I first2, T init, BinaryOp binaryOp, ReduceOp reduceOp) {
+    if constexpr (std::random_access_iterator<I> and std::sized_sentinel_for<S, I>) {
+        using D = std::iter_difference_t<I>;
+        constexpr auto step = static_cast<D>(N);
+        constexpr std::size_t group = N / Accumulators;
+        auto product = [&first1, &first2, &binaryOp](auto k) {
+            return binaryOp(first1[static_cast<D>(k)], first2[static_cast<D>(k)]);
+        };
+        // the tree of every group of the next N elements, the first step starts the accumulators
+        auto groups = [&product, &reduceOp]<std::size_t... K>(std::index_sequence<K...>) {
+            return std::array<T, Accumulators>{detail::tree_reduce<K * group, group>(product, reduceOp)...};
+        };
+        if (last1 - first1 > step) {
+            auto accumulators = groups(std::make_index_sequence<Accumulators>{});
+            accumulators[0] = reduceOp(init, accumulators[0]);
+            first1 += step;
+            first2 += step;
+            while (last1 - first1 > step) {
+                [&]<std::size_t... K>(std::index_sequence<K...>) {
+                    ((accumulators[K] = reduceOp(accumulators[K], detail::tree_reduce<K * group, group>(product, reduceOp))),
+                     ...);
+                }(std::make_index_sequence<Accumulators>{});
+                first1 += step;
+                first2 += step;
+            }
+            auto accumulator = [&accumulators](auto k) {
+                return accumulators[k];
+            };
+            init = detail::tree_reduce<0, Accumulators>(accumulator, reduceOp);
+        }
+    }
+    return ::reduce(first1, last1, first2, init, binaryOp, reduceOp);
+}
+
+// A tree of 4 products per step, added to init, or the SIMD kernels.
 template <std::input_iterator I, std::sentinel_for<I> S, class BinaryOp, class ReduceOp, class T = std::iter_value_t<I>>
     requires returns_t<BinaryOp, T, T, T> and returns_t<ReduceOp, T, T, T>
 T fast_reduce(I first1, S last1, I first2, T init, BinaryOp binaryOp, ReduceOp reduceOp) {
-    if constexpr (std::random_access_iterator<I>) {
-        while (std::distance(first1, last1) > 4) {
-            T aux1 = reduceOp(binaryOp(first1[0], first2[0]), binaryOp(first1[1], first2[1]));
-            T aux2 = reduceOp(binaryOp(first1[2], first2[2]), binaryOp(first1[3], first2[3]));
-            T aux3 = reduceOp(aux1, aux2);
-            init = reduceOp(init, aux3);
-            first1 += 4;
-            first2 += 4;
-        }
+    if constexpr (simd_inner_product<I, S, BinaryOp, ReduceOp, T>) {
+        return init + simd::dot(std::to_address(first1), std::to_address(first2), static_cast<std::size_t>(last1 - first1));
+    } else {
+        return unrolled_reduce<4>(first1, last1, first2, init, binaryOp, reduceOp);
     }
-    return reduce(first1, last1, first2, init, binaryOp, reduceOp);
 }
 
 template <std::input_iterator I, std::sentinel_for<I> S, class T = std::iter_value_t<I>>
@@ -124,27 +335,230 @@ T fast_inner_product(I first1, S last1, I first2) {
     return fast_reduce(first1, last1, first2, T{}, std::multiplies<>{}, std::plus<>{});
 }
 
+// A tree of 8 products per step, added to init, or the SIMD kernels.
 template <std::input_iterator I, std::sentinel_for<I> S, class BinaryOp, class ReduceOp, class T = std::iter_value_t<I>>
     requires returns_t<BinaryOp, T, T, T> and returns_t<ReduceOp, T, T, T>
 T faster_reduce(I first1, S last1, I first2, T init, BinaryOp binaryOp, ReduceOp reduceOp) {
-    if constexpr (std::random_access_iterator<I>) {
-        while (std::distance(first1, last1) > 8) {
-            T aux1 = reduceOp(binaryOp(first1[0], first2[0]), binaryOp(first1[1], first2[1]));
-            T aux2 = reduceOp(binaryOp(first1[2], first2[2]), binaryOp(first1[3], first2[3]));
-            T aux3 = reduceOp(binaryOp(first1[4], first2[4]), binaryOp(first1[5], first2[5]));
-            T aux4 = reduceOp(binaryOp(first1[6], first2[6]), binaryOp(first1[7], first2[7]));
-            T aux5 = reduceOp(aux1, aux2);
-            T aux6 = reduceOp(aux3, aux4);
-            T aux7 = reduceOp(aux5, aux6);
-            init = reduceOp(init, aux7);
-            first1 += 8;
-            first2 += 8;
-        }
+    if constexpr (simd_inner_product<I, S, BinaryOp, ReduceOp, T>) {
+        return init + simd::dot(std::to_address(first1), std::to_address(first2), static_cast<std::size_t>(last1 - first1));
+    } else {
+        return unrolled_reduce<8>(first1, last1, first2, init, binaryOp, reduceOp);
     }
-    return reduce(first1, last1, first2, init, binaryOp, reduceOp);
 }
 
 template <std::input_iterator I, std::sentinel_for<I> S, class T = std::iter_value_t<I>>
 T faster_inner_product(I first1, S last1, I first2) {
     return faster_reduce(first1, last1, first2, T{}, std::multiplies<>{}, std::plus<>{});
 }
+
+// Summing n floating point values one after another has a worst case error proportional to n, and for float32 the
+// additions simply stop having an effect once the sum is 2^24 times larger than the values we add. Pairwise reduction
+// splits the range in halves until the blocks are short, reduces each block with faster_reduce (which keeps the
+// multi-accumulator tree shape and uses the SIMD kernels when possible) and combines the halves in a balanced tree.
+// The error is now proportional to log(n / block) and we keep the vector width.
+// Like faster_reduce, it assumes that reduceOp is associative.
+template <std::random_access_iterator I, std::integral N, class BinaryOp, class ReduceOp, class T = std::iter_value_t<I>>
+    requires returns_t<BinaryOp, T, T, T> and returns_t<ReduceOp, T, T, T>
+T pairwise_reduce_n(I first1, N n, I first2, BinaryOp binaryOp, ReduceOp reduceOp) {
+    // precondition: n > 0, so we don't need an identity element for reduceOp
+    constexpr N block = 1024;
+    if (n <= block) {
+        T leaf = binaryOp(first1[0], first2[0]);
+        return faster_reduce(first1 + 1, first1 + n, first2 + 1, leaf, binaryOp, reduceOp);
+    }
+    N half = n / 2;
+    T left = pairwise_reduce_n(first1, half, first2, binaryOp, reduceOp);
+    T right = pairwise_reduce_n(first1 + half, n - half, first2 + half, binaryOp, reduceOp);
+    return reduceOp(left, right);
+}
+
+template <std::input_iterator I, std::sentinel_for<I> S, class BinaryOp, class ReduceOp, class T = std::iter_value_t<I>>
+    requires returns_t<BinaryOp, T, T, T> and returns_t<ReduceOp, T, T, T>
+T pairwise_reduce(I first1, S last1, I first2, T init, BinaryOp binaryOp, ReduceOp reduceOp) {
+    if constexpr (std::random_access_iterator<I> and std::sized_sentinel_for<S, I>) {
+        auto n = last1 - first1;
+        if (n == 0) {
+            return init;
+        }
+        return reduceOp(init, pairwise_reduce_n(first1, n, first2, binaryOp, reduceOp));
+    } else {
+        return ::reduce(first1, last1, first2, init, binaryOp, reduceOp);
+    }
+}
+
+template <std::input_iterator I, std::sentinel_for<I> S, class T = std::iter_value_t<I>>
+T pairwise_inner_product(I first1, S last1, I first2) {
+    return pairwise_reduce(first1, last1, first2, T{}, std::multiplies<>{}, std::plus<>{});
+}
+
+// The same scheme for a single range.
+template <std::random_access_iterator I, std::integral N, class ReduceOp, class T = std::iter_value_t<I>>
+    requires returns_t<ReduceOp, T, T, T>
+T pairwise_reduce_n(I first, N n, ReduceOp fn) {
+    // precondition: n > 0
+    constexpr N block = 1024;
+    if (n <= block) {
+        if constexpr (simd_summable<I, I, T> and plus_op<ReduceOp, T>) {
+            return simd::sum(std::to_address(first), static_cast<std::size_t>(n));
+        } else {
+            return ::reduce(first + 1, first + n, T(first[0]), fn);
+        }
+    }
+    N half = n / 2;
+    T left = pairwise_reduce_n(first, half, fn);
+    T right = pairwise_reduce_n(first + half, n - half, fn);
+    return fn(left, right);
+}
+
+template <std::input_iterator I, std::sentinel_for<I> S, class ReduceOp, class T = std::iter_value_t<I>>
+    requires returns_t<ReduceOp, T, T, T>
+T pairwise_reduce(I first, S last, T init, ReduceOp fn) {
+    if constexpr (std::random_access_iterator<I> and std::sized_sentinel_for<S, I>) {
+        auto n = last - first;
+        if (n == 0) {
+            return init;
+        }
+        return fn(init, pairwise_reduce_n(first, n, fn));
+    } else {
+        return ::reduce(first, last, init, fn);
+    }
+}
+
+template <std::input_iterator I, std::sentinel_for<I> S, class T = std::iter_value_t<I>>
+    requires reducible<T>
+T pairwise_reduce(I first, S last) {
+    return pairwise_reduce(first, last, T{}, std::plus<T>{});
+}
+
+// The type batch_inner_product sums the products in: float for the 16 bit floating point types, whose 11 or 8 bits of
+// mantissa would lose most of a long sum, and the element type for the others.
+template <class T>
+using batch_accumulator_t = std::conditional_t<simd::float16_element<T> or simd::bfloat16_element<T>, float, T>;
+
+// Contiguous rows of float and of the 16 bit floating point types, with a contiguous query of the same type, can use the
+// dot_rows kernels from simd.h.
+template <class I, class Q, class T>
+concept simd_batch_inner_product = std::contiguous_iterator<I> and std::contiguous_iterator<Q> and
+                                   std::same_as<std::iter_value_t<I>, T> and std::same_as<std::iter_value_t<Q>, T> and
+                                   simd::dot_rows_element<T>;
+
+namespace detail {
+
+// The rows go through the kernels in tiles of batch_tile_rows, and the columns in panels of batch_panel elements: a
+// panel of the query, 8 KB of floats, stays in the L1 cache while all the rows of the tile are multiplied with it.
+inline constexpr std::size_t batch_tile_rows = 64;
+inline constexpr std::size_t batch_panel = 2048;
+
+// The query in float, converted once for all the rows.
+template <std::random_access_iterator Q>
+std::vector<float> widen_query(Q query, std::size_t n) {
+    std::vector<float> x(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        x[i] = static_cast<float>(query[static_cast<std::iter_difference_t<Q>>(i)]);
+    }
+    return x;
+}
+
+// Writes the inner product of x with every row in [first_row, last_row) to output, row(r) is a pointer to the n elements
+// of row r.
+template <simd::dot_rows_element T, class Row, std::weakly_incrementable O>
+O batch_dot_rows(Row row, std::size_t first_row, std::size_t last_row, std::size_t n, const float *x, O output) {
+    std::array<const T *, batch_tile_rows> tile;
+    std::array<float, batch_tile_rows> sums;
+    for (auto r = first_row; r < last_row; r += batch_tile_rows) {
+        auto count = std::min(batch_tile_rows, last_row - r);
+        sums.fill(0.0f);
+        for (std::size_t column = 0; column < n; column += batch_panel) {
+            for (std::size_t k = 0; k < count; ++k) {
+                tile[k] = row(r + k) + column;
+            }
+            simd::dot_rows(tile.data(), count, std::min(batch_panel, n - column), x + column, sums.data());
+        }
+        for (std::size_t k = 0; k < count; ++k) {
+            *output = sums[k];
+            ++output;
+        }
+    }
+    return output;
+}
+
+// One row without the dot_rows kernels: contiguous float and double rows use simd::dot, the other ones are summed in A.
+template <class A, std::random_access_iterator R, std::random_access_iterator Q, class T = std::iter_value_t<R>>
+A widened_inner_product(R row, Q query, std::size_t n) {
+    if constexpr (std::contiguous_iterator<R> and std::contiguous_iterator<Q> and simd::dot_element<T> and
+                  std::same_as<std::iter_value_t<Q>, T>) {
+        return simd::dot(std::to_address(row), std::to_address(query), n);
+    } else {
+        A acc{};
+        for (std::size_t i = 0; i < n; ++i) {
+            auto k = static_cast<std::iter_difference_t<R>>(i);
+            acc += static_cast<A>(row[k]) * static_cast<A>(query[static_cast<std::iter_difference_t<Q>>(i)]);
+        }
+        return acc;
+    }
+}
+
+} // namespace detail
+
+// The inner product of query with every row of the row-major matrix [first, last), written to output in the order of
+// the rows. The rows are as long as the query, the matrix has (last - first) / n of them for a query of n elements.
+// Calling inner_product for every row would read the query again for every row. Here the kernels load each part of the
+// query once for four rows, from the L1 cache, see detail::batch_dot_rows.
+template <std::random_access_iterator I, std::sized_sentinel_for<I> S, std::random_access_iterator Q,
+          std::sized_sentinel_for<Q> QS, std::weakly_incrementable O, class T = std::iter_value_t<I>,
+          class A = batch_accumulator_t<T>>
+    requires std::same_as<std::iter_value_t<Q>, T> and std::indirectly_writable<O, A>
+O batch_inner_product(I first, S last, Q query, QS query_last, O output) {
+    auto n = static_cast<std::size_t>(query_last - query);
+    if (n == 0) {
+        // rows without columns, we can't tell how many there are
+        return output;
+    }
+    auto rows = static_cast<std::size_t>(last - first) / n;
+    if constexpr (simd_batch_inner_product<I, Q, T>) {
+        auto x = detail::widen_query(query, n);
+        auto matrix = std::to_address(first);
+        return detail::batch_dot_rows<T>([matrix, n](std::size_t r) { return matrix + r * n; }, 0, rows, n, x.data(),
+                                         output);
+    } else {
+        for (std::size_t r = 0; r < rows; ++r) {
+            *output = detail::widened_inner_product<A>(first + static_cast<std::iter_difference_t<I>>(r * n), query, n);
+            ++output;
+        }
+        return output;
+    }
+}
+
+template <std::ranges::random_access_range M, std::ranges::random_access_range Q, std::weakly_incrementable O,
+          class T = std::ranges::range_value_t<M>, class A = batch_accumulator_t<T>>
+    requires std::ranges::sized_range<M> and std::ranges::sized_range<Q> and
+             std::same_as<std::ranges::range_value_t<Q>, T> and std::indirectly_writable<O, A>
+O batch_inner_product(M &&matrix, Q &&query, O output) {
+    return ::batch_inner_product(std::ranges::begin(matrix), std::ranges::end(matrix), std::ranges::begin(query),
+                                 std::ranges::end(query), output);
+}
+
+// The same for a range of rows, like a std::vector<std::vector<T>>, where every row is as long as the query.
+template <std::ranges::random_access_range Rows, std::ranges::random_access_range Q, std::weakly_incrementable O,
+          class Row = std::ranges::range_reference_t<Rows>, class T = std::ranges::range_value_t<Q>,
+          class A = batch_accumulator_t<T>>
+    requires std::ranges::random_access_range<Row> and std::same_as<std::ranges::range_value_t<Row>, T> and
+             std::ranges::sized_range<Q> and std::indirectly_writable<O, A>
+O batch_inner_product(Rows &&rows, Q &&query, O output) {
+    auto n = static_cast<std::size_t>(std::ranges::size(query));
+    auto num_rows = static_cast<std::size_t>(std::ranges::distance(rows));
+    auto first_row = std::ranges::begin(rows);
+    using D = std::ranges::range_difference_t<Rows>;
+    if constexpr (std::ranges::contiguous_range<Row> and std::ranges::contiguous_range<Q> and simd::dot_rows_element<T>) {
+        auto x = detail::widen_query(std::ranges::begin(query), n);
+        auto row = [first_row](std::size_t r) { return std::ranges::data(first_row[static_cast<D>(r)]); };
+        return detail::batch_dot_rows<T>(row, 0, num_rows, n, x.data(), output);
+    } else {
+        for (std::size_t r = 0; r < num_rows; ++r) {
+            *output = detail::widened_inner_product<A>(std::ranges::begin(first_row[static_cast<D>(r)]),
+                                                       std::ranges::begin(query), n);
+            ++output;
+        }
+        return output;
+    }
+}
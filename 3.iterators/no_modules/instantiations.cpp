@@ -0,0 +1,5 @@
+#define ALGORITHMS_INSTANTIATION_DEFINITIONS
+#include "algorithms.h"
+#include "instantiations.h"
+
+ALGORITHMS_INSTANTIATE_ALL()
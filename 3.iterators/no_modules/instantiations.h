@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <stdfloat>
+#include <vector>
+
+// The hot kernels of algorithms.h for the element types of the benchmarks, instantiated once in instantiations.cpp
+// (instantiations.cxx for the module). Every translation unit that calls a template instantiates it again and the
+// linker keeps one copy, the extern template declarations below tell the compiler the copy already exists in another
+// object file, so it only emits a call. That saves the compile time of the instantiation, and costs the inlining of
+// the kernel, which is a loop over the whole range anyway.
+// Include it after algorithms.h or after import algorithms, and link the object file of the instantiations.
+// ALGORITHMS_NO_EXTERN_TEMPLATES instantiates them in every translation unit again, to compare the build times.
+
+#define ALGORITHMS_INSTANTIATE(PREFIX, T)                                                                              \
+    PREFIX template std::vector<T>::iterator find(std::vector<T>::iterator, std::vector<T>::iterator, const T &);     \
+    PREFIX template T reduce(std::vector<T>::iterator, std::vector<T>::iterator);                                     \
+    PREFIX template T faster_inner_product(std::vector<T>::iterator, std::vector<T>::iterator, std::vector<T>::iterator);
+
+#define ALGORITHMS_INSTANTIATE_ALL(PREFIX)                                                                             \
+    ALGORITHMS_INSTANTIATE(PREFIX, std::int32_t)                                                                       \
+    ALGORITHMS_INSTANTIATE(PREFIX, std::float32_t)                                                                     \
+    ALGORITHMS_INSTANTIATE(PREFIX, std::float64_t)
+
+#if !defined(ALGORITHMS_INSTANTIATION_DEFINITIONS) && !defined(ALGORITHMS_NO_EXTERN_TEMPLATES)
+ALGORITHMS_INSTANTIATE_ALL(extern)
+#endif
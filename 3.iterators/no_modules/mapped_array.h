@@ -0,0 +1,294 @@
+#pragma once
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <print>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_HAS_MMAP
+#endif
+
+// Arrays in memory mapped with mmap, either the contents of a flat binary file or anonymous memory. The benchmarks
+// store their inputs in files with dataset(), so they are generated once instead of on every run, and data that
+// already lives in files can be searched and reduced without copying it into a std::vector.
+namespace mapped {
+
+// How the pages will be read, passed to the kernel with madvise.
+enum class access {
+    normal,     // the default read-ahead
+    sequential, // read ahead aggressively and free the pages behind, for scans
+    random,     // no read-ahead, for lookups
+};
+
+struct map_options {
+    access pattern = access::normal;
+    // transparent huge pages, fewer TLB misses for large arrays. Works for anonymous memory and, depending on the
+    // kernel, for files on tmpfs (mounted with huge=advise) and read-only files. A hint, ignored where not supported
+    bool huge_pages = false;
+    // fault in every page when mapping, so the first pass over the data doesn't measure page faults and disk reads
+    bool populate = false;
+};
+
+// A contiguous array of trivially copyable T mapped with mmap. The iterators are T *, so it is a contiguous range
+// and the algorithms, the SIMD kernels and the parallel algorithms take it like a std::vector.
+// mapped_array<const T> maps read-only, mapped_array<T> maps read-write and the writes go to the file (MAP_SHARED).
+// Like perf_counters, a mapping that failed is empty, valid() is false and error() tells why.
+template <class T>
+    requires std::is_trivially_copyable_v<T>
+class mapped_array {
+public:
+    using value_type = std::remove_const_t<T>;
+    using element_type = T;
+    using iterator = T *;
+    using size_type = std::size_t;
+
+    mapped_array() = default;
+
+    // the elements stored in the file at path, its size must be a multiple of sizeof(T)
+    explicit mapped_array(const std::string &path, map_options options = {}) {
+#if defined(MAPPED_HAS_MMAP)
+        int fd = ::open(path.c_str(), std::is_const_v<T> ? O_RDONLY : O_RDWR);
+        if (fd < 0) {
+            fail(path);
+            return;
+        }
+        struct stat info{};
+        if (fstat(fd, &info) != 0) {
+            fail(path);
+        } else if (static_cast<std::size_t>(info.st_size) % sizeof(T) != 0) {
+            error_ = path + ": the size is not a multiple of the element size";
+        } else {
+            map(fd, static_cast<std::size_t>(info.st_size) / sizeof(T), options);
+        }
+        ::close(fd);
+#else
+        (void)path;
+        (void)options;
+        error_ = "memory mapped files need mmap";
+#endif
+    }
+
+    // size zeroed elements of anonymous memory, to fill before use
+    explicit mapped_array(std::size_t size, map_options options = {})
+        requires(not std::is_const_v<T>)
+    {
+#if defined(MAPPED_HAS_MMAP)
+        map(-1, size, options);
+#else
+        (void)size;
+        (void)options;
+        error_ = "memory mapped files need mmap";
+#endif
+    }
+
+    // a new file of size zeroed elements at path, an existing file is replaced
+    static mapped_array create(const std::string &path, std::size_t size, map_options options = {})
+        requires(not std::is_const_v<T>)
+    {
+        mapped_array result;
+#if defined(MAPPED_HAS_MMAP)
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            result.fail(path);
+            return result;
+        }
+        if (ftruncate(fd, static_cast<off_t>(size * sizeof(T))) != 0) {
+            result.fail(path);
+        } else {
+            result.map(fd, size, options);
+        }
+        ::close(fd);
+#else
+        (void)path;
+        (void)size;
+        (void)options;
+        result.error_ = "memory mapped files need mmap";
+#endif
+        return result;
+    }
+
+    // a mapping that was filled and is only read from now on, writing to it will crash
+    explicit mapped_array(mapped_array<value_type> &&other) noexcept
+        requires std::is_const_v<T>
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)),
+          error_(std::move(other.error_)) {
+#if defined(MAPPED_HAS_MMAP)
+        if (data_ != nullptr) {
+            mprotect(const_cast<value_type *>(data_), size_ * sizeof(T), PROT_READ);
+        }
+#endif
+    }
+
+    mapped_array(mapped_array &&other) noexcept
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)),
+          error_(std::move(other.error_)) {}
+
+    mapped_array &operator=(mapped_array &&other) noexcept {
+        if (this != &other) {
+            unmap();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+            error_ = std::move(other.error_);
+        }
+        return *this;
+    }
+
+    mapped_array(const mapped_array &) = delete;
+    mapped_array &operator=(const mapped_array &) = delete;
+
+    ~mapped_array() {
+        unmap();
+    }
+
+    bool valid() const noexcept {
+        return error_.empty();
+    }
+
+    const std::string &error() const noexcept {
+        return error_;
+    }
+
+    // tells the kernel how the pages will be read from now on, for example random after a sequential fill
+    void advise(access pattern) const noexcept {
+#if defined(MAPPED_HAS_MMAP)
+        if (data_ == nullptr) {
+            return;
+        }
+        int advice = pattern == access::sequential ? MADV_SEQUENTIAL
+                     : pattern == access::random   ? MADV_RANDOM
+                                                   : MADV_NORMAL;
+        madvise(const_cast<value_type *>(data_), size_ * sizeof(T), advice);
+#else
+        (void)pattern;
+#endif
+    }
+
+    T *begin() const noexcept {
+        return data_;
+    }
+
+    T *end() const noexcept {
+        return data_ + size_;
+    }
+
+    T *data() const noexcept {
+        return data_;
+    }
+
+    std::size_t size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    T &operator[](std::size_t i) const noexcept {
+        return data_[i];
+    }
+
+private:
+    template <class U>
+        requires std::is_trivially_copyable_v<U>
+    friend class mapped_array;
+
+    void fail(const std::string &what) {
+        error_ = what + ": " + std::strerror(errno);
+    }
+
+#if defined(MAPPED_HAS_MMAP)
+    // fd -1 maps anonymous memory, the file can be closed after mapping it
+    void map(int fd, std::size_t size, map_options options) {
+        if (size == 0) {
+            return; // mmap doesn't take empty mappings, an empty array needs none
+        }
+        auto bytes = size * sizeof(T);
+        int protection = std::is_const_v<T> ? PROT_READ : PROT_READ | PROT_WRITE;
+        int flags = fd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED;
+        void *address = mmap(nullptr, bytes, protection, flags, fd, 0);
+        if (address == MAP_FAILED) {
+            fail("mmap");
+            return;
+        }
+        data_ = static_cast<T *>(address);
+        size_ = size;
+#if defined(MADV_HUGEPAGE)
+        if (options.huge_pages) {
+            // before the pages are touched, otherwise they are already small pages
+            madvise(address, bytes, MADV_HUGEPAGE);
+        }
+#endif
+        advise(options.pattern);
+        if (options.populate) {
+            // reading one byte of each page faults it in, a write fault would copy the pages of a private mapping
+            auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+            auto first = static_cast<const volatile unsigned char *>(address);
+            for (std::size_t offset = 0; offset < bytes; offset += page) {
+                (void)first[offset];
+            }
+        }
+    }
+#endif
+
+    void unmap() noexcept {
+#if defined(MAPPED_HAS_MMAP)
+        if (data_ != nullptr) {
+            munmap(const_cast<value_type *>(data_), size_ * sizeof(T));
+        }
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    T *data_ = nullptr;
+    std::size_t size_ = 0;
+    std::string error_;
+};
+
+// The input name of a benchmark, size elements written by fill(std::span<T>).
+// If the environment variable BENCH_DATA names a directory, the input is stored there in name.bin the first time and
+// mapped from the file afterwards, as long as it has the right size. Otherwise it is generated into anonymous memory
+// on every run. The name should say everything the contents depend on (type, distribution, seed), the size is checked.
+// The benchmarks can't run without their input, so a failure ends the program.
+template <class T, class Fill>
+    requires std::invocable<Fill &, std::span<T>>
+mapped_array<const T> dataset(std::string_view name, std::size_t size, Fill fill, map_options options = {}) {
+    auto directory = std::getenv("BENCH_DATA");
+    auto generated = mapped_array<T>{};
+    bool in_file = false;
+    if (directory != nullptr and *directory != '\0') {
+        auto path = (std::filesystem::path(directory) / (std::string(name) + ".bin")).string();
+        auto stored = mapped_array<const T>(path, options);
+        if (stored.valid() and stored.size() == size) {
+            return stored;
+        }
+        generated = mapped_array<T>::create(path, size, options);
+        in_file = generated.valid();
+        if (not in_file) {
+            std::print(stderr, "{}, generating {} in memory\n", generated.error(), name);
+        }
+    }
+    if (not in_file) {
+        generated = mapped_array<T>(size, options);
+    }
+    if (not generated.valid()) {
+        std::print(stderr, "can't allocate {}: {}\n", name, generated.error());
+        std::exit(EXIT_FAILURE);
+    }
+    fill(std::span<T>(generated.begin(), generated.end()));
+    return mapped_array<const T>(std::move(generated));
+}
+
+} // namespace mapped
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <ranges>
+#include <utility>
+
+#include "simd.h"
+
+// The minimum and the maximum, of 2 elements and of a range, see 4.minmax/README.md.
+// For equal elements min returns the first one and max the second one, min_element the first minimum and max_element
+// the last maximum, so the algorithms built on them can be stable.
+
+template <class T, class Compare>
+    requires std::strict_weak_order<Compare, T, T>
+inline const T &min(const T &a, const T &b, Compare comp) {
+    if (comp(b, a)) {
+        return b;
+    }
+    return a;
+}
+
+template <class T, class Compare>
+    requires std::strict_weak_order<Compare, T, T>
+inline const T &max(const T &a, const T &b, Compare comp) {
+    if (comp(b, a)) {
+        return a;
+    }
+    return b;
+}
+
+template <class T>
+    requires std::strict_weak_order<std::less<T>, T, T>
+inline const T &min(const T &a, const T &b) {
+    return ::min(a, b, std::less<T>{});
+}
+
+template <class T>
+    requires std::strict_weak_order<std::less<T>, T, T>
+inline const T &max(const T &a, const T &b) {
+    return ::max(a, b, std::less<T>{});
+}
+
+template <class Op, class T>
+concept less_op = std::same_as<Op, std::less<>> or std::same_as<Op, std::less<T>> or std::same_as<Op, std::ranges::less>;
+
+// Contiguous ranges of 32 and 64 bit integers, floats and doubles compared with operator< can use the min/max kernels
+// from simd.h, which keep a minimum and a maximum in every lane. Like for the searches, a lambda doing the same thing
+// uses the generic version. The kernels need a strict weak order, a range with NaNs has none and the result is
+// unspecified, like with the generic version.
+template <class I, class S, class Compare, class T>
+concept simd_minmaxable = std::contiguous_iterator<I> and std::sized_sentinel_for<S, I> and
+                          std::same_as<std::iter_value_t<I>, T> and simd::minmax_element<T> and less_op<Compare, T>;
+
+template <std::forward_iterator I, std::sentinel_for<I> S, class Compare, class T = std::iter_value_t<I>>
+    requires std::strict_weak_order<Compare &, T, T>
+I min_element(I first, S last, Compare comp) {
+    if (first == last) {
+        return first;
+    }
+    I minimum = first;
+    while (++first != last) {
+        if (comp(*first, *minimum)) {
+            minimum = first;
+        }
+    }
+    return minimum;
+}
+
+template <std::forward_iterator I, std::sentinel_for<I> S, class Compare, class T = std::iter_value_t<I>>
+    requires std::strict_weak_order<Compare &, T, T>
+I max_element(I first, S last, Compare comp) {
+    if (first == last) {
+        return first;
+    }
+    I maximum = first;
+    while (++first != last) {
+        if (not comp(*first, *maximum)) {
+            maximum = first;
+        }
+    }
+    return maximum;
+}
+
+// min_element and max_element together, 2n comparisons
+template <std::forward_iterator I, std::sentinel_for<I> S, class Compare, class T = std::iter_value_t<I>>
+    requires std::strict_weak_order<Compare &, T, T>
+std::pair<I, I> naive_minmax_element(I first, S last, Compare comp) {
+    return {::min_element(first, last, comp), ::max_element(first, last, comp)};
+}
+
+// The first minimum and the last maximum with 3n / 2 comparisons: the elements are taken in pairs, the smaller one is
+// compared with the minimum and the larger one with the maximum. An empty range returns {last, last}.
+template <std::forward_iterator I, std::sentinel_for<I> S, class Compare, class T = std::iter_value_t<I>>
+    requires std::strict_weak_order<Compare &, T, T>
+std::pair<I, I> minmax_element(I first, S last, Compare comp) {
+    if constexpr (simd_minmaxable<I, S, Compare, T>) {
+        auto n = static_cast<std::size_t>(last - first);
+        if (n == 0) {
+            return {first, first};
+        }
+        using N = std::iter_difference_t<I>;
+        auto indices = simd::minmax(std::to_address(first), n);
+        return {first + static_cast<N>(indices.min), first + static_cast<N>(indices.max)};
+    }
+    if (first == last) {
+        return {first, first};
+    }
+    I minimum = first;
+    I maximum = first;
+    ++first;
+    // every pair is ordered with one comparison, for equal elements the first one is the smaller, so the minimum
+    // stays the first one and the maximum moves to the last one
+    while (first != last) {
+        I potential_min = first;
+        if (++first == last) {
+            // n is even, the last element is alone
+            if (comp(*potential_min, *minimum)) {
+                minimum = potential_min;
+            } else if (not comp(*potential_min, *maximum)) {
+                maximum = potential_min;
+            }
+            break;
+        }
+        I potential_max = first;
+        ++first;
+        if (comp(*potential_max, *potential_min)) {
+            std::swap(potential_min, potential_max);
+        }
+        if (comp(*potential_min, *minimum)) {
+            minimum = potential_min;
+        }
+        if (not comp(*potential_max, *maximum)) {
+            maximum = potential_max;
+        }
+    }
+    return {minimum, maximum};
+}
+
+template <std::forward_iterator I, std::sentinel_for<I> S, class T = std::iter_value_t<I>>
+    requires std::strict_weak_order<std::less<>, T, T>
+I min_element(I first, S last) {
+    return ::min_element(first, last, std::less<>{});
+}
+
+template <std::forward_iterator I, std::sentinel_for<I> S, class T = std::iter_value_t<I>>
+    requires std::strict_weak_order<std::less<>, T, T>
+I max_element(I first, S last) {
+    return ::max_element(first, last, std::less<>{});
+}
+
+template <std::forward_iterator I, std::sentinel_for<I> S, class T = std::iter_value_t<I>>
+    requires std::strict_weak_order<std::less<>, T, T>
+std::pair<I, I> minmax_element(I first, S last) {
+    return ::minmax_element(first, last, std::less<>{});
+}
+
+// qualified, for std iterators argument dependent lookup would find std::min_element and std::minmax_element
+template <std::ranges::forward_range R, class Compare = std::less<>, class I = std::ranges::iterator_t<R>,
+          class T = std::iter_value_t<I>>
+    requires std::strict_weak_order<Compare &, T, T>
+I min_element(R &&range, Compare comp = {}) {
+    return ::min_element(std::ranges::begin(range), std::ranges::end(range), comp);
+}
+
+template <std::ranges::forward_range R, class Compare = std::less<>, class I = std::ranges::iterator_t<R>,
+          class T = std::iter_value_t<I>>
+    requires std::strict_weak_order<Compare &, T, T>
+I max_element(R &&range, Compare comp = {}) {
+    return ::max_element(std::ranges::begin(range), std::ranges::end(range), comp);
+}
+
+template <std::ranges::forward_range R, class Compare = std::less<>, class I = std::ranges::iterator_t<R>,
+          class T = std::iter_value_t<I>>
+    requires std::strict_weak_order<Compare &, T, T>
+std::pair<I, I> minmax_element(R &&range, Compare comp = {}) {
+    return ::minmax_element(std::ranges::begin(range), std::ranges::end(range), comp);
+}
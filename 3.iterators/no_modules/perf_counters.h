@@ -0,0 +1,177 @@
+#pragma once
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware performance counters with perf_event_open. Wall-clock time tells us that a benchmark is slow, the counters
+// tell us why: few instructions per cycle, cache misses, branch misses or TLB misses.
+// Only available on Linux, and only if /proc/sys/kernel/perf_event_paranoid allows it (2 or less for user space
+// events), containers often need --privileged or --cap-add=PERFMON.
+namespace timer {
+
+enum class event { cycles, instructions, llc_misses, branch_misses, dtlb_misses };
+
+inline constexpr std::array<std::string_view, 5> event_names = {"cycles", "instructions", "llc_misses", "branch_misses",
+                                                                 "dtlb_misses"};
+
+// Event counts, nullopt for the events the cpu or the kernel can't count.
+struct counters {
+    std::array<std::optional<double>, event_names.size()> values;
+
+    std::optional<double> operator[](event e) const {
+        return values[static_cast<std::size_t>(e)];
+    }
+
+    std::optional<double> ipc() const {
+        auto cycles = (*this)[event::cycles], instructions = (*this)[event::instructions];
+        if (not cycles or not instructions or *cycles == 0.0) {
+            return std::nullopt;
+        }
+        return *instructions / *cycles;
+    }
+
+    counters &operator-=(const counters &other) {
+        for (std::size_t i = 0; i < values.size(); ++i) {
+            if (values[i] and other.values[i]) {
+                *values[i] -= *other.values[i];
+            }
+        }
+        return *this;
+    }
+
+    counters &operator+=(const counters &other) {
+        for (std::size_t i = 0; i < values.size(); ++i) {
+            if (values[i] and other.values[i]) {
+                *values[i] += *other.values[i];
+            } else if (other.values[i]) {
+                values[i] = other.values[i];
+            }
+        }
+        return *this;
+    }
+
+    counters &operator/=(double n) {
+        for (auto &value : values) {
+            if (value) {
+                *value /= n;
+            }
+        }
+        return *this;
+    }
+};
+
+inline counters operator-(counters a, const counters &b) {
+    return a -= b;
+}
+
+// The counters of the thread that creates them and of every thread it creates afterwards (inherit), in user space.
+// They always run, read() returns the totals so far and a measurement is the difference of two reads.
+class perf_counters {
+public:
+    perf_counters() {
+#if defined(__linux__)
+        constexpr std::array<std::pair<std::uint32_t, std::uint64_t>, event_names.size()> configs = {{
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES}, // last level cache misses on most cpus
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        }};
+        for (std::size_t i = 0; i < configs.size(); ++i) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = configs[i].first;
+            attr.config = configs[i].second;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.inherit = 1;
+            // with more events than hardware counters the kernel multiplexes them, the times let us scale the counts
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds_[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+            if (fds_[i] < 0 and error_.empty()) {
+                error_ = std::string(event_names[i]) + ": " + std::strerror(errno);
+            }
+        }
+#else
+        error_ = "perf_event_open is only available on Linux";
+#endif
+    }
+
+    perf_counters(const perf_counters &) = delete;
+    perf_counters &operator=(const perf_counters &) = delete;
+
+    ~perf_counters() {
+#if defined(__linux__)
+        for (auto fd : fds_) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+#endif
+    }
+
+    // at least the cycles can be counted
+    bool available() const noexcept {
+        return fds_[0] >= 0;
+    }
+
+    // the first event that could not be opened and why
+    const std::string &error() const noexcept {
+        return error_;
+    }
+
+    counters read() const {
+        counters result;
+#if defined(__linux__)
+        for (std::size_t i = 0; i < fds_.size(); ++i) {
+            std::uint64_t data[3] = {}; // value, time enabled, time running
+            if (fds_[i] < 0 or ::read(fds_[i], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data))) {
+                continue;
+            }
+            auto value = static_cast<double>(data[0]);
+            if (data[2] != 0 and data[2] < data[1]) {
+                value *= static_cast<double>(data[1]) / static_cast<double>(data[2]);
+            }
+            result.values[i] = value;
+        }
+#endif
+        return result;
+    }
+
+private:
+    std::array<int, event_names.size()> fds_ = {-1, -1, -1, -1, -1};
+    std::string error_;
+};
+
+// nullptr unless enable_hardware_counters() succeeded
+inline const perf_counters *&hardware_counters() {
+    static const perf_counters *enabled = nullptr;
+    return enabled;
+}
+
+// Opens the counters. Call it before the worker threads are created, the counters only follow the threads created
+// after them.
+// error is the first event that could not be opened, even if the others work.
+inline bool enable_hardware_counters(std::string &error) {
+    static perf_counters instance;
+    error = instance.error();
+    if (not instance.available()) {
+        return false;
+    }
+    hardware_counters() = &instance;
+    return true;
+}
+
+} // namespace timer
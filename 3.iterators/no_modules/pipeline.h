@@ -0,0 +1,221 @@
+#pragma once
+
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <ranges>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "algorithms.h"
+
+// Lazy transform | filter | reduce chains that run in a single pass. A transform followed by a reduce writes every
+// transformed element to an intermediate range and reads it again, for large ranges that is two trips to memory. Here
+// the stages only describe what to do with one element, and run() pushes every element of the range through all of
+// them, straight into the accumulator:
+//
+//     auto expr = pipeline::transform(scale) | pipeline::filter(positive) | pipeline::reduce(0.0f, std::plus<>{});
+//     float sum = pipeline::run(vec.begin(), vec.end(), expr);
+//
+// run() is the sequential backend and run_unrolled() the one with 8 accumulators like faster_reduce. The parallel
+// backends are the overloads of run() taking an execution policy, in 5.parallel/parallel_algorithms.h.
+namespace pipeline {
+
+template <class Fn>
+struct transform_stage {
+    Fn fn;
+
+    template <class X, class Sink>
+    void push(X &&x, Sink &&sink) const {
+        sink(std::invoke(fn, std::forward<X>(x)));
+    }
+};
+
+template <class Pred>
+struct filter_stage {
+    Pred pred;
+
+    template <class X, class Sink>
+    void push(X &&x, Sink &&sink) const {
+        if (std::invoke(pred, std::as_const(x))) {
+            sink(std::forward<X>(x));
+        }
+    }
+};
+
+// The stages in the order they are applied.
+template <class... Stages>
+struct chain {
+    std::tuple<Stages...> stages;
+
+    // passes x through the stages from K on, and what comes out of the last one to sink
+    template <std::size_t K = 0, class X, class Sink>
+    void push(X &&x, Sink &&sink) const {
+        if constexpr (K == sizeof...(Stages)) {
+            sink(std::forward<X>(x));
+        } else {
+            std::get<K>(stages).push(std::forward<X>(x), [this, &sink](auto &&y) {
+                push<K + 1>(std::forward<decltype(y)>(y), sink);
+            });
+        }
+    }
+};
+
+// The type of elements that come out of the chain for an element of type X.
+template <class Chain, class X>
+struct output;
+
+template <class X>
+struct output<chain<>, X> {
+    using type = X;
+};
+
+template <class Fn, class... Rest, class X>
+struct output<chain<transform_stage<Fn>, Rest...>, X> {
+    using type = typename output<chain<Rest...>, std::invoke_result_t<const Fn &, X>>::type;
+};
+
+template <class Pred, class... Rest, class X>
+struct output<chain<filter_stage<Pred>, Rest...>, X> {
+    using type = typename output<chain<Rest...>, X>::type;
+};
+
+template <class Chain, class X>
+using output_t = typename output<Chain, X>::type;
+
+// reduceOp has no identity we know of, the backends that need one can't run the chain
+struct no_identity {};
+
+template <class T, class ReduceOp, class Identity = no_identity>
+struct reduce_stage {
+    T init;
+    ReduceOp fn;
+    // the value accumulators start from when a backend reduces parts of the range separately
+    Identity identity;
+};
+
+// A chain with a reduce at the end, what run() takes.
+template <class Chain, class T, class ReduceOp, class Identity>
+struct fused_reduce {
+    Chain stages;
+    reduce_stage<T, ReduceOp, Identity> reduction;
+
+    static constexpr bool has_identity = not std::same_as<Identity, no_identity>;
+};
+
+template <std::copy_constructible Fn>
+auto transform(Fn fn) {
+    return chain<transform_stage<Fn>>{{transform_stage<Fn>{std::move(fn)}}};
+}
+
+template <std::copy_constructible Pred>
+auto filter(Pred pred) {
+    return chain<filter_stage<Pred>>{{filter_stage<Pred>{std::move(pred)}}};
+}
+
+// std::plus and std::multiplies have the identities T{} and T{1}, any other reduceOp needs the three argument version
+// to run on the backends that reduce parts of the range separately.
+template <class T, class ReduceOp>
+    requires returns_t<ReduceOp, T, T, T>
+auto reduce(T init, ReduceOp fn) {
+    if constexpr (plus_op<ReduceOp, T>) {
+        return reduce_stage<T, ReduceOp, T>{std::move(init), std::move(fn), T{}};
+    } else if constexpr (multiplies_op<ReduceOp, T>) {
+        return reduce_stage<T, ReduceOp, T>{std::move(init), std::move(fn), T{1}};
+    } else {
+        return reduce_stage<T, ReduceOp>{std::move(init), std::move(fn), {}};
+    }
+}
+
+// precondition: fn(identity, x) == x for every x
+template <class T, class ReduceOp>
+    requires returns_t<ReduceOp, T, T, T>
+auto reduce(T init, ReduceOp fn, T identity) {
+    return reduce_stage<T, ReduceOp, T>{std::move(init), std::move(fn), std::move(identity)};
+}
+
+template <class... Left, class... Right>
+auto operator|(chain<Left...> left, chain<Right...> right) {
+    return chain<Left..., Right...>{std::tuple_cat(std::move(left.stages), std::move(right.stages))};
+}
+
+template <class... Stages, class T, class ReduceOp, class Identity>
+auto operator|(chain<Stages...> stages, reduce_stage<T, ReduceOp, Identity> reduction) {
+    return fused_reduce<chain<Stages...>, T, ReduceOp, Identity>{std::move(stages), std::move(reduction)};
+}
+
+template <class Expr, class I>
+concept runnable_on = requires(const Expr &expr) {
+    requires std::convertible_to<output_t<decltype(expr.stages), std::iter_reference_t<I>>,
+                                 decltype(expr.reduction.init)>;
+};
+
+// Reduces the elements that come out of the chain in [first, last), starting from acc.
+template <std::input_iterator I, std::sentinel_for<I> S, class Expr, class T>
+T reduce_into(I first, S last, const Expr &expr, T acc) {
+    auto accumulate = [&acc, &expr](auto &&x) {
+        acc = expr.reduction.fn(acc, std::forward<decltype(x)>(x));
+    };
+    for (; first != last; ++first) {
+        expr.stages.push(*first, accumulate);
+    }
+    return acc;
+}
+
+// As reduce_into, with 8 accumulators that start from the identity: element i goes to accumulator i % 8, so the
+// additions of 8 consecutive elements don't wait for one another. Like faster_reduce, reduceOp must be associative
+// and commutative.
+template <std::random_access_iterator I, class Expr, class T>
+    requires Expr::has_identity
+T unrolled_reduce_into(I first, std::iter_difference_t<I> n, const Expr &expr, T acc) {
+    constexpr std::iter_difference_t<I> lanes = 8;
+    std::array<T, lanes> accumulators;
+    accumulators.fill(expr.reduction.identity);
+    std::iter_difference_t<I> i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        for (std::iter_difference_t<I> lane = 0; lane < lanes; ++lane) {
+            expr.stages.push(first[i + lane], [&expr, &accumulators, lane](auto &&x) {
+                accumulators[lane] = expr.reduction.fn(accumulators[lane], std::forward<decltype(x)>(x));
+            });
+        }
+    }
+    acc = reduce_into(first + i, first + n, expr, acc);
+    auto &fn = expr.reduction.fn;
+    return fn(acc, fn(fn(fn(accumulators[0], accumulators[1]), fn(accumulators[2], accumulators[3])),
+                      fn(fn(accumulators[4], accumulators[5]), fn(accumulators[6], accumulators[7]))));
+}
+
+template <std::input_iterator I, std::sentinel_for<I> S, class Chain, class T, class ReduceOp, class Identity>
+    requires runnable_on<fused_reduce<Chain, T, ReduceOp, Identity>, I>
+T run(I first, S last, const fused_reduce<Chain, T, ReduceOp, Identity> &expr) {
+    return reduce_into(first, last, expr, expr.reduction.init);
+}
+
+template <std::input_iterator I, std::sentinel_for<I> S, class Chain, class T, class ReduceOp, class Identity>
+    requires runnable_on<fused_reduce<Chain, T, ReduceOp, Identity>, I>
+T run_unrolled(I first, S last, const fused_reduce<Chain, T, ReduceOp, Identity> &expr) {
+    static_assert(fused_reduce<Chain, T, ReduceOp, Identity>::has_identity,
+                  "run_unrolled needs the identity of reduceOp, pass it to pipeline::reduce");
+    if constexpr (std::random_access_iterator<I> and std::sized_sentinel_for<S, I>) {
+        return unrolled_reduce_into(first, last - first, expr, expr.reduction.init);
+    } else {
+        return reduce_into(first, last, expr, expr.reduction.init);
+    }
+}
+
+template <std::ranges::input_range R, class Chain, class T, class ReduceOp, class Identity>
+    requires runnable_on<fused_reduce<Chain, T, ReduceOp, Identity>, std::ranges::iterator_t<R>>
+T run(R &&range, const fused_reduce<Chain, T, ReduceOp, Identity> &expr) {
+    return run(std::ranges::begin(range), std::ranges::end(range), expr);
+}
+
+template <std::ranges::input_range R, class Chain, class T, class ReduceOp, class Identity>
+    requires runnable_on<fused_reduce<Chain, T, ReduceOp, Identity>, std::ranges::iterator_t<R>>
+T run_unrolled(R &&range, const fused_reduce<Chain, T, ReduceOp, Identity> &expr) {
+    return run_unrolled(std::ranges::begin(range), std::ranges::end(range), expr);
+}
+
+} // namespace pipeline
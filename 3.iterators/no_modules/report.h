@@ -0,0 +1,695 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+#include <optional>
+#include <print>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "perf_counters.h"
+
+// The Makefiles pass the commit and the optimization flags, they end up in the result files.
+#ifndef TIMER_COMMIT
+#define TIMER_COMMIT "unknown"
+#endif
+#ifndef TIMER_FLAGS
+#define TIMER_FLAGS "unknown"
+#endif
+
+// Statistics of the benchmark samples, the machine readable results and the comparison of two result files.
+// This header only depends on the standard library (and perf_counters.h), so the timers of every chapter and the timer module can share it.
+namespace timer {
+
+// The work done by one call of the benchmarked function, used to report the throughput. 0 means unknown.
+struct work {
+    std::size_t elements = 0;
+    std::size_t bytes = 0;
+};
+
+// All times are in seconds for one call of fn.
+struct statistics {
+    std::vector<double> samples; // sorted
+    std::uint32_t iterations = 0;
+    double min = 0.0;
+    double median = 0.0;
+    double p90 = 0.0;
+    double p99 = 0.0;
+    double mean = 0.0;
+    double stddev = 0.0;
+    double elements_per_second = 0.0;
+    double bytes_per_second = 0.0;
+    std::optional<counters> events; // for one call, only with --counters
+};
+
+// cycles, instructions, IPC and the misses of one call
+inline std::string describe(const counters &events) {
+    std::string s;
+    for (std::size_t i = 0; i < events.values.size(); ++i) {
+        if (events.values[i]) {
+            s += std::format("{}{} {:.4g}", s.empty() ? "" : ", ", event_names[i], *events.values[i]);
+        }
+        if (static_cast<event>(i) == event::instructions and events.ipc()) {
+            s += std::format(", ipc {:.2f}", *events.ipc());
+        }
+    }
+    return s;
+}
+
+namespace detail {
+
+// linear interpolation between the closest ranks, sorted must not be empty
+inline double percentile(const std::vector<double> &sorted, double p) {
+    double rank = p * static_cast<double>(sorted.size() - 1);
+    auto lower = static_cast<std::size_t>(rank);
+    auto upper = std::min(lower + 1, sorted.size() - 1);
+    return sorted[lower] + (rank - static_cast<double>(lower)) * (sorted[upper] - sorted[lower]);
+}
+
+} // namespace detail
+
+inline statistics summarize(std::vector<double> samples, std::uint32_t iterations, work per_call = {}) {
+    statistics result;
+    if (samples.empty()) {
+        return result;
+    }
+    std::ranges::sort(samples);
+    auto n = static_cast<double>(samples.size());
+    result.iterations = iterations;
+    result.min = samples.front();
+    result.median = detail::percentile(samples, 0.5);
+    result.p90 = detail::percentile(samples, 0.9);
+    result.p99 = detail::percentile(samples, 0.99);
+    result.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / n;
+    // the sum of the squared deviations, with n - 1 because the mean was estimated from the same samples
+    double squares = std::accumulate(samples.begin(), samples.end(), 0.0, [mean = result.mean](double init, double current) {
+        return init + (current - mean) * (current - mean);
+    });
+    result.stddev = samples.size() > 1 ? std::sqrt(squares / (n - 1)) : 0.0;
+    // the median is not pulled up by the samples disturbed by other processes or interrupts
+    if (result.median > 0.0) {
+        result.elements_per_second = static_cast<double>(per_call.elements) / result.median;
+        result.bytes_per_second = static_cast<double>(per_call.bytes) / result.median;
+    }
+    result.samples = std::move(samples);
+    return result;
+}
+
+inline std::string compiler() {
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#else
+    return "unknown";
+#endif
+}
+
+inline std::string cpu() {
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        // x86 has a model name, most arm kernels don't
+        if (line.starts_with("model name")) {
+            auto colon = line.find(':');
+            return colon == std::string::npos ? line : line.substr(line.find_first_not_of(' ', colon + 1));
+        }
+    }
+    return "unknown";
+}
+
+// Collects the statistics of every benchmark and writes them when the program ends, if an output file was requested.
+// The format follows the extension: .csv for CSV, everything else is JSON.
+class recorder {
+public:
+    recorder() : info_{{"commit", TIMER_COMMIT}, {"compiler", compiler()}, {"flags", TIMER_FLAGS}, {"cpu", cpu()}} {}
+
+    recorder(const recorder &) = delete;
+    recorder &operator=(const recorder &) = delete;
+
+    ~recorder() {
+        if (not output_.empty() and not write(output_)) {
+            std::print(stderr, "Could not write the results to {}\n", output_);
+        }
+    }
+
+    void set_output(std::string path) {
+        output_ = std::move(path);
+    }
+
+    // additional information about the run, for example the SIMD kernels or the number of threads
+    void set(std::string key, std::string value) {
+        for (auto &[k, v] : info_) {
+            if (k == key) {
+                v = std::move(value);
+                return;
+            }
+        }
+        info_.emplace_back(std::move(key), std::move(value));
+    }
+
+    void add(std::string name, statistics stats) {
+        records_.emplace_back(std::move(name), std::move(stats));
+    }
+
+    bool write(const std::string &path) const {
+        std::ofstream file(path);
+        if (not file) {
+            return false;
+        }
+        auto out = std::ostreambuf_iterator<char>(file);
+        if (path.ends_with(".csv")) {
+            write_csv(out);
+        } else {
+            write_json(out);
+        }
+        return static_cast<bool>(file);
+    }
+
+private:
+    static std::string quote_json(std::string_view s) {
+        std::string quoted = "\"";
+        for (char c : s) {
+            if (c == '"' or c == '\\') {
+                quoted += '\\';
+                quoted += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                quoted += std::format("\\u{:04x}", static_cast<int>(c));
+            } else {
+                quoted += c;
+            }
+        }
+        return quoted + '"';
+    }
+
+    static std::string quote_csv(std::string_view s) {
+        std::string quoted = "\"";
+        for (char c : s) {
+            quoted += c;
+            if (c == '"') {
+                quoted += '"';
+            }
+        }
+        return quoted + '"';
+    }
+
+    void write_json(auto out) const {
+        std::format_to(out, "{{\n");
+        for (const auto &[key, value] : info_) {
+            std::format_to(out, "  {}: {},\n", quote_json(key), quote_json(value));
+        }
+        std::format_to(out, "  \"benchmarks\": [");
+        for (std::size_t i = 0; i < records_.size(); ++i) {
+            const auto &[name, s] = records_[i];
+            // doubles are printed with the shortest representation that reads back to the same value
+            std::format_to(out,
+                           "{}\n    {{\"name\": {}, \"iterations\": {}, \"min\": {}, \"median\": {}, \"p90\": {}, "
+                           "\"p99\": {}, \"mean\": {}, \"stddev\": {}, \"elements_per_second\": {}, "
+                           "\"bytes_per_second\": {}, ",
+                           i == 0 ? "" : ",", quote_json(name), s.iterations, s.min, s.median, s.p90, s.p99, s.mean,
+                           s.stddev, s.elements_per_second, s.bytes_per_second);
+            if (s.events) {
+                // the counters of one call, only the events that were counted
+                std::format_to(out, "\"counters\": {{");
+                bool first = true;
+                for (std::size_t j = 0; j < s.events->values.size(); ++j) {
+                    if (s.events->values[j]) {
+                        std::format_to(out, "{}\"{}\": {}", first ? "" : ", ", event_names[j], *s.events->values[j]);
+                        first = false;
+                    }
+                }
+                std::format_to(out, "}}, ");
+            }
+            std::format_to(out, "\"samples\": [");
+            for (std::size_t j = 0; j < s.samples.size(); ++j) {
+                std::format_to(out, "{}{}", j == 0 ? "" : ", ", s.samples[j]);
+            }
+            std::format_to(out, "]}}");
+        }
+        std::format_to(out, "\n  ]\n}}\n");
+    }
+
+    void write_csv(auto out) const {
+        for (const auto &[key, value] : info_) {
+            std::format_to(out, "# {}: {}\n", key, value);
+        }
+        std::format_to(out, "name,iterations,min,median,p90,p99,mean,stddev,elements_per_second,bytes_per_second,");
+        for (auto event_name : event_names) {
+            std::format_to(out, "{},", event_name);
+        }
+        std::format_to(out, "samples\n");
+        for (const auto &[name, s] : records_) {
+            std::format_to(out, "{},{},{},{},{},{},{},{},{},{},", quote_csv(name), s.iterations, s.min, s.median, s.p90,
+                           s.p99, s.mean, s.stddev, s.elements_per_second, s.bytes_per_second);
+            for (std::size_t j = 0; j < event_names.size(); ++j) {
+                // empty if the event was not counted
+                if (s.events and s.events->values[j]) {
+                    std::format_to(out, "{}", *s.events->values[j]);
+                }
+                std::format_to(out, ",");
+            }
+            for (std::size_t j = 0; j < s.samples.size(); ++j) {
+                std::format_to(out, "{}{}", j == 0 ? "" : ";", s.samples[j]);
+            }
+            std::format_to(out, "\n");
+        }
+    }
+
+    std::string output_;
+    std::vector<std::pair<std::string, std::string>> info_;
+    std::vector<std::pair<std::string, statistics>> records_;
+};
+
+inline recorder &report() {
+    static recorder instance;
+    return instance;
+}
+
+// Set with --samples, the benchmarks take at least this many samples. More samples make the comparison more sensitive.
+inline std::uint32_t &minimum_samples() {
+    static std::uint32_t samples = 0;
+    return samples;
+}
+
+namespace detail {
+
+// The name and the samples of every benchmark in a result file, nothing else is needed for the comparison.
+using samples_by_name = std::vector<std::pair<std::string, std::vector<double>>>;
+
+inline std::optional<double> parse_double(std::string_view s) {
+    double value = 0.0;
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+    if (ec != std::errc{} or ptr != s.data() + s.size()) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+// Reads the JSON files written by recorder. It understands all of JSON, but keeps only the name and the samples of
+// the objects in the "benchmarks" array.
+class json_reader {
+public:
+    explicit json_reader(std::string_view text) : text_(text) {}
+
+    std::optional<samples_by_name> read() {
+        samples_by_name result;
+        if (not expect('{')) {
+            return std::nullopt;
+        }
+        if (not members([this, &result](std::string_view key) {
+                return key == "benchmarks" ? benchmarks(result) : skip_value();
+            })) {
+            return std::nullopt;
+        }
+        return result;
+    }
+
+private:
+    void skip_whitespace() {
+        while (pos_ < text_.size() and (text_[pos_] == ' ' or text_[pos_] == '\n' or text_[pos_] == '\r' or text_[pos_] == '\t')) {
+            ++pos_;
+        }
+    }
+
+    bool peek(char c) {
+        skip_whitespace();
+        return pos_ < text_.size() and text_[pos_] == c;
+    }
+
+    bool expect(char c) {
+        if (not peek(c)) {
+            return false;
+        }
+        ++pos_;
+        return true;
+    }
+
+    // the opening brace was already read, calls member(key) with the position at the value of each member
+    bool members(auto member) {
+        if (expect('}')) {
+            return true;
+        }
+        do {
+            auto key = string();
+            if (not key or not expect(':') or not member(*key)) {
+                return false;
+            }
+        } while (expect(','));
+        return expect('}');
+    }
+
+    // the opening bracket was already read
+    bool elements(auto element) {
+        if (expect(']')) {
+            return true;
+        }
+        do {
+            if (not element()) {
+                return false;
+            }
+        } while (expect(','));
+        return expect(']');
+    }
+
+    std::optional<std::string> string() {
+        if (not expect('"')) {
+            return std::nullopt;
+        }
+        std::string s;
+        while (pos_ < text_.size() and text_[pos_] != '"') {
+            char c = text_[pos_++];
+            if (c == '\\' and pos_ < text_.size()) {
+                char escaped = text_[pos_++];
+                if (escaped == 'u' and pos_ + 4 <= text_.size()) {
+                    // the names are ASCII, that is all recorder escapes this way
+                    unsigned code = 0;
+                    std::from_chars(text_.data() + pos_, text_.data() + pos_ + 4, code, 16);
+                    s += static_cast<char>(code);
+                    pos_ += 4;
+                } else {
+                    constexpr std::string_view from = "nrtbf", to = "\n\r\t\b\f";
+                    auto i = from.find(escaped);
+                    s += i == std::string_view::npos ? escaped : to[i];
+                }
+            } else {
+                s += c;
+            }
+        }
+        if (pos_ == text_.size()) {
+            return std::nullopt;
+        }
+        ++pos_;
+        return s;
+    }
+
+    std::optional<double> number() {
+        skip_whitespace();
+        auto start = pos_;
+        while (pos_ < text_.size() and std::string_view("+-.0123456789eE").find(text_[pos_]) != std::string_view::npos) {
+            ++pos_;
+        }
+        return parse_double(text_.substr(start, pos_ - start));
+    }
+
+    bool skip_value() {
+        if (expect('{')) {
+            return members([this](std::string_view) { return skip_value(); });
+        }
+        if (expect('[')) {
+            return elements([this]() { return skip_value(); });
+        }
+        if (peek('"')) {
+            return string().has_value();
+        }
+        for (std::string_view literal : {"true", "false", "null"}) {
+            if (text_.substr(pos_).starts_with(literal)) {
+                pos_ += literal.size();
+                return true;
+            }
+        }
+        return number().has_value();
+    }
+
+    bool benchmarks(samples_by_name &result) {
+        if (not expect('[')) {
+            return false;
+        }
+        return elements([this, &result]() {
+            std::string name;
+            std::vector<double> samples;
+            bool ok = expect('{') and members([this, &name, &samples](std::string_view key) {
+                          if (key == "name") {
+                              auto s = string();
+                              name = s.value_or("");
+                              return s.has_value();
+                          }
+                          if (key == "samples") {
+                              return expect('[') and elements([this, &samples]() {
+                                         auto value = number();
+                                         samples.push_back(value.value_or(0.0));
+                                         return value.has_value();
+                                     });
+                          }
+                          return skip_value();
+                      });
+            result.emplace_back(std::move(name), std::move(samples));
+            return ok;
+        });
+    }
+
+    std::string_view text_;
+    std::size_t pos_ = 0;
+};
+
+// splits a line of the CSV files written by recorder, quoted fields can contain commas and doubled quotes
+inline std::vector<std::string> csv_fields(std::string_view line) {
+    std::vector<std::string> fields(1);
+    bool quoted = false;
+    for (std::size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (quoted and c == '"' and i + 1 < line.size() and line[i + 1] == '"') {
+            fields.back() += '"';
+            ++i;
+        } else if (c == '"') {
+            quoted = not quoted;
+        } else if (c == ',' and not quoted) {
+            fields.emplace_back();
+        } else if (c != '\r') {
+            fields.back() += c;
+        }
+    }
+    return fields;
+}
+
+inline std::optional<samples_by_name> read_csv(std::istream &file) {
+    samples_by_name result;
+    std::string line;
+    std::optional<std::size_t> name_column, samples_column;
+    while (std::getline(file, line)) {
+        if (line.empty() or line.starts_with('#')) {
+            continue;
+        }
+        auto fields = csv_fields(line);
+        if (not samples_column) {
+            // the header
+            for (std::size_t i = 0; i < fields.size(); ++i) {
+                if (fields[i] == "name") {
+                    name_column = i;
+                } else if (fields[i] == "samples") {
+                    samples_column = i;
+                }
+            }
+            if (not name_column or not samples_column) {
+                return std::nullopt;
+            }
+            continue;
+        }
+        if (fields.size() <= std::max(*name_column, *samples_column)) {
+            return std::nullopt;
+        }
+        std::vector<double> samples;
+        std::string_view rest = fields[*samples_column];
+        while (not rest.empty()) {
+            auto end = std::min(rest.find(';'), rest.size());
+            auto value = parse_double(rest.substr(0, end));
+            if (not value) {
+                return std::nullopt;
+            }
+            samples.push_back(*value);
+            rest.remove_prefix(std::min(end + 1, rest.size()));
+        }
+        result.emplace_back(fields[*name_column], std::move(samples));
+    }
+    return result;
+}
+
+inline std::optional<samples_by_name> read_results(const std::string &path) {
+    std::ifstream file(path);
+    if (not file) {
+        return std::nullopt;
+    }
+    if (path.ends_with(".csv")) {
+        return read_csv(file);
+    }
+    std::string text(std::istreambuf_iterator<char>(file), {});
+    return json_reader(text).read();
+}
+
+// The probability that the samples of after are at least this much larger than the samples of before if both come
+// from the same distribution (one-sided Mann-Whitney U test). It makes no assumption about the shape of the
+// distribution, which matters for timings: they have a long tail to the right.
+inline double p_value_greater(const std::vector<double> &before, const std::vector<double> &after) {
+    auto a = after.size(), b = before.size();
+    if (a == 0 or b == 0) {
+        return 1.0;
+    }
+    // u counts the pairs where the sample of after is larger, ties count one half
+    double u = 0.0;
+    bool ties = false;
+    for (auto x : after) {
+        for (auto y : before) {
+            u += x > y ? 1.0 : (x == y ? 0.5 : 0.0);
+            ties = ties or x == y;
+        }
+    }
+
+    if (not ties and a * b <= 400) {
+        // exact distribution: ways[i][j][k] arrangements of i samples of after and j of before with u == k
+        // the largest sample either comes from after and is larger than the j samples of before, or it comes from before
+        std::vector ways(a + 1, std::vector(b + 1, std::vector<double>(a * b + 1, 0.0)));
+        for (std::size_t i = 0; i <= a; ++i) {
+            for (std::size_t j = 0; j <= b; ++j) {
+                if (i == 0 or j == 0) {
+                    ways[i][j][0] = 1.0;
+                    continue;
+                }
+                for (std::size_t k = 0; k <= i * j; ++k) {
+                    ways[i][j][k] = (k >= j ? ways[i - 1][j][k - j] : 0.0) + (k <= i * (j - 1) ? ways[i][j - 1][k] : 0.0);
+                }
+            }
+        }
+        const auto &counts = ways[a][b];
+        double total = std::accumulate(counts.begin(), counts.end(), 0.0);
+        double tail = std::accumulate(counts.begin() + static_cast<std::ptrdiff_t>(u), counts.end(), 0.0);
+        return tail / total;
+    }
+
+    // normal approximation, with the variance corrected for the ties
+    std::vector<double> all(before);
+    all.insert(all.end(), after.begin(), after.end());
+    std::ranges::sort(all);
+    double n = static_cast<double>(all.size());
+    double tie_term = 0.0;
+    for (std::size_t i = 0; i < all.size();) {
+        auto j = i;
+        while (j < all.size() and all[j] == all[i]) {
+            ++j;
+        }
+        double t = static_cast<double>(j - i);
+        tie_term += t * t * t - t;
+        i = j;
+    }
+    double ab = static_cast<double>(a * b);
+    double variance = ab / 12.0 * ((n + 1.0) - tie_term / (n * (n - 1.0)));
+    if (variance <= 0.0) {
+        return 1.0;
+    }
+    double z = (u - ab / 2.0 - 0.5) / std::sqrt(variance);
+    return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+inline double median(std::vector<double> samples) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+    std::ranges::sort(samples);
+    return percentile(samples, 0.5);
+}
+
+} // namespace detail
+
+struct compare_options {
+    double alpha = 0.05;     // significance level of the test
+    double threshold = 0.02; // smaller changes of the median are ignored even when they are significant
+};
+
+// Prints a table with the change of the median of every benchmark that appears in both files. A benchmark is slower
+// when the new samples are significantly larger and the median grew by more than the threshold.
+// Returns 1 if a benchmark got slower, 0 otherwise and 2 if a file could not be read, so it can gate a CI job.
+inline int compare(const std::string &before_path, const std::string &after_path, compare_options opts = {}) {
+    auto before = detail::read_results(before_path);
+    auto after = detail::read_results(after_path);
+    if (not before or not after) {
+        std::print(stderr, "Could not read {}\n", before ? after_path : before_path);
+        return 2;
+    }
+
+    int slower = 0;
+    std::print("| benchmark | before | after | change | p-value | verdict |\n");
+    std::print("|-----------|--------|-------|--------|---------|---------|\n");
+    for (const auto &[name, after_samples] : *after) {
+        auto found = std::ranges::find(*before, name, &std::pair<std::string, std::vector<double>>::first);
+        if (found == before->end()) {
+            std::print("| {} | | {:.6f}s | | | new |\n", name, detail::median(after_samples));
+            continue;
+        }
+        const auto &before_samples = found->second;
+        auto before_median = detail::median(before_samples);
+        auto after_median = detail::median(after_samples);
+        auto change = before_median > 0.0 ? after_median / before_median - 1.0 : 0.0;
+        auto p_slower = detail::p_value_greater(before_samples, after_samples);
+        auto p_faster = detail::p_value_greater(after_samples, before_samples);
+        std::string_view verdict = "";
+        double p = std::min(p_slower, p_faster);
+        if (p_slower < opts.alpha and change > opts.threshold) {
+            verdict = "slower";
+            ++slower;
+        } else if (p_faster < opts.alpha and change < -opts.threshold) {
+            verdict = "faster";
+        }
+        std::print("| {} | {:.6f}s | {:.6f}s | {:+.1f}% | {:.4f} | {} |\n", name, before_median, after_median,
+                   100.0 * change, p, verdict);
+    }
+    std::print("{} of {} benchmarks are significantly slower\n", slower, after->size());
+    return slower > 0 ? 1 : 0;
+}
+
+// The command line of the benchmark executables:
+//   --output results.json   also write the results as JSON (or CSV if the file ends with .csv)
+//   --samples n             take at least n samples of every benchmark
+//   --counters              also count cycles, instructions and misses, see perf_counters.h
+//   --compare before after  compare two result files instead of running the benchmarks
+//   --alpha a, --threshold t
+// Returns the exit code if the program should stop.
+inline std::optional<int> handle_arguments(int argc, char *argv[]) {
+    std::vector<std::string_view> args(argv + 1, argv + argc);
+    compare_options opts;
+    std::optional<std::pair<std::string, std::string>> files;
+    auto number = [&args](std::size_t i) -> std::optional<double> {
+        return i < args.size() ? detail::parse_double(args[i]) : std::nullopt;
+    };
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--output" and i + 1 < args.size()) {
+            report().set_output(std::string(args[++i]));
+        } else if (args[i] == "--samples" and number(i + 1)) {
+            minimum_samples() = static_cast<std::uint32_t>(*number(++i));
+        } else if (args[i] == "--counters") {
+            std::string error;
+            if (not enable_hardware_counters(error)) {
+                std::print(stderr, "Hardware counters are not available ({}), check /proc/sys/kernel/perf_event_paranoid\n",
+                           error);
+                return 2;
+            }
+            if (not error.empty()) {
+                std::print(stderr, "Some hardware counters are not available ({})\n", error);
+            }
+        } else if (args[i] == "--alpha" and number(i + 1)) {
+            opts.alpha = *number(++i);
+        } else if (args[i] == "--threshold" and number(i + 1)) {
+            opts.threshold = *number(++i);
+        } else if (args[i] == "--compare" and i + 2 < args.size()) {
+            files.emplace(args[i + 1], args[i + 2]);
+            i += 2;
+        } else {
+            std::print(stderr, "usage: {} [--output file.json|file.csv] [--samples n] "
+                               "[--counters] [--compare before after [--alpha a] [--threshold t]]\n",
+                       argv[0]);
+            return 2;
+        }
+    }
+    if (files) {
+        return compare(files->first, files->second, opts);
+    }
+    return std::nullopt;
+}
+
+} // namespace timer
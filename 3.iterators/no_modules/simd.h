@@ -0,0 +1,1573 @@
+#pragma once
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <type_traits>
+
+#if (defined(__x86_64__) or defined(__i386__)) and (defined(__GNUC__) or defined(__clang__))
+#include <immintrin.h>
+// The x86 kernels are compiled for their own instruction set with a target attribute, independently of -march.
+// They are only called after checking that the cpu supports them, so the same binary runs on every x86 machine.
+#define SIMD_HAS_AVX2 1
+#define SIMD_HAS_AVX512 1
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define SIMD_TARGET_AVX2_F16C __attribute__((target("avx2,fma,f16c")))
+#define SIMD_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+#if defined(__ARM_NEON) and defined(__aarch64__)
+// NEON is part of every aarch64 cpu, we don't need to detect it
+#include <arm_neon.h>
+#define SIMD_HAS_NEON 1
+#endif
+#if defined(__GNUC__) or defined(__clang__)
+// The unbounded searches read whole aligned vectors, which can include a few bytes before the first element or after the
+// match. An aligned load never crosses a page, so this is safe on the hardware, but the address sanitizer reports it.
+#define SIMD_NO_SANITIZE __attribute__((no_sanitize_address))
+#else
+#define SIMD_NO_SANITIZE
+#endif
+
+// Explicit SIMD kernels for the inner product, the sum, the linear search, the minimum and maximum and the copy of
+// contiguous ranges, and for the inner products of many rows with the same vector.
+// The compiler does not always vectorize fast_reduce and faster_reduce, it can't reorder floating point additions on
+// its own and it never fuses the multiplication with the addition. These kernels use fused multiply-add instructions and
+// 4 independent accumulators, so 4 FMAs can be in flight at the same time.
+// The kernels are selected at runtime: the first call detects the instruction sets of the cpu and fills a table of
+// function pointers with the best kernels, every later call goes through the table.
+namespace simd {
+
+enum class isa { scalar, neon, avx2, avx512 };
+
+inline std::string_view name(isa level) {
+    switch (level) {
+    case isa::neon:
+        return "neon";
+    case isa::avx2:
+        return "avx2";
+    case isa::avx512:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
+
+// The best instruction set supported by the cpu and the operating system.
+inline isa detected_isa() {
+    static const isa detected = []() {
+#if defined(SIMD_HAS_AVX512)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return isa::avx512;
+        }
+        if (__builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma")) {
+            return isa::avx2;
+        }
+#elif defined(SIMD_HAS_NEON)
+        return isa::neon;
+#endif
+        return isa::scalar;
+    }();
+    return detected;
+}
+
+inline bool supports(isa level) {
+    auto detected = detected_isa();
+    if (level == isa::scalar or level == detected) {
+        return true;
+    }
+    // avx512 machines also support avx2
+    return level == isa::avx2 and detected == isa::avx512;
+}
+
+// The instruction set used by the dispatched kernels. The SIMD_ISA environment variable (scalar, neon, avx2, avx512)
+// can lower it, which is useful to compare the kernels on the same machine.
+inline isa active_isa() {
+    static const isa active = []() {
+        auto detected = detected_isa();
+        auto requested = std::getenv("SIMD_ISA");
+        if (requested == nullptr) {
+            return detected;
+        }
+        for (auto level : {isa::scalar, isa::neon, isa::avx2, isa::avx512}) {
+            if (name(level) == requested and supports(level)) {
+                return level;
+            }
+        }
+        return detected;
+    }();
+    return active;
+}
+
+// The portable kernels, used when the cpu has none of the instruction sets below.
+template <class T>
+T dot_scalar(const T *a, const T *b, std::size_t n) {
+    T acc0{}, acc1{}, acc2{}, acc3{};
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 += a[i] * b[i];
+        acc1 += a[i + 1] * b[i + 1];
+        acc2 += a[i + 2] * b[i + 2];
+        acc3 += a[i + 3] * b[i + 3];
+    }
+    for (; i != n; ++i) {
+        acc0 += a[i] * b[i];
+    }
+    return (acc0 + acc1) + (acc2 + acc3);
+}
+
+template <class T>
+T sum_scalar(const T *a, std::size_t n) {
+    T acc0{}, acc1{}, acc2{}, acc3{};
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 += a[i];
+        acc1 += a[i + 1];
+        acc2 += a[i + 2];
+        acc3 += a[i + 3];
+    }
+    for (; i != n; ++i) {
+        acc0 += a[i];
+    }
+    return (acc0 + acc1) + (acc2 + acc3);
+}
+
+template <class T>
+const T *find_scalar(const T *first, const T *last, T value) {
+    while (first != last) {
+        if (*first == value) {
+            break;
+        }
+        ++first;
+    }
+    return first;
+}
+
+// precondition: value is found at or after first
+template <class T>
+const T *find_unbounded_scalar(const T *first, T value) {
+    while (not(*first == value)) {
+        ++first;
+    }
+    return first;
+}
+
+// Copies larger than this many bytes use the stream_copy kernels. Such a copy doesn't fit in the last level cache of
+// most cpus, normal stores would evict what the cache holds for lines that are evicted themselves before they are read.
+inline constexpr std::size_t stream_copy_threshold = std::size_t{1} << 25;
+
+// The stream_copy kernels copy stream_copy_pages pages of stream_copy_page bytes at the same time.
+inline constexpr std::size_t stream_copy_page = 4096;
+inline constexpr std::size_t stream_copy_pages = 4;
+
+// The interleaved pages would overwrite parts of an overlapping source before reading them, those copies use memmove.
+inline bool stream_copy_overlaps(const void *destination, const void *source, std::size_t bytes) {
+    auto dst = reinterpret_cast<std::uintptr_t>(destination);
+    auto src = reinterpret_cast<std::uintptr_t>(source);
+    return dst < src + bytes and src < dst + bytes;
+}
+
+// There are no portable non-temporal stores, memmove is the best we have. NEON has no intrinsics for them either, so it
+// keeps this kernel.
+inline void stream_copy_scalar(void *destination, const void *source, std::size_t bytes) {
+    std::memmove(destination, source, bytes);
+}
+
+// The elements of the rows the dot_rows kernels read: float, or the bits of the 16 bit floating point formats, which the
+// kernels convert to float.
+enum class row_format { f32, f16, bf16 };
+
+template <row_format F>
+using row_storage_t = std::conditional_t<F == row_format::f32, float, std::uint16_t>;
+
+// IEEE binary16: 1 sign bit, 5 exponent bits and 10 mantissa bits.
+inline float f16_to_f32(std::uint16_t h) {
+    std::uint32_t sign = std::uint32_t{h & 0x8000u} << 16;
+    std::uint32_t exponent = (h >> 10) & 0x1fu;
+    std::uint32_t mantissa = h & 0x3ffu;
+    if (exponent == 0) {
+        // zero and the subnormals, mantissa * 2^-24
+        float magnitude = static_cast<float>(mantissa) * 0x1p-24f;
+        return sign != 0 ? -magnitude : magnitude;
+    }
+    // infinity and NaN keep the largest exponent
+    exponent = exponent == 0x1fu ? 0xffu : exponent + 127 - 15;
+    return std::bit_cast<float>(sign | exponent << 23 | mantissa << 13);
+}
+
+// bfloat16 is the upper half of a float.
+inline float bf16_to_f32(std::uint16_t b) {
+    return std::bit_cast<float>(std::uint32_t{b} << 16);
+}
+
+template <row_format F>
+float widen(row_storage_t<F> x) {
+    if constexpr (F == row_format::f32) {
+        return x;
+    } else if constexpr (F == row_format::f16) {
+        return f16_to_f32(x);
+    } else {
+        return bf16_to_f32(x);
+    }
+}
+
+// y[r] += rows[r][0, n) . x[0, n) for every r < num_rows, summed in float. x is the vector the rows are multiplied with,
+// already converted to float, it is shared by all the rows.
+template <row_format F>
+void dot_rows_scalar(const row_storage_t<F> *const *rows, std::size_t num_rows, std::size_t n, const float *x, float *y) {
+    for (std::size_t r = 0; r < num_rows; ++r) {
+        const auto *a = rows[r];
+        float acc0{}, acc1{}, acc2{}, acc3{};
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            acc0 += widen<F>(a[i]) * x[i];
+            acc1 += widen<F>(a[i + 1]) * x[i + 1];
+            acc2 += widen<F>(a[i + 2]) * x[i + 2];
+            acc3 += widen<F>(a[i + 3]) * x[i + 3];
+        }
+        for (; i != n; ++i) {
+            acc0 += widen<F>(a[i]) * x[i];
+        }
+        y[r] += (acc0 + acc1) + (acc2 + acc3);
+    }
+}
+
+// The positions of the first minimum and the last maximum, like minmax_element.
+struct minmax_indices {
+    std::size_t min = 0;
+    std::size_t max = 0;
+};
+
+// Compares the elements in pairs, the smaller one with the minimum and the larger one with the maximum: 3 comparisons
+// for 2 elements instead of 4.
+// precondition: n > 0
+template <class T>
+minmax_indices minmax_scalar(const T *a, std::size_t n) {
+    minmax_indices result;
+    std::size_t i = 1;
+    for (; i + 1 < n; i += 2) {
+        // for equal elements the first one is the smaller and the second one the larger, so the minimum stays the
+        // first and the maximum becomes the last
+        bool swapped = a[i + 1] < a[i];
+        std::size_t smaller = swapped ? i + 1 : i, larger = swapped ? i : i + 1;
+        if (a[smaller] < a[result.min]) {
+            result.min = smaller;
+        }
+        if (not(a[larger] < a[result.max])) {
+            result.max = larger;
+        }
+    }
+    if (i < n) {
+        if (a[i] < a[result.min]) {
+            result.min = i;
+        }
+        if (not(a[i] < a[result.max])) {
+            result.max = i;
+        }
+    }
+    return result;
+}
+
+// The vector kernels keep a minimum and a maximum with their indices in each lane. At the end, the lanes are merged,
+// equal values by their index, so the result is the same as with minmax_scalar.
+template <class T, class Index>
+minmax_indices merge_lanes(const T *a, const Index *min_indices, const Index *max_indices, std::size_t lanes) {
+    minmax_indices result{min_indices[0], max_indices[0]};
+    for (std::size_t lane = 1; lane < lanes; ++lane) {
+        std::size_t min = min_indices[lane], max = max_indices[lane];
+        if (a[min] < a[result.min] or (not(a[result.min] < a[min]) and min < result.min)) {
+            result.min = min;
+        }
+        if (a[result.max] < a[max] or (not(a[max] < a[result.max]) and max > result.max)) {
+            result.max = max;
+        }
+    }
+    return result;
+}
+
+// The elements after the last whole vector, their indices are larger than all the others.
+template <class T>
+void minmax_tail(const T *a, std::size_t first, std::size_t n, minmax_indices &result) {
+    for (std::size_t i = first; i < n; ++i) {
+        if (a[i] < a[result.min]) {
+            result.min = i;
+        }
+        if (not(a[i] < a[result.max])) {
+            result.max = i;
+        }
+    }
+}
+
+// The indices of 32 bit elements are kept in 32 bit lanes, the kernels for them process at most 2^31 elements at a
+// time and the results of the blocks are merged here.
+template <class T>
+minmax_indices minmax_blocks(const T *a, std::size_t n, minmax_indices (*kernel)(const T *, std::size_t)) {
+    constexpr std::size_t block = sizeof(T) == 4 ? std::size_t{1} << 31 : std::numeric_limits<std::size_t>::max();
+    auto result = kernel(a, n < block ? n : block);
+    for (std::size_t offset = block; offset < n; offset += block) {
+        auto part = kernel(a + offset, n - offset < block ? n - offset : block);
+        if (a[offset + part.min] < a[result.min]) {
+            result.min = offset + part.min;
+        }
+        if (not(a[offset + part.max] < a[result.max])) {
+            result.max = offset + part.max;
+        }
+    }
+    return result;
+}
+
+#if defined(SIMD_HAS_AVX512)
+SIMD_TARGET_AVX512 inline float dot_avx512(const float *a, const float *b, std::size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+        acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32), acc2);
+        acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48), acc3);
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i != n) {
+        // the masked loads read only the remaining n - i elements, the other lanes are 0
+        __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+}
+
+SIMD_TARGET_AVX512 inline double dot_avx512(const double *a, const double *b, std::size_t n) {
+    __m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd(), acc2 = _mm512_setzero_pd(), acc3 = _mm512_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), acc0);
+        acc1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 8), _mm512_loadu_pd(b + i + 8), acc1);
+        acc2 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 16), _mm512_loadu_pd(b + i + 16), acc2);
+        acc3 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 24), _mm512_loadu_pd(b + i + 24), acc3);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), acc0);
+    }
+    if (i != n) {
+        __mmask8 mask = static_cast<__mmask8>((1u << (n - i)) - 1);
+        acc1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, a + i), _mm512_maskz_loadu_pd(mask, b + i), acc1);
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(_mm512_add_pd(acc0, acc1), _mm512_add_pd(acc2, acc3)));
+}
+
+SIMD_TARGET_AVX512 inline float sum_avx512(const float *a, std::size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps(), acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        acc0 = _mm512_add_ps(_mm512_loadu_ps(a + i), acc0);
+        acc1 = _mm512_add_ps(_mm512_loadu_ps(a + i + 16), acc1);
+        acc2 = _mm512_add_ps(_mm512_loadu_ps(a + i + 32), acc2);
+        acc3 = _mm512_add_ps(_mm512_loadu_ps(a + i + 48), acc3);
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_add_ps(_mm512_loadu_ps(a + i), acc0);
+    }
+    if (i != n) {
+        __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+        acc1 = _mm512_add_ps(_mm512_maskz_loadu_ps(mask, a + i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3)));
+}
+
+SIMD_TARGET_AVX512 inline double sum_avx512(const double *a, std::size_t n) {
+    __m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd(), acc2 = _mm512_setzero_pd(), acc3 = _mm512_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_add_pd(_mm512_loadu_pd(a + i), acc0);
+        acc1 = _mm512_add_pd(_mm512_loadu_pd(a + i + 8), acc1);
+        acc2 = _mm512_add_pd(_mm512_loadu_pd(a + i + 16), acc2);
+        acc3 = _mm512_add_pd(_mm512_loadu_pd(a + i + 24), acc3);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm512_add_pd(_mm512_loadu_pd(a + i), acc0);
+    }
+    if (i != n) {
+        __mmask8 mask = static_cast<__mmask8>((1u << (n - i)) - 1);
+        acc1 = _mm512_add_pd(_mm512_maskz_loadu_pd(mask, a + i), acc1);
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(_mm512_add_pd(acc0, acc1), _mm512_add_pd(acc2, acc3)));
+}
+
+// The searches compare 16 (32 bit) or 8 (64 bit) elements at a time. AVX-512F has no 8 and 16 bit comparisons, those
+// element types use the avx2 kernels.
+template <class T>
+SIMD_TARGET_AVX512 inline __m512i broadcast_avx512(T value) {
+    if constexpr (sizeof(T) == 4) {
+        return _mm512_set1_epi32(std::bit_cast<int>(value));
+    } else {
+        return _mm512_set1_epi64(std::bit_cast<long long>(value));
+    }
+}
+
+// One bit for each lane selected by mask that is equal to the needle. The masked lanes are not read.
+// Floating point elements are compared as floating point numbers, so 0.0 == -0.0 and NaN never matches, like operator==.
+template <class T>
+SIMD_TARGET_AVX512 inline unsigned equal_lanes_avx512(const T *p, __m512i needle, unsigned mask) {
+    if constexpr (std::same_as<T, float>) {
+        auto data = _mm512_castsi512_ps(_mm512_maskz_loadu_epi32(static_cast<__mmask16>(mask), p));
+        return _mm512_mask_cmp_ps_mask(static_cast<__mmask16>(mask), data, _mm512_castsi512_ps(needle), _CMP_EQ_OQ);
+    } else if constexpr (std::same_as<T, double>) {
+        auto data = _mm512_castsi512_pd(_mm512_maskz_loadu_epi64(static_cast<__mmask8>(mask), p));
+        return _mm512_mask_cmp_pd_mask(static_cast<__mmask8>(mask), data, _mm512_castsi512_pd(needle), _CMP_EQ_OQ);
+    } else if constexpr (sizeof(T) == 4) {
+        auto data = _mm512_maskz_loadu_epi32(static_cast<__mmask16>(mask), p);
+        return _mm512_mask_cmpeq_epi32_mask(static_cast<__mmask16>(mask), data, needle);
+    } else {
+        auto data = _mm512_maskz_loadu_epi64(static_cast<__mmask8>(mask), p);
+        return _mm512_mask_cmpeq_epi64_mask(static_cast<__mmask8>(mask), data, needle);
+    }
+}
+
+template <class T>
+    requires(sizeof(T) == 4 or sizeof(T) == 8)
+SIMD_TARGET_AVX512 inline const T *find_avx512(const T *first, const T *last, T value) {
+    constexpr std::ptrdiff_t lanes = 64 / sizeof(T);
+    constexpr unsigned all_lanes = (1u << lanes) - 1;
+    const __m512i needle = broadcast_avx512(value);
+    for (; last - first >= lanes; first += lanes) {
+        auto found = equal_lanes_avx512(first, needle, all_lanes);
+        if (found != 0) {
+            // the lowest set bit is the first lane that matched
+            return first + std::countr_zero(found);
+        }
+    }
+    if (first != last) {
+        auto found = equal_lanes_avx512(first, needle, (1u << (last - first)) - 1);
+        if (found != 0) {
+            return first + std::countr_zero(found);
+        }
+    }
+    return last;
+}
+
+// precondition: value is found at or after first
+template <class T>
+    requires(sizeof(T) == 4 or sizeof(T) == 8)
+SIMD_TARGET_AVX512 SIMD_NO_SANITIZE inline const T *find_unbounded_avx512(const T *first, T value) {
+    constexpr std::size_t lanes = 64 / sizeof(T);
+    constexpr unsigned all_lanes = (1u << lanes) - 1;
+    const __m512i needle = broadcast_avx512(value);
+    // start at the 64 byte boundary before first and ignore the lanes before it, from then on every load is aligned
+    auto address = reinterpret_cast<std::uintptr_t>(first);
+    auto skipped = (address % 64) / sizeof(T);
+    auto block = reinterpret_cast<const T *>(address - address % 64);
+    auto found = equal_lanes_avx512(block, needle, all_lanes & (all_lanes << skipped));
+    while (found == 0) {
+        block += lanes;
+        found = equal_lanes_avx512(block, needle, all_lanes);
+    }
+    return block + std::countr_zero(found);
+}
+// AVX-512F compares 32 and 64 bit integers, signed and unsigned, into mask registers, and moves the lanes selected by a
+// mask, so a lane keeps its minimum and its index with two masked moves.
+template <class T>
+SIMD_TARGET_AVX512 inline unsigned less_lanes_avx512(__m512i x, __m512i y) {
+    if constexpr (std::same_as<T, float>) {
+        return _mm512_cmp_ps_mask(_mm512_castsi512_ps(x), _mm512_castsi512_ps(y), _CMP_LT_OQ);
+    } else if constexpr (std::same_as<T, double>) {
+        return _mm512_cmp_pd_mask(_mm512_castsi512_pd(x), _mm512_castsi512_pd(y), _CMP_LT_OQ);
+    } else if constexpr (sizeof(T) == 4 and std::signed_integral<T>) {
+        return _mm512_cmplt_epi32_mask(x, y);
+    } else if constexpr (sizeof(T) == 4) {
+        return _mm512_cmplt_epu32_mask(x, y);
+    } else if constexpr (std::signed_integral<T>) {
+        return _mm512_cmplt_epi64_mask(x, y);
+    } else {
+        return _mm512_cmplt_epu64_mask(x, y);
+    }
+}
+
+template <class T>
+SIMD_TARGET_AVX512 inline __m512i select_lanes_avx512(__m512i old, unsigned mask, __m512i updated) {
+    if constexpr (sizeof(T) == 4) {
+        return _mm512_mask_mov_epi32(old, static_cast<__mmask16>(mask), updated);
+    } else {
+        return _mm512_mask_mov_epi64(old, static_cast<__mmask8>(mask), updated);
+    }
+}
+
+// precondition: 0 < n <= 2^31
+template <class T>
+    requires(sizeof(T) == 4 or sizeof(T) == 8)
+SIMD_TARGET_AVX512 inline minmax_indices minmax_block_avx512(const T *a, std::size_t n) {
+    constexpr std::size_t lanes = 64 / sizeof(T);
+    constexpr unsigned all_lanes = (1u << lanes) - 1;
+    using index_t = std::conditional_t<sizeof(T) == 4, std::uint32_t, std::uint64_t>;
+    // every lane starts with the first element, whose index is 0
+    auto lowest = broadcast_avx512(a[0]), highest = lowest;
+    auto lowest_index = _mm512_setzero_si512(), highest_index = lowest_index;
+    __m512i index, step;
+    if constexpr (sizeof(T) == 4) {
+        index = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+        step = _mm512_set1_epi32(lanes);
+    } else {
+        index = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+        step = _mm512_set1_epi64(lanes);
+    }
+    std::size_t i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        auto x = _mm512_loadu_si512(a + i);
+        auto lower = less_lanes_avx512<T>(x, lowest);
+        auto not_lower = ~less_lanes_avx512<T>(x, highest) & all_lanes;
+        lowest = select_lanes_avx512<T>(lowest, lower, x);
+        lowest_index = select_lanes_avx512<T>(lowest_index, lower, index);
+        highest = select_lanes_avx512<T>(highest, not_lower, x);
+        highest_index = select_lanes_avx512<T>(highest_index, not_lower, index);
+        if constexpr (sizeof(T) == 4) {
+            index = _mm512_add_epi32(index, step);
+        } else {
+            index = _mm512_add_epi64(index, step);
+        }
+    }
+    alignas(64) index_t min_indices[lanes], max_indices[lanes];
+    _mm512_store_si512(min_indices, lowest_index);
+    _mm512_store_si512(max_indices, highest_index);
+    auto result = merge_lanes(a, min_indices, max_indices, lanes);
+    minmax_tail(a, i, n, result);
+    return result;
+}
+
+template <class T>
+    requires(sizeof(T) == 4 or sizeof(T) == 8)
+inline minmax_indices minmax_avx512(const T *a, std::size_t n) {
+    return minmax_blocks<T>(a, n, minmax_block_avx512<T>);
+}
+
+// Copies with non-temporal stores: a store of a whole cache line goes to memory through a write combining buffer,
+// without reading the line first (a normal store reads every destination line before it writes it, 3 transfers for
+// every line instead of 2) and without evicting other lines from the caches. The stores need a destination aligned to
+// the vector, the unaligned ends are copied with memmove. Each step copies a few lines from 4 pages instead of the
+// next lines of one page, which keeps more DRAM pages open and was about 40% faster than a linear copy. The source
+// is not prefetched, the hardware prefetcher follows the 4 streams, and prefetchnta made the copy slower. The stores
+// are weakly ordered, sfence makes them visible before we return.
+SIMD_TARGET_AVX512 inline void stream_copy_avx512(void *destination, const void *source, std::size_t bytes) {
+    auto dst = static_cast<unsigned char *>(destination);
+    auto src = static_cast<const unsigned char *>(source);
+    if (stream_copy_overlaps(dst, src, bytes)) {
+        std::memmove(dst, src, bytes);
+        return;
+    }
+    std::size_t head = (64 - reinterpret_cast<std::uintptr_t>(dst) % 64) % 64;
+    head = head < bytes ? head : bytes;
+    std::memmove(dst, src, head);
+    std::size_t i = head;
+    for (; i + stream_copy_pages * stream_copy_page <= bytes; i += stream_copy_pages * stream_copy_page) {
+        for (std::size_t line = 0; line < stream_copy_page; line += 128) {
+            for (std::size_t page = 0; page < stream_copy_pages; ++page) {
+                std::size_t offset = i + page * stream_copy_page + line;
+                __m512i v0 = _mm512_loadu_si512(src + offset);
+                __m512i v1 = _mm512_loadu_si512(src + offset + 64);
+                _mm512_stream_si512(reinterpret_cast<__m512i *>(dst + offset), v0);
+                _mm512_stream_si512(reinterpret_cast<__m512i *>(dst + offset + 64), v1);
+            }
+        }
+    }
+    for (; i + 64 <= bytes; i += 64) {
+        _mm512_stream_si512(reinterpret_cast<__m512i *>(dst + i), _mm512_loadu_si512(src + i));
+    }
+    _mm_sfence();
+    std::memmove(dst + i, src + i, bytes - i);
+}
+
+// 16 elements of a row as floats.
+template <row_format F>
+SIMD_TARGET_AVX512 inline __m512 load_row_avx512(const row_storage_t<F> *p) {
+    if constexpr (F == row_format::f32) {
+        return _mm512_loadu_ps(p);
+    } else {
+        __m256i bits = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        if constexpr (F == row_format::f16) {
+            return _mm512_cvtph_ps(bits);
+        } else {
+            return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(bits), 16));
+        }
+    }
+}
+
+// The last count < 16 elements of a row, the other lanes are 0.
+template <row_format F>
+SIMD_TARGET_AVX512 inline __m512 load_row_tail_avx512(const row_storage_t<F> *p, std::size_t count) {
+    if constexpr (F == row_format::f32) {
+        return _mm512_maskz_loadu_ps(static_cast<__mmask16>((1u << count) - 1), p);
+    } else {
+        // AVX-512F has no masked loads of 16 bit elements
+        row_storage_t<F> buffer[16] = {};
+        std::memcpy(buffer, p, count * sizeof(row_storage_t<F>));
+        return load_row_avx512<F>(buffer);
+    }
+}
+
+// Four rows at a time share every load of x, and each of them has two accumulators, so 8 FMAs can be in flight. The
+// rows that don't make a group of four go one at a time.
+template <row_format F>
+SIMD_TARGET_AVX512 inline void dot_rows_avx512(const row_storage_t<F> *const *rows, std::size_t num_rows, std::size_t n,
+                                               const float *x, float *y) {
+    std::size_t r = 0;
+    for (; r + 4 <= num_rows; r += 4) {
+        const auto *a0 = rows[r], *a1 = rows[r + 1], *a2 = rows[r + 2], *a3 = rows[r + 3];
+        __m512 acc00 = _mm512_setzero_ps(), acc01 = _mm512_setzero_ps(), acc10 = _mm512_setzero_ps(),
+               acc11 = _mm512_setzero_ps(), acc20 = _mm512_setzero_ps(), acc21 = _mm512_setzero_ps(),
+               acc30 = _mm512_setzero_ps(), acc31 = _mm512_setzero_ps();
+        std::size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            __m512 x0 = _mm512_loadu_ps(x + i), x1 = _mm512_loadu_ps(x + i + 16);
+            acc00 = _mm512_fmadd_ps(load_row_avx512<F>(a0 + i), x0, acc00);
+            acc01 = _mm512_fmadd_ps(load_row_avx512<F>(a0 + i + 16), x1, acc01);
+            acc10 = _mm512_fmadd_ps(load_row_avx512<F>(a1 + i), x0, acc10);
+            acc11 = _mm512_fmadd_ps(load_row_avx512<F>(a1 + i + 16), x1, acc11);
+            acc20 = _mm512_fmadd_ps(load_row_avx512<F>(a2 + i), x0, acc20);
+            acc21 = _mm512_fmadd_ps(load_row_avx512<F>(a2 + i + 16), x1, acc21);
+            acc30 = _mm512_fmadd_ps(load_row_avx512<F>(a3 + i), x0, acc30);
+            acc31 = _mm512_fmadd_ps(load_row_avx512<F>(a3 + i + 16), x1, acc31);
+        }
+        for (; i + 16 <= n; i += 16) {
+            __m512 x0 = _mm512_loadu_ps(x + i);
+            acc00 = _mm512_fmadd_ps(load_row_avx512<F>(a0 + i), x0, acc00);
+            acc10 = _mm512_fmadd_ps(load_row_avx512<F>(a1 + i), x0, acc10);
+            acc20 = _mm512_fmadd_ps(load_row_avx512<F>(a2 + i), x0, acc20);
+            acc30 = _mm512_fmadd_ps(load_row_avx512<F>(a3 + i), x0, acc30);
+        }
+        if (i != n) {
+            __m512 x0 = _mm512_maskz_loadu_ps(static_cast<__mmask16>((1u << (n - i)) - 1), x + i);
+            acc01 = _mm512_fmadd_ps(load_row_tail_avx512<F>(a0 + i, n - i), x0, acc01);
+            acc11 = _mm512_fmadd_ps(load_row_tail_avx512<F>(a1 + i, n - i), x0, acc11);
+            acc21 = _mm512_fmadd_ps(load_row_tail_avx512<F>(a2 + i, n - i), x0, acc21);
+            acc31 = _mm512_fmadd_ps(load_row_tail_avx512<F>(a3 + i, n - i), x0, acc31);
+        }
+        y[r] += _mm512_reduce_add_ps(_mm512_add_ps(acc00, acc01));
+        y[r + 1] += _mm512_reduce_add_ps(_mm512_add_ps(acc10, acc11));
+        y[r + 2] += _mm512_reduce_add_ps(_mm512_add_ps(acc20, acc21));
+        y[r + 3] += _mm512_reduce_add_ps(_mm512_add_ps(acc30, acc31));
+    }
+    for (; r < num_rows; ++r) {
+        const auto *a = rows[r];
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+        std::size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            acc0 = _mm512_fmadd_ps(load_row_avx512<F>(a + i), _mm512_loadu_ps(x + i), acc0);
+            acc1 = _mm512_fmadd_ps(load_row_avx512<F>(a + i + 16), _mm512_loadu_ps(x + i + 16), acc1);
+        }
+        for (; i + 16 <= n; i += 16) {
+            acc0 = _mm512_fmadd_ps(load_row_avx512<F>(a + i), _mm512_loadu_ps(x + i), acc0);
+        }
+        if (i != n) {
+            __m512 x0 = _mm512_maskz_loadu_ps(static_cast<__mmask16>((1u << (n - i)) - 1), x + i);
+            acc1 = _mm512_fmadd_ps(load_row_tail_avx512<F>(a + i, n - i), x0, acc1);
+        }
+        y[r] += _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    }
+}
+#endif
+
+#if defined(SIMD_HAS_AVX2)
+// AVX2 has no mask registers, maskload uses the sign bit of each 32 bit lane instead.
+// Loading 8 lanes starting at tail_mask_table + 8 - r gives r lanes of -1 followed by 0s.
+alignas(64) inline constexpr int tail_mask_table[16] = {-1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0};
+
+SIMD_TARGET_AVX2 inline float horizontal_sum(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+SIMD_TARGET_AVX2 inline double horizontal_sum(__m256d v) {
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    sum = _mm_add_sd(sum, _mm_unpackhi_pd(sum, sum));
+    return _mm_cvtsd_f64(sum);
+}
+
+SIMD_TARGET_AVX2 inline __m256i tail_mask(std::size_t lanes_32) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tail_mask_table + 8 - lanes_32));
+}
+
+SIMD_TARGET_AVX2 inline float dot_avx2(const float *a, const float *b, std::size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    if (i != n) {
+        auto mask = tail_mask(n - i);
+        acc1 = _mm256_fmadd_ps(_mm256_maskload_ps(a + i, mask), _mm256_maskload_ps(b + i, mask), acc1);
+    }
+    return horizontal_sum(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+}
+
+SIMD_TARGET_AVX2 inline double dot_avx2(const double *a, const double *b, std::size_t n) {
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd(), acc2 = _mm256_setzero_pd(), acc3 = _mm256_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc0);
+        acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), acc1);
+        acc2 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 8), _mm256_loadu_pd(b + i + 8), acc2);
+        acc3 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 12), _mm256_loadu_pd(b + i + 12), acc3);
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc0);
+    }
+    if (i != n) {
+        // each 64 bit lane needs two 32 bit lanes of -1
+        auto mask = tail_mask(2 * (n - i));
+        acc1 = _mm256_fmadd_pd(_mm256_maskload_pd(a + i, mask), _mm256_maskload_pd(b + i, mask), acc1);
+    }
+    return horizontal_sum(_mm256_add_pd(_mm256_add_pd(acc0, acc1), _mm256_add_pd(acc2, acc3)));
+}
+
+SIMD_TARGET_AVX2 inline float sum_avx2(const float *a, std::size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps(), acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_add_ps(_mm256_loadu_ps(a + i), acc0);
+        acc1 = _mm256_add_ps(_mm256_loadu_ps(a + i + 8), acc1);
+        acc2 = _mm256_add_ps(_mm256_loadu_ps(a + i + 16), acc2);
+        acc3 = _mm256_add_ps(_mm256_loadu_ps(a + i + 24), acc3);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_ps(_mm256_loadu_ps(a + i), acc0);
+    }
+    if (i != n) {
+        acc1 = _mm256_add_ps(_mm256_maskload_ps(a + i, tail_mask(n - i)), acc1);
+    }
+    return horizontal_sum(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+}
+
+SIMD_TARGET_AVX2 inline double sum_avx2(const double *a, std::size_t n) {
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd(), acc2 = _mm256_setzero_pd(), acc3 = _mm256_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_add_pd(_mm256_loadu_pd(a + i), acc0);
+        acc1 = _mm256_add_pd(_mm256_loadu_pd(a + i + 4), acc1);
+        acc2 = _mm256_add_pd(_mm256_loadu_pd(a + i + 8), acc2);
+        acc3 = _mm256_add_pd(_mm256_loadu_pd(a + i + 12), acc3);
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm256_add_pd(_mm256_loadu_pd(a + i), acc0);
+    }
+    if (i != n) {
+        acc1 = _mm256_add_pd(_mm256_maskload_pd(a + i, tail_mask(2 * (n - i))), acc1);
+    }
+    return horizontal_sum(_mm256_add_pd(_mm256_add_pd(acc0, acc1), _mm256_add_pd(acc2, acc3)));
+}
+
+template <class T>
+SIMD_TARGET_AVX2 inline __m256i broadcast_avx2(T value) {
+    if constexpr (sizeof(T) == 1) {
+        return _mm256_set1_epi8(std::bit_cast<char>(value));
+    } else if constexpr (sizeof(T) == 2) {
+        return _mm256_set1_epi16(std::bit_cast<short>(value));
+    } else if constexpr (sizeof(T) == 4) {
+        return _mm256_set1_epi32(std::bit_cast<int>(value));
+    } else {
+        return _mm256_set1_epi64x(std::bit_cast<long long>(value));
+    }
+}
+
+// Compares the 32 bytes at p with the needle, 32, 16, 8 or 4 elements at a time depending on their size.
+// movemask gives one bit for each byte, so an element that matched sets sizeof(T) bits and the lowest set bit divided
+// by sizeof(T) is the first element that matched.
+template <class T>
+SIMD_TARGET_AVX2 inline unsigned equal_bytes_avx2(const T *p, __m256i needle) {
+    auto data = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    __m256i equal;
+    if constexpr (std::same_as<T, float>) {
+        equal = _mm256_castps_si256(_mm256_cmp_ps(_mm256_castsi256_ps(data), _mm256_castsi256_ps(needle), _CMP_EQ_OQ));
+    } else if constexpr (std::same_as<T, double>) {
+        equal = _mm256_castpd_si256(_mm256_cmp_pd(_mm256_castsi256_pd(data), _mm256_castsi256_pd(needle), _CMP_EQ_OQ));
+    } else if constexpr (sizeof(T) == 1) {
+        equal = _mm256_cmpeq_epi8(data, needle);
+    } else if constexpr (sizeof(T) == 2) {
+        equal = _mm256_cmpeq_epi16(data, needle);
+    } else if constexpr (sizeof(T) == 4) {
+        equal = _mm256_cmpeq_epi32(data, needle);
+    } else {
+        equal = _mm256_cmpeq_epi64(data, needle);
+    }
+    return static_cast<unsigned>(_mm256_movemask_epi8(equal));
+}
+
+template <class T>
+SIMD_TARGET_AVX2 inline const T *find_avx2(const T *first, const T *last, T value) {
+    constexpr std::ptrdiff_t lanes = 32 / sizeof(T);
+    const __m256i needle = broadcast_avx2(value);
+    for (; last - first >= lanes; first += lanes) {
+        auto found = equal_bytes_avx2(first, needle);
+        if (found != 0) {
+            return first + std::countr_zero(found) / sizeof(T);
+        }
+    }
+    return find_scalar(first, last, value);
+}
+
+// precondition: value is found at or after first
+template <class T>
+SIMD_TARGET_AVX2 SIMD_NO_SANITIZE inline const T *find_unbounded_avx2(const T *first, T value) {
+    const __m256i needle = broadcast_avx2(value);
+    // start at the 32 byte boundary before first and ignore the bytes before it, from then on every load is aligned
+    auto address = reinterpret_cast<std::uintptr_t>(first);
+    auto skipped = address % 32;
+    auto block = reinterpret_cast<const T *>(address - skipped);
+    auto found = equal_bytes_avx2(block, needle) & (~0u << skipped);
+    while (found == 0) {
+        block += 32 / sizeof(T);
+        found = equal_bytes_avx2(block, needle);
+    }
+    return block + std::countr_zero(found) / sizeof(T);
+}
+// AVX2 compares into vectors of all ones or all zeros, and has only signed integer comparisons: flipping the sign bit
+// maps the unsigned order to the signed one.
+template <class T>
+SIMD_TARGET_AVX2 inline __m256i less_lanes_avx2(__m256i x, __m256i y) {
+    if constexpr (std::same_as<T, float>) {
+        return _mm256_castps_si256(_mm256_cmp_ps(_mm256_castsi256_ps(x), _mm256_castsi256_ps(y), _CMP_LT_OQ));
+    } else if constexpr (std::same_as<T, double>) {
+        return _mm256_castpd_si256(_mm256_cmp_pd(_mm256_castsi256_pd(x), _mm256_castsi256_pd(y), _CMP_LT_OQ));
+    } else if constexpr (sizeof(T) == 4) {
+        if constexpr (std::unsigned_integral<T>) {
+            auto sign = _mm256_set1_epi32(std::numeric_limits<int>::min());
+            x = _mm256_xor_si256(x, sign);
+            y = _mm256_xor_si256(y, sign);
+        }
+        return _mm256_cmpgt_epi32(y, x);
+    } else {
+        if constexpr (std::unsigned_integral<T>) {
+            auto sign = _mm256_set1_epi64x(std::numeric_limits<long long>::min());
+            x = _mm256_xor_si256(x, sign);
+            y = _mm256_xor_si256(y, sign);
+        }
+        return _mm256_cmpgt_epi64(y, x);
+    }
+}
+
+// precondition: 0 < n <= 2^31
+template <class T>
+    requires(sizeof(T) == 4 or sizeof(T) == 8)
+SIMD_TARGET_AVX2 inline minmax_indices minmax_block_avx2(const T *a, std::size_t n) {
+    constexpr std::size_t lanes = 32 / sizeof(T);
+    using index_t = std::conditional_t<sizeof(T) == 4, std::uint32_t, std::uint64_t>;
+    auto lowest = broadcast_avx2(a[0]), highest = lowest;
+    auto lowest_index = _mm256_setzero_si256(), highest_index = lowest_index;
+    const auto all_ones = _mm256_set1_epi32(-1);
+    __m256i index, step;
+    if constexpr (sizeof(T) == 4) {
+        index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        step = _mm256_set1_epi32(lanes);
+    } else {
+        index = _mm256_setr_epi64x(0, 1, 2, 3);
+        step = _mm256_set1_epi64x(lanes);
+    }
+    std::size_t i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        auto lower = less_lanes_avx2<T>(x, lowest);
+        auto not_lower = _mm256_xor_si256(less_lanes_avx2<T>(x, highest), all_ones);
+        // the comparisons set whole lanes, so selecting bytes selects lanes
+        lowest = _mm256_blendv_epi8(lowest, x, lower);
+        lowest_index = _mm256_blendv_epi8(lowest_index, index, lower);
+        highest = _mm256_blendv_epi8(highest, x, not_lower);
+        highest_index = _mm256_blendv_epi8(highest_index, index, not_lower);
+        if constexpr (sizeof(T) == 4) {
+            index = _mm256_add_epi32(index, step);
+        } else {
+            index = _mm256_add_epi64(index, step);
+        }
+    }
+    alignas(32) index_t min_indices[lanes], max_indices[lanes];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(min_indices), lowest_index);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(max_indices), highest_index);
+    auto result = merge_lanes(a, min_indices, max_indices, lanes);
+    minmax_tail(a, i, n, result);
+    return result;
+}
+
+template <class T>
+    requires(sizeof(T) == 4 or sizeof(T) == 8)
+inline minmax_indices minmax_avx2(const T *a, std::size_t n) {
+    return minmax_blocks<T>(a, n, minmax_block_avx2<T>);
+}
+
+// As stream_copy_avx512, with stores of half a cache line.
+SIMD_TARGET_AVX2 inline void stream_copy_avx2(void *destination, const void *source, std::size_t bytes) {
+    auto dst = static_cast<unsigned char *>(destination);
+    auto src = static_cast<const unsigned char *>(source);
+    if (stream_copy_overlaps(dst, src, bytes)) {
+        std::memmove(dst, src, bytes);
+        return;
+    }
+    std::size_t head = (32 - reinterpret_cast<std::uintptr_t>(dst) % 32) % 32;
+    head = head < bytes ? head : bytes;
+    std::memmove(dst, src, head);
+    std::size_t i = head;
+    for (; i + stream_copy_pages * stream_copy_page <= bytes; i += stream_copy_pages * stream_copy_page) {
+        for (std::size_t line = 0; line < stream_copy_page; line += 128) {
+            for (std::size_t page = 0; page < stream_copy_pages; ++page) {
+                std::size_t offset = i + page * stream_copy_page + line;
+                __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + offset));
+                __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + offset + 32));
+                __m256i v2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + offset + 64));
+                __m256i v3 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + offset + 96));
+                _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + offset), v0);
+                _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + offset + 32), v1);
+                _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + offset + 64), v2);
+                _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + offset + 96), v3);
+            }
+        }
+    }
+    for (; i + 32 <= bytes; i += 32) {
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + i),
+                            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i)));
+    }
+    _mm_sfence();
+    std::memmove(dst + i, src + i, bytes - i);
+}
+
+// The dot_rows kernels also convert float16 with F16C, which every cpu with AVX2 has, see make_kernel_table.
+template <row_format F>
+SIMD_TARGET_AVX2_F16C inline __m256 load_row_avx2(const row_storage_t<F> *p) {
+    if constexpr (F == row_format::f32) {
+        return _mm256_loadu_ps(p);
+    } else {
+        __m128i bits = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        if constexpr (F == row_format::f16) {
+            return _mm256_cvtph_ps(bits);
+        } else {
+            return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(bits), 16));
+        }
+    }
+}
+
+template <row_format F>
+SIMD_TARGET_AVX2_F16C inline __m256 load_row_tail_avx2(const row_storage_t<F> *p, std::size_t count) {
+    if constexpr (F == row_format::f32) {
+        return _mm256_maskload_ps(p, tail_mask(count));
+    } else {
+        row_storage_t<F> buffer[8] = {};
+        std::memcpy(buffer, p, count * sizeof(row_storage_t<F>));
+        return load_row_avx2<F>(buffer);
+    }
+}
+
+// As dot_rows_avx512, with 8 lanes.
+template <row_format F>
+SIMD_TARGET_AVX2_F16C inline void dot_rows_avx2(const row_storage_t<F> *const *rows, std::size_t num_rows, std::size_t n,
+                                                const float *x, float *y) {
+    std::size_t r = 0;
+    for (; r + 4 <= num_rows; r += 4) {
+        const auto *a0 = rows[r], *a1 = rows[r + 1], *a2 = rows[r + 2], *a3 = rows[r + 3];
+        __m256 acc00 = _mm256_setzero_ps(), acc01 = _mm256_setzero_ps(), acc10 = _mm256_setzero_ps(),
+               acc11 = _mm256_setzero_ps(), acc20 = _mm256_setzero_ps(), acc21 = _mm256_setzero_ps(),
+               acc30 = _mm256_setzero_ps(), acc31 = _mm256_setzero_ps();
+        std::size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m256 x0 = _mm256_loadu_ps(x + i), x1 = _mm256_loadu_ps(x + i + 8);
+            acc00 = _mm256_fmadd_ps(load_row_avx2<F>(a0 + i), x0, acc00);
+            acc01 = _mm256_fmadd_ps(load_row_avx2<F>(a0 + i + 8), x1, acc01);
+            acc10 = _mm256_fmadd_ps(load_row_avx2<F>(a1 + i), x0, acc10);
+            acc11 = _mm256_fmadd_ps(load_row_avx2<F>(a1 + i + 8), x1, acc11);
+            acc20 = _mm256_fmadd_ps(load_row_avx2<F>(a2 + i), x0, acc20);
+            acc21 = _mm256_fmadd_ps(load_row_avx2<F>(a2 + i + 8), x1, acc21);
+            acc30 = _mm256_fmadd_ps(load_row_avx2<F>(a3 + i), x0, acc30);
+            acc31 = _mm256_fmadd_ps(load_row_avx2<F>(a3 + i + 8), x1, acc31);
+        }
+        for (; i + 8 <= n; i += 8) {
+            __m256 x0 = _mm256_loadu_ps(x + i);
+            acc00 = _mm256_fmadd_ps(load_row_avx2<F>(a0 + i), x0, acc00);
+            acc10 = _mm256_fmadd_ps(load_row_avx2<F>(a1 + i), x0, acc10);
+            acc20 = _mm256_fmadd_ps(load_row_avx2<F>(a2 + i), x0, acc20);
+            acc30 = _mm256_fmadd_ps(load_row_avx2<F>(a3 + i), x0, acc30);
+        }
+        if (i != n) {
+            __m256 x0 = _mm256_maskload_ps(x + i, tail_mask(n - i));
+            acc01 = _mm256_fmadd_ps(load_row_tail_avx2<F>(a0 + i, n - i), x0, acc01);
+            acc11 = _mm256_fmadd_ps(load_row_tail_avx2<F>(a1 + i, n - i), x0, acc11);
+            acc21 = _mm256_fmadd_ps(load_row_tail_avx2<F>(a2 + i, n - i), x0, acc21);
+            acc31 = _mm256_fmadd_ps(load_row_tail_avx2<F>(a3 + i, n - i), x0, acc31);
+        }
+        y[r] += horizontal_sum(_mm256_add_ps(acc00, acc01));
+        y[r + 1] += horizontal_sum(_mm256_add_ps(acc10, acc11));
+        y[r + 2] += horizontal_sum(_mm256_add_ps(acc20, acc21));
+        y[r + 3] += horizontal_sum(_mm256_add_ps(acc30, acc31));
+    }
+    for (; r < num_rows; ++r) {
+        const auto *a = rows[r];
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        std::size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            acc0 = _mm256_fmadd_ps(load_row_avx2<F>(a + i), _mm256_loadu_ps(x + i), acc0);
+            acc1 = _mm256_fmadd_ps(load_row_avx2<F>(a + i + 8), _mm256_loadu_ps(x + i + 8), acc1);
+        }
+        for (; i + 8 <= n; i += 8) {
+            acc0 = _mm256_fmadd_ps(load_row_avx2<F>(a + i), _mm256_loadu_ps(x + i), acc0);
+        }
+        if (i != n) {
+            __m256 x0 = _mm256_maskload_ps(x + i, tail_mask(n - i));
+            acc1 = _mm256_fmadd_ps(load_row_tail_avx2<F>(a + i, n - i), x0, acc1);
+        }
+        y[r] += horizontal_sum(_mm256_add_ps(acc0, acc1));
+    }
+}
+#endif
+
+#if defined(SIMD_HAS_NEON)
+// NEON has no masked loads, the tail is processed with scalar code
+inline float dot_neon(const float *a, const float *b, std::size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0), acc2 = vdupq_n_f32(0), acc3 = vdupq_n_f32(0);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        acc2 = vfmaq_f32(acc2, vld1q_f32(a + i + 8), vld1q_f32(b + i + 8));
+        acc3 = vfmaq_f32(acc3, vld1q_f32(a + i + 12), vld1q_f32(b + i + 12));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float sum = vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+    for (; i != n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+inline double dot_neon(const double *a, const double *b, std::size_t n) {
+    float64x2_t acc0 = vdupq_n_f64(0), acc1 = vdupq_n_f64(0), acc2 = vdupq_n_f64(0), acc3 = vdupq_n_f64(0);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f64(acc0, vld1q_f64(a + i), vld1q_f64(b + i));
+        acc1 = vfmaq_f64(acc1, vld1q_f64(a + i + 2), vld1q_f64(b + i + 2));
+        acc2 = vfmaq_f64(acc2, vld1q_f64(a + i + 4), vld1q_f64(b + i + 4));
+        acc3 = vfmaq_f64(acc3, vld1q_f64(a + i + 6), vld1q_f64(b + i + 6));
+    }
+    for (; i + 2 <= n; i += 2) {
+        acc0 = vfmaq_f64(acc0, vld1q_f64(a + i), vld1q_f64(b + i));
+    }
+    double sum = vaddvq_f64(vaddq_f64(vaddq_f64(acc0, acc1), vaddq_f64(acc2, acc3)));
+    for (; i != n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+inline float sum_neon(const float *a, std::size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0), acc2 = vdupq_n_f32(0), acc3 = vdupq_n_f32(0);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = vaddq_f32(acc0, vld1q_f32(a + i));
+        acc1 = vaddq_f32(acc1, vld1q_f32(a + i + 4));
+        acc2 = vaddq_f32(acc2, vld1q_f32(a + i + 8));
+        acc3 = vaddq_f32(acc3, vld1q_f32(a + i + 12));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = vaddq_f32(acc0, vld1q_f32(a + i));
+    }
+    float sum = vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+    for (; i != n; ++i) {
+        sum += a[i];
+    }
+    return sum;
+}
+
+inline double sum_neon(const double *a, std::size_t n) {
+    float64x2_t acc0 = vdupq_n_f64(0), acc1 = vdupq_n_f64(0), acc2 = vdupq_n_f64(0), acc3 = vdupq_n_f64(0);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vaddq_f64(acc0, vld1q_f64(a + i));
+        acc1 = vaddq_f64(acc1, vld1q_f64(a + i + 2));
+        acc2 = vaddq_f64(acc2, vld1q_f64(a + i + 4));
+        acc3 = vaddq_f64(acc3, vld1q_f64(a + i + 6));
+    }
+    for (; i + 2 <= n; i += 2) {
+        acc0 = vaddq_f64(acc0, vld1q_f64(a + i));
+    }
+    double sum = vaddvq_f64(vaddq_f64(vaddq_f64(acc0, acc1), vaddq_f64(acc2, acc3)));
+    for (; i != n; ++i) {
+        sum += a[i];
+    }
+    return sum;
+}
+
+// Compares the 16 bytes at p with value. NEON has no movemask, shifting each 16 bit half of the comparison right by 4
+// and narrowing it keeps 4 bits for each byte in a 64 bit integer, so the lowest set bit divided by 4 * sizeof(T) is
+// the first element that matched.
+template <class T>
+inline std::uint64_t equal_nibbles_neon(const T *p, T value) {
+    uint8x16_t equal;
+    if constexpr (std::same_as<T, float>) {
+        equal = vreinterpretq_u8_u32(vceqq_f32(vld1q_f32(p), vdupq_n_f32(value)));
+    } else if constexpr (std::same_as<T, double>) {
+        equal = vreinterpretq_u8_u64(vceqq_f64(vld1q_f64(p), vdupq_n_f64(value)));
+    } else if constexpr (sizeof(T) == 1) {
+        equal = vceqq_u8(vld1q_u8(p), vdupq_n_u8(value));
+    } else if constexpr (sizeof(T) == 2) {
+        equal = vreinterpretq_u8_u16(vceqq_u16(vld1q_u16(p), vdupq_n_u16(value)));
+    } else if constexpr (sizeof(T) == 4) {
+        equal = vreinterpretq_u8_u32(vceqq_u32(vld1q_u32(p), vdupq_n_u32(value)));
+    } else {
+        equal = vreinterpretq_u8_u64(vceqq_u64(vld1q_u64(p), vdupq_n_u64(value)));
+    }
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+}
+
+template <class T>
+inline const T *find_neon(const T *first, const T *last, T value) {
+    constexpr std::ptrdiff_t lanes = 16 / sizeof(T);
+    for (; last - first >= lanes; first += lanes) {
+        auto found = equal_nibbles_neon(first, value);
+        if (found != 0) {
+            return first + std::countr_zero(found) / (4 * sizeof(T));
+        }
+    }
+    return find_scalar(first, last, value);
+}
+
+// precondition: value is found at or after first
+template <class T>
+SIMD_NO_SANITIZE inline const T *find_unbounded_neon(const T *first, T value) {
+    auto address = reinterpret_cast<std::uintptr_t>(first);
+    auto skipped = address % 16;
+    auto block = reinterpret_cast<const T *>(address - skipped);
+    auto found = equal_nibbles_neon(block, value) & (~std::uint64_t{0} << (4 * skipped));
+    while (found == 0) {
+        block += 16 / sizeof(T);
+        found = equal_nibbles_neon(block, value);
+    }
+    return block + std::countr_zero(found) / (4 * sizeof(T));
+}
+// NEON compares into vectors of all ones or all zeros like AVX2, and has signed, unsigned and floating point
+// comparisons for 32 and 64 bit lanes. The data and the indices are kept as unsigned vectors of the element size.
+template <class T>
+inline auto less_lanes_neon(auto x, auto y) {
+    if constexpr (std::same_as<T, float>) {
+        return vcltq_f32(vreinterpretq_f32_u32(x), vreinterpretq_f32_u32(y));
+    } else if constexpr (std::same_as<T, double>) {
+        return vcltq_f64(vreinterpretq_f64_u64(x), vreinterpretq_f64_u64(y));
+    } else if constexpr (sizeof(T) == 4 and std::signed_integral<T>) {
+        return vcltq_s32(vreinterpretq_s32_u32(x), vreinterpretq_s32_u32(y));
+    } else if constexpr (sizeof(T) == 4) {
+        return vcltq_u32(x, y);
+    } else if constexpr (std::signed_integral<T>) {
+        return vcltq_s64(vreinterpretq_s64_u64(x), vreinterpretq_s64_u64(y));
+    } else {
+        return vcltq_u64(x, y);
+    }
+}
+
+// precondition: 0 < n <= 2^31
+template <class T>
+    requires(sizeof(T) == 4 or sizeof(T) == 8)
+inline minmax_indices minmax_block_neon(const T *a, std::size_t n) {
+    constexpr std::size_t lanes = 16 / sizeof(T);
+    std::size_t i = 0;
+    minmax_indices result;
+    if constexpr (sizeof(T) == 4) {
+        auto data = reinterpret_cast<const std::uint32_t *>(a);
+        auto lowest = vdupq_n_u32(data[0]), highest = lowest;
+        auto lowest_index = vdupq_n_u32(0), highest_index = lowest_index;
+        const std::uint32_t first_indices[4] = {0, 1, 2, 3};
+        auto index = vld1q_u32(first_indices);
+        for (; i + lanes <= n; i += lanes) {
+            auto x = vld1q_u32(data + i);
+            auto lower = less_lanes_neon<T>(x, lowest);
+            auto not_lower = vmvnq_u32(less_lanes_neon<T>(x, highest));
+            lowest = vbslq_u32(lower, x, lowest);
+            lowest_index = vbslq_u32(lower, index, lowest_index);
+            highest = vbslq_u32(not_lower, x, highest);
+            highest_index = vbslq_u32(not_lower, index, highest_index);
+            index = vaddq_u32(index, vdupq_n_u32(lanes));
+        }
+        std::uint32_t min_indices[lanes], max_indices[lanes];
+        vst1q_u32(min_indices, lowest_index);
+        vst1q_u32(max_indices, highest_index);
+        result = merge_lanes(a, min_indices, max_indices, lanes);
+    } else {
+        auto data = reinterpret_cast<const std::uint64_t *>(a);
+        auto lowest = vdupq_n_u64(data[0]), highest = lowest;
+        auto lowest_index = vdupq_n_u64(0), highest_index = lowest_index;
+        const std::uint64_t first_indices[2] = {0, 1};
+        auto index = vld1q_u64(first_indices);
+        // there is no vmvnq_u64
+        const auto all_ones = vdupq_n_u64(~std::uint64_t{0});
+        for (; i + lanes <= n; i += lanes) {
+            auto x = vld1q_u64(data + i);
+            auto lower = less_lanes_neon<T>(x, lowest);
+            auto not_lower = veorq_u64(less_lanes_neon<T>(x, highest), all_ones);
+            lowest = vbslq_u64(lower, x, lowest);
+            lowest_index = vbslq_u64(lower, index, lowest_index);
+            highest = vbslq_u64(not_lower, x, highest);
+            highest_index = vbslq_u64(not_lower, index, highest_index);
+            index = vaddq_u64(index, vdupq_n_u64(lanes));
+        }
+        std::uint64_t min_indices[lanes], max_indices[lanes];
+        vst1q_u64(min_indices, lowest_index);
+        vst1q_u64(max_indices, highest_index);
+        result = merge_lanes(a, min_indices, max_indices, lanes);
+    }
+    minmax_tail(a, i, n, result);
+    return result;
+}
+
+template <class T>
+    requires(sizeof(T) == 4 or sizeof(T) == 8)
+inline minmax_indices minmax_neon(const T *a, std::size_t n) {
+    return minmax_blocks<T>(a, n, minmax_block_neon<T>);
+}
+
+template <row_format F>
+inline float32x4_t load_row_neon(const row_storage_t<F> *p) {
+    if constexpr (F == row_format::f32) {
+        return vld1q_f32(p);
+    } else if constexpr (F == row_format::f16) {
+        return vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(p)));
+    } else {
+        return vreinterpretq_f32_u32(vshll_n_u16(vld1_u16(p), 16));
+    }
+}
+
+// As dot_rows_avx512, with 4 lanes and the tail in scalar code.
+template <row_format F>
+inline void dot_rows_neon(const row_storage_t<F> *const *rows, std::size_t num_rows, std::size_t n, const float *x,
+                          float *y) {
+    std::size_t r = 0;
+    for (; r + 4 <= num_rows; r += 4) {
+        const auto *a0 = rows[r], *a1 = rows[r + 1], *a2 = rows[r + 2], *a3 = rows[r + 3];
+        float32x4_t acc00 = vdupq_n_f32(0), acc01 = vdupq_n_f32(0), acc10 = vdupq_n_f32(0), acc11 = vdupq_n_f32(0),
+                    acc20 = vdupq_n_f32(0), acc21 = vdupq_n_f32(0), acc30 = vdupq_n_f32(0), acc31 = vdupq_n_f32(0);
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            float32x4_t x0 = vld1q_f32(x + i), x1 = vld1q_f32(x + i + 4);
+            acc00 = vfmaq_f32(acc00, load_row_neon<F>(a0 + i), x0);
+            acc01 = vfmaq_f32(acc01, load_row_neon<F>(a0 + i + 4), x1);
+            acc10 = vfmaq_f32(acc10, load_row_neon<F>(a1 + i), x0);
+            acc11 = vfmaq_f32(acc11, load_row_neon<F>(a1 + i + 4), x1);
+            acc20 = vfmaq_f32(acc20, load_row_neon<F>(a2 + i), x0);
+            acc21 = vfmaq_f32(acc21, load_row_neon<F>(a2 + i + 4), x1);
+            acc30 = vfmaq_f32(acc30, load_row_neon<F>(a3 + i), x0);
+            acc31 = vfmaq_f32(acc31, load_row_neon<F>(a3 + i + 4), x1);
+        }
+        for (; i + 4 <= n; i += 4) {
+            float32x4_t x0 = vld1q_f32(x + i);
+            acc00 = vfmaq_f32(acc00, load_row_neon<F>(a0 + i), x0);
+            acc10 = vfmaq_f32(acc10, load_row_neon<F>(a1 + i), x0);
+            acc20 = vfmaq_f32(acc20, load_row_neon<F>(a2 + i), x0);
+            acc30 = vfmaq_f32(acc30, load_row_neon<F>(a3 + i), x0);
+        }
+        float sum0 = vaddvq_f32(vaddq_f32(acc00, acc01)), sum1 = vaddvq_f32(vaddq_f32(acc10, acc11)),
+              sum2 = vaddvq_f32(vaddq_f32(acc20, acc21)), sum3 = vaddvq_f32(vaddq_f32(acc30, acc31));
+        for (; i != n; ++i) {
+            sum0 += widen<F>(a0[i]) * x[i];
+            sum1 += widen<F>(a1[i]) * x[i];
+            sum2 += widen<F>(a2[i]) * x[i];
+            sum3 += widen<F>(a3[i]) * x[i];
+        }
+        y[r] += sum0;
+        y[r + 1] += sum1;
+        y[r + 2] += sum2;
+        y[r + 3] += sum3;
+    }
+    for (; r < num_rows; ++r) {
+        const auto *a = rows[r];
+        float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            acc0 = vfmaq_f32(acc0, load_row_neon<F>(a + i), vld1q_f32(x + i));
+            acc1 = vfmaq_f32(acc1, load_row_neon<F>(a + i + 4), vld1q_f32(x + i + 4));
+        }
+        for (; i + 4 <= n; i += 4) {
+            acc0 = vfmaq_f32(acc0, load_row_neon<F>(a + i), vld1q_f32(x + i));
+        }
+        float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+        for (; i != n; ++i) {
+            sum += widen<F>(a[i]) * x[i];
+        }
+        y[r] += sum;
+    }
+}
+#endif
+
+// The searches for one element type: with a bound, and without one for find(first, std::unreachable_sentinel, value).
+template <class T>
+struct find_kernels {
+    const T *(*bounded)(const T *, const T *, T) = find_scalar<T>;
+    const T *(*unbounded)(const T *, T) = find_unbounded_scalar<T>;
+};
+
+// The kernels used for this cpu. We pay for an indirect call, but the kernels are only worth calling for ranges long
+// enough to hide it.
+// The searches only compare for equality, so integers are searched by their unsigned type of the same size.
+struct kernel_table {
+    float (*dot_f32)(const float *, const float *, std::size_t) = dot_scalar<float>;
+    double (*dot_f64)(const double *, const double *, std::size_t) = dot_scalar<double>;
+    float (*sum_f32)(const float *, std::size_t) = sum_scalar<float>;
+    double (*sum_f64)(const double *, std::size_t) = sum_scalar<double>;
+    find_kernels<std::uint8_t> find_u8;
+    find_kernels<std::uint16_t> find_u16;
+    find_kernels<std::uint32_t> find_u32;
+    find_kernels<std::uint64_t> find_u64;
+    find_kernels<float> find_f32;
+    find_kernels<double> find_f64;
+    minmax_indices (*minmax_i32)(const std::int32_t *, std::size_t) = minmax_scalar<std::int32_t>;
+    minmax_indices (*minmax_u32)(const std::uint32_t *, std::size_t) = minmax_scalar<std::uint32_t>;
+    minmax_indices (*minmax_i64)(const std::int64_t *, std::size_t) = minmax_scalar<std::int64_t>;
+    minmax_indices (*minmax_u64)(const std::uint64_t *, std::size_t) = minmax_scalar<std::uint64_t>;
+    minmax_indices (*minmax_f32)(const float *, std::size_t) = minmax_scalar<float>;
+    minmax_indices (*minmax_f64)(const double *, std::size_t) = minmax_scalar<double>;
+    void (*stream_copy)(void *, const void *, std::size_t) = stream_copy_scalar;
+    void (*dot_rows_f32)(const float *const *, std::size_t, std::size_t, const float *, float *) =
+        dot_rows_scalar<row_format::f32>;
+    void (*dot_rows_f16)(const std::uint16_t *const *, std::size_t, std::size_t, const float *, float *) =
+        dot_rows_scalar<row_format::f16>;
+    void (*dot_rows_bf16)(const std::uint16_t *const *, std::size_t, std::size_t, const float *, float *) =
+        dot_rows_scalar<row_format::bf16>;
+
+    template <class T>
+    const find_kernels<T> &find_for() const {
+        if constexpr (std::same_as<T, std::uint8_t>) {
+            return find_u8;
+        } else if constexpr (std::same_as<T, std::uint16_t>) {
+            return find_u16;
+        } else if constexpr (std::same_as<T, std::uint32_t>) {
+            return find_u32;
+        } else if constexpr (std::same_as<T, std::uint64_t>) {
+            return find_u64;
+        } else if constexpr (std::same_as<T, float>) {
+            return find_f32;
+        } else {
+            return find_f64;
+        }
+    }
+
+    template <class T>
+    auto minmax_for() const {
+        if constexpr (std::same_as<T, std::int32_t>) {
+            return minmax_i32;
+        } else if constexpr (std::same_as<T, std::uint32_t>) {
+            return minmax_u32;
+        } else if constexpr (std::same_as<T, std::int64_t>) {
+            return minmax_i64;
+        } else if constexpr (std::same_as<T, std::uint64_t>) {
+            return minmax_u64;
+        } else if constexpr (std::same_as<T, float>) {
+            return minmax_f32;
+        } else {
+            return minmax_f64;
+        }
+    }
+};
+
+inline kernel_table make_kernel_table([[maybe_unused]] isa level) {
+    kernel_table table;
+#if defined(SIMD_HAS_AVX2)
+    if (level == isa::avx2 or level == isa::avx512) {
+        table.dot_f32 = dot_avx2;
+        table.dot_f64 = dot_avx2;
+        table.sum_f32 = sum_avx2;
+        table.sum_f64 = sum_avx2;
+        table.find_u8 = {find_avx2<std::uint8_t>, find_unbounded_avx2<std::uint8_t>};
+        table.find_u16 = {find_avx2<std::uint16_t>, find_unbounded_avx2<std::uint16_t>};
+        table.find_u32 = {find_avx2<std::uint32_t>, find_unbounded_avx2<std::uint32_t>};
+        table.find_u64 = {find_avx2<std::uint64_t>, find_unbounded_avx2<std::uint64_t>};
+        table.find_f32 = {find_avx2<float>, find_unbounded_avx2<float>};
+        table.find_f64 = {find_avx2<double>, find_unbounded_avx2<double>};
+        table.minmax_i32 = minmax_avx2<std::int32_t>;
+        table.minmax_u32 = minmax_avx2<std::uint32_t>;
+        table.minmax_i64 = minmax_avx2<std::int64_t>;
+        table.minmax_u64 = minmax_avx2<std::uint64_t>;
+        table.minmax_f32 = minmax_avx2<float>;
+        table.minmax_f64 = minmax_avx2<double>;
+        table.stream_copy = stream_copy_avx2;
+        if (__builtin_cpu_supports("f16c")) {
+            table.dot_rows_f32 = dot_rows_avx2<row_format::f32>;
+            table.dot_rows_f16 = dot_rows_avx2<row_format::f16>;
+            table.dot_rows_bf16 = dot_rows_avx2<row_format::bf16>;
+        }
+    }
+#endif
+#if defined(SIMD_HAS_AVX512)
+    if (level == isa::avx512) {
+        // the 8 and 16 bit searches keep the avx2 kernels
+        table.dot_f32 = dot_avx512;
+        table.dot_f64 = dot_avx512;
+        table.sum_f32 = sum_avx512;
+        table.sum_f64 = sum_avx512;
+        table.find_u32 = {find_avx512<std::uint32_t>, find_unbounded_avx512<std::uint32_t>};
+        table.find_u64 = {find_avx512<std::uint64_t>, find_unbounded_avx512<std::uint64_t>};
+        table.find_f32 = {find_avx512<float>, find_unbounded_avx512<float>};
+        table.find_f64 = {find_avx512<double>, find_unbounded_avx512<double>};
+        table.minmax_i32 = minmax_avx512<std::int32_t>;
+        table.minmax_u32 = minmax_avx512<std::uint32_t>;
+        table.minmax_i64 = minmax_avx512<std::int64_t>;
+        table.minmax_u64 = minmax_avx512<std::uint64_t>;
+        table.minmax_f32 = minmax_avx512<float>;
+        table.minmax_f64 = minmax_avx512<double>;
+        table.stream_copy = stream_copy_avx512;
+        table.dot_rows_f32 = dot_rows_avx512<row_format::f32>;
+        table.dot_rows_f16 = dot_rows_avx512<row_format::f16>;
+        table.dot_rows_bf16 = dot_rows_avx512<row_format::bf16>;
+    }
+#endif
+#if defined(SIMD_HAS_NEON)
+    if (level == isa::neon) {
+        table.dot_f32 = dot_neon;
+        table.dot_f64 = dot_neon;
+        table.sum_f32 = sum_neon;
+        table.sum_f64 = sum_neon;
+        table.find_u8 = {find_neon<std::uint8_t>, find_unbounded_neon<std::uint8_t>};
+        table.find_u16 = {find_neon<std::uint16_t>, find_unbounded_neon<std::uint16_t>};
+        table.find_u32 = {find_neon<std::uint32_t>, find_unbounded_neon<std::uint32_t>};
+        table.find_u64 = {find_neon<std::uint64_t>, find_unbounded_neon<std::uint64_t>};
+        table.find_f32 = {find_neon<float>, find_unbounded_neon<float>};
+        table.find_f64 = {find_neon<double>, find_unbounded_neon<double>};
+        table.minmax_i32 = minmax_neon<std::int32_t>;
+        table.minmax_u32 = minmax_neon<std::uint32_t>;
+        table.minmax_i64 = minmax_neon<std::int64_t>;
+        table.minmax_u64 = minmax_neon<std::uint64_t>;
+        table.minmax_f32 = minmax_neon<float>;
+        table.minmax_f64 = minmax_neon<double>;
+        table.dot_rows_f32 = dot_rows_neon<row_format::f32>;
+        table.dot_rows_f16 = dot_rows_neon<row_format::f16>;
+        table.dot_rows_bf16 = dot_rows_neon<row_format::bf16>;
+    }
+#endif
+    return table;
+}
+
+inline const kernel_table &kernels() {
+    static const kernel_table table = make_kernel_table(active_isa());
+    return table;
+}
+
+// float, double, and also std::float32_t and std::float64_t which are distinct types with the same representation
+template <class T>
+concept dot_element = std::floating_point<T> and std::numeric_limits<T>::is_iec559 and
+                      (sizeof(T) == sizeof(float) or sizeof(T) == sizeof(double));
+
+template <class T>
+using native_t = std::conditional_t<sizeof(T) == sizeof(float), float, double>;
+
+// std::float16_t and std::bfloat16_t, the 16 bit formats of the dot_rows kernels
+template <class T>
+concept float16_element = std::floating_point<T> and sizeof(T) == 2 and std::numeric_limits<T>::digits == 11;
+
+template <class T>
+concept bfloat16_element = std::floating_point<T> and sizeof(T) == 2 and std::numeric_limits<T>::digits == 8;
+
+// float and std::float32_t, and the 16 bit formats, which the kernels sum in float
+template <class T>
+concept dot_rows_element = (dot_element<T> and sizeof(T) == sizeof(float)) or float16_element<T> or bfloat16_element<T>;
+
+template <class T>
+inline constexpr row_format row_format_of = sizeof(T) == sizeof(float) ? row_format::f32
+                                            : float16_element<T>       ? row_format::f16
+                                                                       : row_format::bf16;
+
+// any 8, 16, 32 or 64 bit integer, and the floating point types of dot_element
+template <class T>
+concept find_element = (std::integral<T> and (sizeof(T) == 1 or sizeof(T) == 2 or sizeof(T) == 4 or sizeof(T) == 8)) or
+                       dot_element<T>;
+
+// the element type of the kernels that search for T
+template <class T>
+using find_native_t = std::conditional_t<
+    std::floating_point<T>, native_t<T>,
+    std::conditional_t<sizeof(T) == 1, std::uint8_t,
+                       std::conditional_t<sizeof(T) == 2, std::uint16_t,
+                                          std::conditional_t<sizeof(T) == 4, std::uint32_t, std::uint64_t>>>>;
+
+// any 32 or 64 bit integer, and the floating point types of dot_element
+template <class T>
+concept minmax_element = (std::integral<T> and (sizeof(T) == 4 or sizeof(T) == 8)) or dot_element<T>;
+
+// the element type of the kernels that compare T, integers keep their signedness
+template <class T>
+using minmax_native_t = std::conditional_t<
+    std::floating_point<T>, native_t<T>,
+    std::conditional_t<std::signed_integral<T>, std::conditional_t<sizeof(T) == 4, std::int32_t, std::int64_t>,
+                       std::conditional_t<sizeof(T) == 4, std::uint32_t, std::uint64_t>>>;
+
+template <dot_element T>
+T dot(const T *a, const T *b, std::size_t n) {
+    auto native_a = reinterpret_cast<const native_t<T> *>(a);
+    auto native_b = reinterpret_cast<const native_t<T> *>(b);
+    if constexpr (sizeof(T) == sizeof(float)) {
+        return static_cast<T>(kernels().dot_f32(native_a, native_b, n));
+    } else {
+        return static_cast<T>(kernels().dot_f64(native_a, native_b, n));
+    }
+}
+
+template <dot_element T>
+T sum(const T *a, std::size_t n) {
+    auto native_a = reinterpret_cast<const native_t<T> *>(a);
+    if constexpr (sizeof(T) == sizeof(float)) {
+        return static_cast<T>(kernels().sum_f32(native_a, n));
+    } else {
+        return static_cast<T>(kernels().sum_f64(native_a, n));
+    }
+}
+
+template <find_element T>
+const T *find(const T *first, const T *last, T value) {
+    using U = find_native_t<T>;
+    auto native_first = reinterpret_cast<const U *>(first);
+    auto found = kernels().find_for<U>().bounded(native_first, reinterpret_cast<const U *>(last), std::bit_cast<U>(value));
+    return first + (found - native_first);
+}
+
+// precondition: value is found at or after first
+template <find_element T>
+const T *find_unbounded(const T *first, T value) {
+    using U = find_native_t<T>;
+    auto native_first = reinterpret_cast<const U *>(first);
+    auto found = kernels().find_for<U>().unbounded(native_first, std::bit_cast<U>(value));
+    return first + (found - native_first);
+}
+
+// The first minimum and the last maximum of a[0, n), ordered by operator<. NaN is not ordered, with NaNs the result
+// depends on the kernel.
+// precondition: n > 0
+template <minmax_element T>
+minmax_indices minmax(const T *a, std::size_t n) {
+    using U = minmax_native_t<T>;
+    return kernels().minmax_for<U>()(reinterpret_cast<const U *>(a), n);
+}
+
+// Copies a[0, n) to output[0, n) with the stream_copy kernel, whatever the size. Like copy, output may be before a but
+// not in a[0, n).
+template <class T>
+    requires std::is_trivially_copyable_v<T>
+void stream_copy(T *output, const T *a, std::size_t n) {
+    kernels().stream_copy(output, a, n * sizeof(T));
+}
+
+// y[r] += rows[r][0, n) . x[0, n) for every r < num_rows, summed in float. x is the vector the rows are multiplied
+// with, converted to float once for all the rows.
+template <dot_rows_element T>
+void dot_rows(const T *const *rows, std::size_t num_rows, std::size_t n, const float *x, float *y) {
+    constexpr auto format = row_format_of<T>;
+    auto native_rows = reinterpret_cast<const row_storage_t<format> *const *>(rows);
+    if constexpr (format == row_format::f32) {
+        kernels().dot_rows_f32(native_rows, num_rows, n, x, y);
+    } else if constexpr (format == row_format::f16) {
+        kernels().dot_rows_f16(native_rows, num_rows, n, x, y);
+    } else {
+        kernels().dot_rows_bf16(native_rows, num_rows, n, x, y);
+    }
+}
+
+} // namespace simd
@@ -0,0 +1,6 @@
+#define ALGORITHMS_INSTANTIATION_DEFINITIONS
+#include "../no_modules/instantiations.h"
+
+import algorithms;
+
+ALGORITHMS_INSTANTIATE_ALL()
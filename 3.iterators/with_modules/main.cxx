@@ -1,30 +1,77 @@
 #include <algorithm>
+#include <bit>
+#include <cmath>
 #include <deque>
+#include <format>
 #include <list>
+#include <memory_resource>
+#include <numeric>
+#include <print>
 #include <random>
 #include <ranges>
+#include <span>
 #include <stdfloat>
+#include <utility>
 #include <vector>
 
+#include "../no_modules/mapped_array.h"
+#include "../no_modules/report.h"
+#include "../no_modules/simd.h"
 
 import algorithms;
 import timer;
 
+// after algorithms.h: find, reduce and faster_inner_product on vectors come from instantiations.o
+#include "../no_modules/instantiations.h"
+
 void do_not_optimize(auto x) {
     [[maybe_unused]] volatile auto y = x;
 }
 
+// Where the nodes of a node based container end up in memory. A fresh heap hands out the nodes one after the other,
+// like a monotonic arena, a list that lived through many insertions and erasures has its nodes all over the place.
+enum class node_order {
+    allocation, // the nodes are linked in the order they were allocated
+    scattered,  // the nodes are linked in a random order of their addresses
+};
+
+// The values in list order don't depend on alloc or order, only where the nodes are.
+template <class T, class Dtype = typename T::value_type>
+T make_container(const std::vector<Dtype> &v, typename T::allocator_type alloc, node_order order) {
+    if constexpr (requires(T t) { t.splice(t.end(), t, t.begin()); }) {
+        if (order == node_order::scattered) {
+            // allocate the node of every position in a random order, then relink them in position order, splice
+            // doesn't move the nodes
+            auto rand = std::default_random_engine(5);
+            auto positions = std::vector<std::size_t>(v.size());
+            std::iota(positions.begin(), positions.end(), std::size_t{0});
+            std::ranges::shuffle(positions, rand);
+            T container(alloc);
+            auto nodes = std::vector<typename T::iterator>(v.size());
+            for (auto position : positions) {
+                nodes[position] = container.insert(container.end(), v[position]);
+            }
+            for (auto node : nodes) {
+                container.splice(container.end(), container, node);
+            }
+            return container;
+        }
+    }
+    return T(v.begin(), v.end(), alloc);
+}
+
 template <class T, class Dtype = typename T::value_type>
-T random_container(int size) {
+T random_container(int size, typename T::allocator_type alloc = {}, node_order order = node_order::allocation) {
     auto rand = std::default_random_engine(3);
     auto v = std::vector<Dtype>(size);
     std::iota(v.begin(), v.end(), Dtype{0});
     std::ranges::shuffle(v, rand);
-    return T(v.begin(), v.end());
+    return make_container<T>(v, alloc, order);
 }
 
 template <class T, class Dtype = typename T::value_type>
-T random_container_floating(int size) {
+T random_container_floating(int size, typename T::allocator_type alloc = {},
+                            node_order order = node_order::allocation) {
     auto rand = std::default_random_engine(3);
     std::uniform_real_distribution<Dtype> dist(static_cast<Dtype>(0.0), static_cast<Dtype>(1.0));
 
@@ -32,13 +79,33 @@ T random_container_floating(int size) {
     for (auto &val : v) {
         val = dist(rand);
     }
-    return T(v.begin(), v.end());
+    return make_container<T>(v, alloc, order);
+}
+
+// The inner products read the largest inputs. For vectors they come from mapped::dataset and can be stored in the
+// directory named by BENCH_DATA, so later runs map them instead of generating them again.
+template <class T, class V = typename T::value_type>
+auto floating_input(std::string test_name, int size) {
+    if constexpr (std::same_as<T, std::vector<V>>) {
+        auto name = std::format("uniform_{}_{}_seed3", test_name, size);
+        std::ranges::replace(name, ' ', '_');
+        return mapped::dataset<V>(name, size, [](std::span<V> out) {
+            auto rand = std::default_random_engine(3);
+            std::uniform_real_distribution<V> dist(static_cast<V>(0.0), static_cast<V>(1.0));
+            for (auto &val : out) {
+                val = dist(rand);
+            }
+        });
+    } else {
+        return random_container_floating<T>(size);
+    }
 }
 
 template <class T>
-void test_find_for_container(std::string test_name) {
+void test_find_for_container(std::string test_name, typename T::allocator_type alloc = {},
+                             node_order order = node_order::allocation) {
     constexpr auto size = 100'000;
-    auto container = random_container<T>(size);
+    auto container = random_container<T>(size, alloc, order);
 
     auto ranges_find = [&container, size]() {
         for (auto i = 0; i < size; ++i) {
@@ -65,18 +132,52 @@ void test_find_for_container(std::string test_name) {
             do_not_optimize(find(container.begin(), std::unreachable_sentinel, i));
         }
     };
-    timer::repeat(ranges_find, 1, 3, test_name + " ranges find");
-    timer::repeat(ranges_find_unreachable, 1, 3, test_name + " ranges find + unreachable");
-    timer::repeat(stl_find, 1, 3, test_name + " stl find");
-    timer::repeat(our_find, 1, 3, test_name + " our find");
-    timer::repeat(our_find_unreachable, 1, 3, test_name + " our find + unreachable");
+    // the container is a permutation, the finds of all values together compare 1 + 2 + ... + size elements
+    constexpr auto compared = std::size_t{size} * (size + 1) / 2;
+    constexpr auto find_work = timer::work{.elements = compared, .bytes = compared * sizeof(typename T::value_type)};
+    timer::repeat(ranges_find, 1, 3, test_name + " ranges find", find_work);
+    timer::repeat(ranges_find_unreachable, 1, 3, test_name + " ranges find + unreachable", find_work);
+    timer::repeat(stl_find, 1, 3, test_name + " stl find", find_work);
+    timer::repeat(our_find, 1, 3, test_name + " our find", find_work);
+    timer::repeat(our_find_unreachable, 1, 3, test_name + " our find + unreachable", find_work);
+
+    using V = typename T::value_type;
+    if constexpr (simd::find_element<V> and std::contiguous_iterator<typename T::iterator>) {
+        // each kernel the cpu supports on its own, our find uses the best one
+        using U = simd::find_native_t<V>;
+        auto first = reinterpret_cast<const U *>(std::to_address(container.begin()));
+        auto last = first + container.size();
+        auto find_with = [first, last, size](auto kernel) {
+            return [first, last, size, kernel]() {
+                for (auto i = 0; i < size; ++i) {
+                    do_not_optimize(kernel(first, last, std::bit_cast<U>(static_cast<V>(i))));
+                }
+            };
+        };
+        timer::repeat(find_with(simd::find_scalar<U>), 1, 3, test_name + " scalar find", find_work);
+#if defined(SIMD_HAS_AVX512)
+        if constexpr (sizeof(U) >= 4) {
+            if (simd::supports(simd::isa::avx512)) {
+                timer::repeat(find_with(simd::find_avx512<U>), 1, 3, test_name + " avx512 find", find_work);
+            }
+        }
+#endif
+#if defined(SIMD_HAS_AVX2)
+        if (simd::supports(simd::isa::avx2)) {
+            timer::repeat(find_with(simd::find_avx2<U>), 1, 3, test_name + " avx2 find", find_work);
+        }
+#endif
+#if defined(SIMD_HAS_NEON)
+        timer::repeat(find_with(simd::find_neon<U>), 1, 3, test_name + " neon find", find_work);
+#endif
+    }
 }
 
 template <class T>
 void test_inner_product(std::string test_name) {
     constexpr auto size = 500'000'000;
-    auto container1 = random_container_floating<T>(size);
-    auto container2 = random_container_floating<T>(size);
+    auto container1 = floating_input<T>(test_name, size);
+    auto container2 = floating_input<T>(test_name, size);
 
     auto stl_inner_product = [&container1, &container2]() {
         do_not_optimize(std::inner_product(container1.begin(), container1.end(), container2.begin(), 0.0));
@@ -90,18 +191,162 @@ void test_inner_product(std::string test_name) {
     auto our_faster_inner_product = [&container1, &container2]() {
         do_not_optimize(faster_inner_product(container1.begin(), container1.end(), container2.begin()));
     };
-    timer::repeat(stl_inner_product, 3, 3, test_name + " stl inner product");
-    timer::repeat(our_inner_product, 3, 3, test_name + " our inner product");
-    timer::repeat(our_fast_inner_product, 3, 3, test_name + " fast inner product");
-    timer::repeat(our_faster_inner_product, 3, 3, test_name + " faster inner product");
+    // lambdas are not recognized as std::multiplies and std::plus, so these use the unrolled loops without the kernels
+    using V = typename T::value_type;
+    auto multiplies = [](V x, V y) -> V { return x * y; };
+    auto plus = [](V x, V y) -> V { return x + y; };
+    auto our_fast_inner_product_generic = [&container1, &container2, multiplies, plus]() {
+        do_not_optimize(fast_reduce(container1.begin(), container1.end(), container2.begin(), V{}, multiplies, plus));
+    };
+    auto our_faster_inner_product_generic = [&container1, &container2, multiplies, plus]() {
+        do_not_optimize(faster_reduce(container1.begin(), container1.end(), container2.begin(), V{}, multiplies, plus));
+    };
+    auto our_pairwise_inner_product = [&container1, &container2]() {
+        do_not_optimize(pairwise_inner_product(container1.begin(), container1.end(), container2.begin()));
+    };
+    auto our_pairwise_inner_product_generic = [&container1, &container2, multiplies, plus]() {
+        do_not_optimize(pairwise_reduce(container1.begin(), container1.end(), container2.begin(), V{}, multiplies, plus));
+    };
+    constexpr auto inner_product_work = timer::work{.elements = size, .bytes = 2 * size * sizeof(V)};
+    timer::repeat(stl_inner_product, 3, 3, test_name + " stl inner product", inner_product_work);
+    timer::repeat(our_inner_product, 3, 3, test_name + " our inner product", inner_product_work);
+    timer::repeat(our_fast_inner_product, 3, 3, test_name + " fast inner product", inner_product_work);
+    timer::repeat(our_faster_inner_product, 3, 3, test_name + " faster inner product", inner_product_work);
+    timer::repeat(our_fast_inner_product_generic, 3, 3, test_name + " fast inner product, generic ops",
+                  inner_product_work);
+    timer::repeat(our_faster_inner_product_generic, 3, 3, test_name + " faster inner product, generic ops",
+                  inner_product_work);
+    timer::repeat(our_pairwise_inner_product, 3, 3, test_name + " pairwise inner product", inner_product_work);
+    timer::repeat(our_pairwise_inner_product_generic, 3, 3, test_name + " pairwise inner product, generic ops",
+                  inner_product_work);
+
+    // being fast is only half of the story, the sums should also be right
+    long double reference = 0.0L;
+    for (auto it1 = container1.begin(), it2 = container2.begin(); it1 != container1.end(); ++it1, ++it2) {
+        reference += static_cast<long double>(*it1) * static_cast<long double>(*it2);
+    }
+    auto print_error = [reference, &test_name](std::string name, V result) {
+        auto error = std::abs((static_cast<long double>(result) - reference) / reference);
+        std::println("{} {} relative error: {:.3e}", test_name, name, static_cast<double>(error));
+    };
+    print_error("our inner product", inner_product(container1.begin(), container1.end(), container2.begin()));
+    print_error("faster inner product", faster_inner_product(container1.begin(), container1.end(), container2.begin()));
+    print_error("faster inner product, generic ops",
+                faster_reduce(container1.begin(), container1.end(), container2.begin(), V{}, multiplies, plus));
+    print_error("pairwise inner product", pairwise_inner_product(container1.begin(), container1.end(), container2.begin()));
+    print_error("pairwise inner product, generic ops",
+                pairwise_reduce(container1.begin(), container1.end(), container2.begin(), V{}, multiplies, plus));
+
+    if constexpr (simd::dot_element<V> and std::ranges::contiguous_range<decltype(container1)>) {
+        // each kernel the cpu supports on its own, fast_inner_product and faster_inner_product use the best one
+        auto a = reinterpret_cast<const simd::native_t<V> *>(std::to_address(container1.begin()));
+        auto b = reinterpret_cast<const simd::native_t<V> *>(std::to_address(container2.begin()));
+        auto n = container1.size();
+        timer::repeat([=]() { do_not_optimize(simd::dot_scalar(a, b, n)); }, 3, 3, test_name + " scalar inner product",
+                      inner_product_work);
+#if defined(SIMD_HAS_AVX512)
+        if (simd::supports(simd::isa::avx512)) {
+            timer::repeat([=]() { do_not_optimize(simd::dot_avx512(a, b, n)); },
+                          3, 3, test_name + " avx512 fma inner product", inner_product_work);
+        }
+#endif
+#if defined(SIMD_HAS_AVX2)
+        if (simd::supports(simd::isa::avx2)) {
+            timer::repeat([=]() { do_not_optimize(simd::dot_avx2(a, b, n)); },
+                          3, 3, test_name + " avx2 fma inner product", inner_product_work);
+        }
+#endif
+#if defined(SIMD_HAS_NEON)
+        timer::repeat([=]() { do_not_optimize(simd::dot_neon(a, b, n)); }, 3, 3, test_name + " neon fma inner product",
+                      inner_product_work);
+#endif
+    }
+}
+
+// unrolled_reduce for N = 1, 2, 4, ..., 32, with one accumulator and with N of them. The lambdas keep the SIMD kernels
+// out, so this measures the unrolled loops themselves and shows which unroll factor suits V on this cpu. The values are
+// in [-1, 1), the sums of float16_t stay finite.
+template <class V>
+void test_unroll_sweep(std::string test_name) {
+    constexpr auto size = 100'000'000;
+    auto rand = std::default_random_engine(3);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<V> container1(size);
+    std::vector<V> container2(size);
+    for (std::size_t i = 0; i < container1.size(); ++i) {
+        container1[i] = static_cast<V>(dist(rand));
+        container2[i] = static_cast<V>(dist(rand));
+    }
+    constexpr auto inner_product_work = timer::work{.elements = size, .bytes = 2 * size * sizeof(V)};
+    auto run = [&]<std::size_t N, std::size_t Accumulators>() {
+        auto fn = [&container1, &container2]() {
+            do_not_optimize(unrolled_reduce<N, Accumulators>(container1.begin(), container1.end(), container2.begin(), V{},
+                                                             std::multiplies<>{}, std::plus<>{}));
+        };
+        timer::repeat(fn, 3, 3, std::format("{} unroll {}, {} accumulators", test_name, N, Accumulators),
+                      inner_product_work);
+    };
+    [&run]<std::size_t... K>(std::index_sequence<K...>) {
+        (run.template operator()<std::size_t{1} << K, 1>(), ...);
+        ([&run] {
+            if constexpr (K > 0) {
+                run.template operator()<std::size_t{1} << K, std::size_t{1} << K>();
+            }
+        }(), ...);
+    }(std::make_index_sequence<6>{});
 }
 
+// One query against a row-major matrix of 64M elements, row by row and with batch_inner_product. float16_t and
+// bfloat16_t are summed in float, with std::inner_product that is the float init.
+template <class V>
+void test_batch_inner_product(std::string test_name) {
+    constexpr std::size_t rows = 65'536;
+    constexpr std::size_t cols = 1'024;
+    auto rand = std::default_random_engine(3);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<V> matrix(rows * cols);
+    std::vector<V> query(cols);
+    for (auto &val : matrix) {
+        val = static_cast<V>(dist(rand));
+    }
+    for (auto &val : query) {
+        val = static_cast<V>(dist(rand));
+    }
+    using A = batch_accumulator_t<V>;
+    std::vector<A> scores(rows);
+
+    auto stl_rows = [&matrix, &query, &scores]() {
+        for (std::size_t r = 0; r < rows; ++r) {
+            auto row = matrix.begin() + static_cast<std::ptrdiff_t>(r * cols);
+            scores[r] = std::inner_product(row, row + cols, query.begin(), A{});
+        }
+        do_not_optimize(scores[0]);
+    };
+    auto our_batch = [&matrix, &query, &scores]() {
+        batch_inner_product(matrix, query, scores.begin());
+        do_not_optimize(scores[0]);
+    };
+    constexpr auto batch_work = timer::work{.elements = rows * cols, .bytes = rows * cols * sizeof(V)};
+    timer::repeat(stl_rows, 3, 3, test_name + " stl inner product for every row", batch_work);
+    if constexpr (simd::dot_element<V>) {
+        auto our_rows = [&matrix, &query, &scores]() {
+            for (std::size_t r = 0; r < rows; ++r) {
+                auto row = matrix.begin() + static_cast<std::ptrdiff_t>(r * cols);
+                scores[r] = faster_inner_product(row, row + cols, query.begin());
+            }
+            do_not_optimize(scores[0]);
+        };
+        timer::repeat(our_rows, 3, 3, test_name + " faster inner product for every row", batch_work);
+    }
+    timer::repeat(our_batch, 3, 3, test_name + " batch inner product", batch_work);
+}
 
 template <class T>
-void test_copy(std::string test_name) {
+void test_copy(std::string test_name, typename T::allocator_type alloc = {},
+               node_order order = node_order::allocation) {
     constexpr auto size = 250'000'000;
-    auto container1 = random_container_floating<T>(size);
-    auto container2 = random_container_floating<T>(size);
+    auto container1 = random_container_floating<T>(size, alloc, order);
+    auto container2 = random_container_floating<T>(size, alloc, order);
 
     auto stl_copy = [&container1, &container2]() {
         do_not_optimize(std::copy(container1.begin(), container1.end(), container2.begin()));
@@ -112,17 +357,56 @@ void test_copy(std::string test_name) {
     auto our_copy = [&container1, &container2]() {
         do_not_optimize(transform(container1.begin(), container1.end(), container2.begin(), std::identity{}));
     };
-    timer::repeat(stl_copy, 3, 3, test_name + " stl copy");
-    timer::repeat(ranges_copy, 3, 3, test_name + " ranges copy");
-    timer::repeat(our_copy, 3, 3, test_name + " our copy");
+    // read one container and write the other
+    constexpr auto copy_work = timer::work{.elements = size, .bytes = 2 * size * sizeof(typename T::value_type)};
+    timer::repeat(stl_copy, 3, 3, test_name + " stl copy", copy_work);
+    timer::repeat(ranges_copy, 3, 3, test_name + " ranges copy", copy_work);
+    timer::repeat(our_copy, 3, 3, test_name + " our copy", copy_work);
 }
 
-int main() {
+// The same list benchmark with the nodes in an arena, in order and scattered, and in a pool:
+// - the arena in allocation order against the vector is the cost of the links, following a pointer to the next node
+//   and reading 24 bytes of node instead of the value
+// - the scattered arena against the arena in allocation order is the cost of the scatter, every node is a cache and
+//   TLB miss once the list doesn't fit in the caches
+// - the pool is what a node based container in a long running program can get back by allocating its nodes from
+//   its own memory instead of the global heap
+// The std::list rows show where the global allocator puts the nodes, on a fresh heap they are almost contiguous.
+template <class V>
+void test_lists_by_placement(std::string type_name, auto test) {
+    using list = std::pmr::list<V>;
+    {
+        std::pmr::monotonic_buffer_resource arena;
+        test.template operator()<list>("pmr list " + type_name + " arena", &arena, node_order::allocation);
+    }
+    {
+        std::pmr::monotonic_buffer_resource arena;
+        test.template operator()<list>("pmr list " + type_name + " arena scattered", &arena, node_order::scattered);
+    }
+    {
+        std::pmr::unsynchronized_pool_resource pool;
+        test.template operator()<list>("pmr list " + type_name + " pool", &pool, node_order::allocation);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    // --output, --samples, --counters and --compare, see timer::handle_arguments
+    if (auto status = timer::handle_arguments(argc, argv)) {
+        return *status;
+    }
+    std::print("Using the {} kernels\n", simd::name(simd::active_isa()));
+    timer::report().set("simd", std::string(simd::name(simd::active_isa())));
     test_copy<std::vector<std::float32_t>>("vector i32");
     test_copy<std::list<std::float32_t>>("list i32");
+    test_lists_by_placement<std::float32_t>("f32", []<class T>(std::string name, auto... placement) {
+        test_copy<T>(name, placement...);
+    });
 
     test_find_for_container<std::vector<std::int32_t>>("vector i32");
     test_find_for_container<std::list<std::int32_t>>("list i32");
+    test_lists_by_placement<std::int32_t>("i32", []<class T>(std::string name, auto... placement) {
+        test_find_for_container<T>(name, placement...);
+    });
 
     // test_find_for_container<std::vector<std::int64_t>>("vector i64");
     // test_find_for_container<std::list<std::int64_t>>("list i64");
@@ -135,5 +419,15 @@ int main() {
 
     test_inner_product<std::vector<std::float64_t>>("vector f64");
     // // test_inner_product<std::list<std::float64_t>>("list f64");
+
+    test_unroll_sweep<std::float16_t>("vector f16");
+    test_unroll_sweep<std::float32_t>("vector f32");
+    test_unroll_sweep<std::float64_t>("vector f64");
+
+    test_batch_inner_product<std::float16_t>("matrix f16");
+#if defined(__STDCPP_BFLOAT16_T__)
+    test_batch_inner_product<std::bfloat16_t>("matrix bf16");
+#endif
+    test_batch_inner_product<std::float32_t>("matrix f32");
     // return 0;
 }
@@ -1,19 +1,30 @@
 module;
+#include <algorithm>
 #include <chrono>
 #include <concepts>
+#include <cstdint>
+#include <optional>
 #include <print>
-#include <ranges>
-#include <cmath>
+#include <string>
 #include <string_view>
+#include <vector>
 
-export module timer;
-import algorithms;
+#include "../no_modules/report.h"
 
+export module timer;
 
 namespace timer {
 
 using clock = std::chrono::high_resolution_clock;
 
+export struct options {
+    std::uint32_t samples = 10;       // number of timed samples, at least minimum_samples()
+    std::uint32_t min_iterations = 1; // calls of fn in each sample, at least
+    double min_sample_time = 0.01;    // seconds, the calibration adds calls until a sample takes at least this long
+    std::uint32_t warmup = 1;         // untimed calls before the calibration, to fill the caches and fault in the pages
+    work per_call{};
+};
+
 double time(std::invocable auto fn, std::uint32_t repeats) {
     auto start = clock::now();
     while (repeats--) {
@@ -23,20 +34,59 @@ double time(std::invocable auto fn, std::uint32_t repeats) {
     return std::chrono::duration<double>(end - start).count();
 }
 
-export void repeat(std::invocable auto fn, std::uint32_t repeats, std::uint32_t tests, std::string_view s) {
-    std::vector<double> times;
-    times.reserve(tests);
+// Calls fn a few times untimed, then doubles the number of calls in a sample until a sample takes at least
+// min_sample_time, so the clock resolution and the overhead of clock::now() don't matter, and finally times the samples.
+export inline statistics measure(std::invocable auto fn, options opts = {}) {
+    for (std::uint32_t i = 0; i < opts.warmup; ++i) {
+        fn();
+    }
+    std::uint32_t iterations = std::max(opts.min_iterations, 1u);
+    while (time(fn, iterations) < opts.min_sample_time and iterations < (1u << 30)) {
+        iterations *= 2;
+    }
 
-    while (tests--) {
-        times.push_back(time(fn, repeats));
+    auto num_samples = std::max(opts.samples, minimum_samples());
+    std::vector<double> samples;
+    samples.reserve(num_samples);
+    // the counters are read only around all the samples, reading them costs a system call
+    auto counters = hardware_counters();
+    auto before = counters ? std::optional(counters->read()) : std::nullopt;
+    for (std::uint32_t i = 0; i < num_samples; ++i) {
+        samples.push_back(time(fn, iterations) / iterations);
     }
+    auto events = counters ? std::optional(counters->read() - *before) : std::nullopt;
 
-    double mean = reduce(times.begin(), times.end()) / times.size();
-    double variance_sum = reduce(times.begin(), times.end(), 0.0, [mean](double init, double current) {
-        return init + current - mean;
-    });
+    auto stats = summarize(std::move(samples), iterations, opts.per_call);
+    if (events) {
+        stats.events = *events /= static_cast<double>(num_samples) * iterations;
+    }
+    return stats;
+}
+
+export inline void print(const statistics &stats, std::string_view s) {
+    std::print("Median is {:.6f} sec (min {:.6f}, p90 {:.6f}, p99 {:.6f}), mean is {:.6f} sec, stddev is {:.6f} sec, "
+               "{} samples x {} calls",
+               stats.median, stats.min, stats.p90, stats.p99, stats.mean, stats.stddev, stats.samples.size(),
+               stats.iterations);
+    if (stats.elements_per_second > 0.0) {
+        std::print(", {:.3f} G elements/s", stats.elements_per_second / 1e9);
+    }
+    if (stats.bytes_per_second > 0.0) {
+        std::print(", {:.3f} GB/s", stats.bytes_per_second / 1e9);
+    }
+    std::print(", {}\n", s);
+    if (stats.events) {
+        std::print("    per call: {}\n", describe(*stats.events));
+    }
+}
 
-    std::print("Mean is {:.6f} sec, stddev is {:.6f} sec, {}\n", mean, std::sqrt(variance_sum / times.size()), s);
+// Kept for the existing benchmarks: tests samples of at least repeats calls each.
+// The statistics are also added to the report, which is written at the end if the program was started with --output.
+export statistics repeat(std::invocable auto fn, std::uint32_t repeats, std::uint32_t tests, std::string_view s, work per_call = {}) {
+    auto stats = measure(fn, {.samples = tests, .min_iterations = repeats, .per_call = per_call});
+    print(stats, s);
+    report().add(std::string(s), stats);
+    return stats;
 }
 
 } // namespace timer
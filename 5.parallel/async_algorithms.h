@@ -0,0 +1,467 @@
+#pragma once
+#include <atomic>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <semaphore>
+#include <stop_token>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "parallel_algorithms.h"
+#include "thread_pool.h"
+
+// Parallel algorithms for coroutines. parallel_find_if and the others block the calling thread until all the chunks
+// finished, an event loop that calls them can't do anything else meanwhile. The versions here return an async_task
+// that the caller co_awaits: the chunks run on the pool, the awaiting coroutine is suspended without holding a thread,
+// and it resumes on the worker that finished the last chunk. A std::stop_token cancels an algorithm, its chunks stop
+// at the next block of partition_policy::cancellation_interval elements and co_await throws operation_cancelled.
+//
+//     async_task<std::size_t> position_of(std::span<const int> values, int key, std::stop_token token) {
+//         auto found = co_await async_find_if(values, [key](int x) { return x == key; }, token);
+//         co_return static_cast<std::size_t>(found - values.begin());
+//     }
+
+// What co_await on an algorithm throws when its stop_token was stopped before it finished.
+struct operation_cancelled : std::exception {
+    const char *what() const noexcept override {
+        return "operation cancelled";
+    }
+};
+
+// A coroutine that returns a T. It starts when it is awaited, and resumes the coroutine that awaits it when it returns.
+template <class T>
+class [[nodiscard]] async_task {
+public:
+    struct promise_type;
+    using handle = std::coroutine_handle<promise_type>;
+
+    struct promise_type {
+        std::coroutine_handle<> continuation = std::noop_coroutine();
+        std::optional<T> value;
+        std::exception_ptr error;
+
+        async_task get_return_object() noexcept {
+            return async_task(handle::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        auto final_suspend() noexcept {
+            // resuming the awaiting coroutine from here, instead of calling resume(), doesn't grow the stack
+            struct resume_continuation {
+                bool await_ready() noexcept {
+                    return false;
+                }
+                std::coroutine_handle<> await_suspend(handle coroutine) noexcept {
+                    return coroutine.promise().continuation;
+                }
+                void await_resume() noexcept {}
+            };
+            return resume_continuation{};
+        }
+
+        void return_value(T result) {
+            value.emplace(std::move(result));
+        }
+
+        void unhandled_exception() noexcept {
+            error = std::current_exception();
+        }
+    };
+
+    async_task(async_task &&other) noexcept : coroutine_(std::exchange(other.coroutine_, {})) {}
+
+    async_task &operator=(async_task other) noexcept {
+        std::swap(coroutine_, other.coroutine_);
+        return *this;
+    }
+
+    ~async_task() {
+        if (coroutine_) {
+            coroutine_.destroy();
+        }
+    }
+
+    auto operator co_await() && noexcept {
+        struct awaiter {
+            handle coroutine;
+
+            bool await_ready() noexcept {
+                return false;
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+                coroutine.promise().continuation = caller;
+                return coroutine;
+            }
+            T await_resume() {
+                auto &promise = coroutine.promise();
+                if (promise.error) {
+                    std::rethrow_exception(promise.error);
+                }
+                return std::move(*promise.value);
+            }
+        };
+        return awaiter{coroutine_};
+    }
+
+private:
+    explicit async_task(handle coroutine) noexcept : coroutine_(coroutine) {}
+
+    handle coroutine_;
+};
+
+namespace detail {
+
+// A coroutine that starts right away and frees itself when it returns, nobody awaits it.
+struct detached_task {
+    struct promise_type {
+        detached_task get_return_object() noexcept {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {
+            std::terminate();
+        }
+    };
+};
+
+// Starts all the tasks in await_suspend and resumes the caller when the last one returned.
+template <class T>
+struct when_all_awaitable {
+    std::vector<async_task<T>> &tasks;
+    std::vector<std::optional<T>> &values;
+    std::vector<std::exception_ptr> &errors;
+    // one more than the tasks while they are started, so they can't resume the caller before all of them started
+    std::atomic<std::size_t> remaining = 0;
+    std::coroutine_handle<> caller = {};
+
+    bool await_ready() const noexcept {
+        return tasks.empty();
+    }
+
+    bool await_suspend(std::coroutine_handle<> coroutine) {
+        caller = coroutine;
+        auto n = tasks.size();
+        remaining.store(n + 1, std::memory_order_relaxed);
+        for (std::size_t i = 0; i < n; ++i) {
+            run(i);
+        }
+        // if the tasks already returned, the caller goes on without suspending
+        return remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+
+    void await_resume() const noexcept {}
+
+    detached_task run(std::size_t i) {
+        try {
+            values[i].emplace(co_await std::move(tasks[i]));
+        } catch (...) {
+            errors[i] = std::current_exception();
+        }
+        if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            caller.resume();
+        }
+    }
+};
+
+} // namespace detail
+
+// Runs the tasks at the same time and returns their results in order. If some of them threw, the exception of the first
+// one is rethrown after all of them returned.
+template <class T>
+async_task<std::vector<T>> when_all(std::vector<async_task<T>> tasks) {
+    std::vector<std::optional<T>> values(tasks.size());
+    std::vector<std::exception_ptr> errors(tasks.size());
+    co_await detail::when_all_awaitable<T>{tasks, values, errors};
+    for (auto &error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+    std::vector<T> results;
+    results.reserve(values.size());
+    for (auto &value : values) {
+        results.push_back(std::move(*value));
+    }
+    co_return results;
+}
+
+// Runs the task and blocks the calling thread until it returns, for callers that are not coroutines. The task finishes
+// on the pool, so this must not be called from one of its workers.
+template <class T>
+T sync_wait(async_task<T> task) {
+    std::binary_semaphore done(0);
+    std::optional<T> value;
+    std::exception_ptr error;
+    // the coroutine owns the task, so it is destroyed with the coroutine, whether or not we returned already
+    [](async_task<T> task, std::binary_semaphore &done, std::optional<T> &value,
+       std::exception_ptr &error) -> detail::detached_task {
+        try {
+            value.emplace(co_await std::move(task));
+        } catch (...) {
+            error = std::current_exception();
+        }
+        done.release();
+    }(std::move(task), done, value, error);
+    done.acquire();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return std::move(*value);
+}
+
+// The awaitable version of for_each_chunk: co_await calls fn(index, chunk_first, chunk_last) for each of the
+// num_chunks chunks of [0, length) on the pool, and resumes the awaiting coroutine when all of them finished. The
+// chunks go to the same workers as in for_each_chunk, but the last one doesn't run on the calling thread, which is free
+// to run something else. A chunk that didn't start before token was stopped doesn't run. co_await rethrows the first
+// exception thrown by a chunk, and throws operation_cancelled if token was stopped.
+template <std::integral N, class Fn>
+class chunks_awaitable {
+public:
+    chunks_awaitable(thread_pool &pool, N length, std::size_t num_chunks, std::stop_token token, Fn fn)
+        : pool_(pool), length_(length), num_chunks_(num_chunks), token_(std::move(token)), fn_(std::move(fn)) {}
+
+    bool await_ready() const noexcept {
+        return token_.stop_requested();
+    }
+
+    bool await_suspend(std::coroutine_handle<> caller) {
+        caller_ = caller;
+        // one more than the chunks while they are submitted, so they can't resume the caller before all of them are
+        // submitted, and nothing here touches this after the last submission
+        remaining_.store(num_chunks_ + 1, std::memory_order_relaxed);
+        auto &pool = pool_;
+        auto num_chunks = num_chunks_;
+        for (std::size_t i = 0; i < num_chunks; ++i) {
+            pool.post_to(i * pool.size() / num_chunks, [this, i]() {
+                run_chunk(i);
+            });
+        }
+        // if the chunks already finished, the caller goes on without suspending
+        return not finish_one();
+    }
+
+    void await_resume() const {
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+        if (token_.stop_requested()) {
+            throw operation_cancelled{};
+        }
+    }
+
+private:
+    void run_chunk(std::size_t index) noexcept {
+        if (not token_.stop_requested()) {
+            try {
+                fn_(index, chunk_offset(length_, num_chunks_, index), chunk_offset(length_, num_chunks_, index + 1));
+            } catch (...) {
+                if (not failed_.exchange(true, std::memory_order_relaxed)) {
+                    error_ = std::current_exception();
+                }
+            }
+        }
+        if (finish_one()) {
+            caller_.resume();
+        }
+    }
+
+    // true for the last one, which resumes the caller
+    bool finish_one() noexcept {
+        return remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    thread_pool &pool_;
+    N length_;
+    std::size_t num_chunks_;
+    std::stop_token token_;
+    Fn fn_;
+    std::coroutine_handle<> caller_;
+    std::atomic<std::size_t> remaining_ = 0;
+    std::atomic<bool> failed_ = false;
+    std::exception_ptr error_;
+};
+
+template <std::integral N, class Fn>
+chunks_awaitable<N, Fn> for_each_chunk_async(thread_pool &pool, N length, std::size_t num_chunks, std::stop_token token,
+                                             Fn fn) {
+    return {pool, length, num_chunks, std::move(token), std::move(fn)};
+}
+
+namespace detail {
+
+// Calls fn(block_first, block_last) for the blocks of interval elements of [first, last), until fn returns false or
+// token is stopped.
+template <std::integral N, class Fn>
+void for_each_block(N first, N last, N interval, const std::stop_token &token, Fn fn) {
+    while (first != last and not token.stop_requested()) {
+        auto block_last = last - first > interval ? first + interval : last;
+        if (not fn(first, block_last)) {
+            return;
+        }
+        first = block_last;
+    }
+}
+
+} // namespace detail
+
+// parallel_find_if for coroutines. The chunks share the index of the first match like in parallel_find_if, and check
+// token before every block.
+template <std::random_access_iterator I, std::sentinel_for<I> S, class Pred>
+    requires std::indirect_unary_predicate<Pred, I>
+async_task<I> async_find_if(I first, S last, Pred pred, std::stop_token token = {},
+                            thread_pool &pool = default_thread_pool(), partition_policy policy = {}) {
+    static_assert(!std::is_same_v<S, std::unreachable_sentinel_t>,
+                  "async_find_if does not support std::unreachable_sentinel_t as the sentinel type.");
+    using N = std::iter_difference_t<I>;
+    I end = std::ranges::next(first, last);
+    auto length = std::distance(first, end);
+    if (static_cast<std::size_t>(length) < policy.sequential_threshold) {
+        // short ranges are searched right away on the calling thread. Longer ones go to the pool even as a single
+        // chunk, so the caller doesn't wait for them
+        if (token.stop_requested()) {
+            throw operation_cancelled{};
+        }
+        co_return our_find_if(first, end, pred);
+    }
+    auto num_chunks = policy.num_chunks(static_cast<std::size_t>(length), pool.size());
+    std::atomic<N> best = length;
+    auto interval = static_cast<N>(std::max<std::size_t>(policy.cancellation_interval, 1));
+    co_await for_each_chunk_async(pool, length, num_chunks, token,
+                                  [first, &best, &pred, &token, interval](std::size_t, N chunk_first, N chunk_last) {
+        detail::for_each_block(chunk_first, chunk_last, interval, token, [first, &best, &pred](N block_first, N block_last) {
+            if (best.load(std::memory_order_relaxed) < block_first) {
+                return false;
+            }
+            auto found = our_find_if(first + block_first, first + block_last, pred);
+            if (found != first + block_last) {
+                atomic_fetch_min(best, static_cast<N>(found - first));
+                return false;
+            }
+            return true;
+        });
+    });
+    co_return first + best.load(std::memory_order_relaxed);
+}
+
+// The range must outlive the task, like for a view.
+template <std::ranges::random_access_range R, class Pred, class I = std::ranges::iterator_t<R>>
+    requires std::indirect_unary_predicate<Pred, I>
+async_task<I> async_find_if(R &&range, Pred pred, std::stop_token token = {}, thread_pool &pool = default_thread_pool(),
+                            partition_policy policy = {}) {
+    return async_find_if(std::ranges::begin(range), std::ranges::end(range), std::move(pred), std::move(token), pool,
+                         policy);
+}
+
+// The parallel reduce for coroutines: each chunk is reduced separately, in blocks so it can stop after any of them,
+// and the partial results are reduced in order, so fn must be associative.
+template <std::random_access_iterator I, std::sentinel_for<I> S, class ReduceOp, class T = std::iter_value_t<I>>
+    requires returns_t<ReduceOp, T, T, T>
+async_task<T> async_reduce(I first, S last, T init, ReduceOp fn, std::stop_token token = {},
+                           thread_pool &pool = default_thread_pool(), partition_policy policy = {}) {
+    using N = std::iter_difference_t<I>;
+    I end = std::ranges::next(first, last);
+    N length = std::distance(first, end);
+    // an empty range would be a single empty chunk, which has no first element to start from
+    if (length == 0 or static_cast<std::size_t>(length) < policy.sequential_threshold) {
+        if (token.stop_requested()) {
+            throw operation_cancelled{};
+        }
+        co_return ::reduce(first, end, init, fn);
+    }
+    auto num_chunks = policy.num_chunks(static_cast<std::size_t>(length), pool.size());
+    auto interval = static_cast<N>(std::max<std::size_t>(policy.cancellation_interval, 1));
+    // the range isn't empty, so neither are the chunks: each one starts from its first element and we don't need an
+    // identity element
+    std::vector<std::optional<T>> partial(num_chunks);
+    co_await for_each_chunk_async(pool, length, num_chunks, token,
+                                  [first, &partial, &fn, &token, interval](std::size_t index, N chunk_first, N chunk_last) {
+        T acc = first[chunk_first];
+        detail::for_each_block(chunk_first + 1, chunk_last, interval, token, [first, &acc, &fn](N block_first, N block_last) {
+            acc = ::reduce(first + block_first, first + block_last, acc, fn);
+            return true;
+        });
+        partial[index] = acc;
+    });
+    for (auto &value : partial) {
+        init = fn(init, *value);
+    }
+    co_return init;
+}
+
+template <std::random_access_iterator I, std::sentinel_for<I> S, class T = std::iter_value_t<I>>
+    requires reducible<T>
+async_task<T> async_reduce(I first, S last, std::stop_token token = {}, thread_pool &pool = default_thread_pool(),
+                           partition_policy policy = {}) {
+    return async_reduce(first, last, T{}, std::plus<T>{}, std::move(token), pool, policy);
+}
+
+// parallel_find_all_of for coroutines, with the same two passes, each one a co_await.
+// precondition: output has room for all the matches
+template <std::random_access_iterator I, std::sentinel_for<I> S, std::random_access_iterator O, class Pred>
+    requires std::indirect_unary_predicate<Pred &, I> and std::indirectly_copyable<I, O>
+async_task<O> async_find_all_of(I first, S last, O output, Pred pred, std::stop_token token = {},
+                                thread_pool &pool = default_thread_pool(), partition_policy policy = {}) {
+    using N = std::iter_difference_t<I>;
+    using M = std::iter_difference_t<O>;
+    I end = std::ranges::next(first, last);
+    auto length = std::distance(first, end);
+    if (static_cast<std::size_t>(length) < policy.sequential_threshold) {
+        if (token.stop_requested()) {
+            throw operation_cancelled{};
+        }
+        co_return our_find_all_of(first, end, output, pred);
+    }
+    auto num_chunks = policy.num_chunks(static_cast<std::size_t>(length), pool.size());
+    auto interval = static_cast<N>(std::max<std::size_t>(policy.cancellation_interval, 1));
+    // offsets[i + 1] is the number of matches in chunk i, then the prefix sum makes offsets[i] where chunk i starts
+    std::vector<M> offsets(num_chunks + 1);
+    co_await for_each_chunk_async(pool, length, num_chunks, token,
+                                  [first, &offsets, &pred, &token, interval](std::size_t index, N chunk_first, N chunk_last) {
+        M count = 0;
+        detail::for_each_block(chunk_first, chunk_last, interval, token, [first, &count, &pred](N block_first, N block_last) {
+            for (auto it = first + block_first; it != first + block_last; ++it) {
+                count += pred(*it) ? 1 : 0;
+            }
+            return true;
+        });
+        offsets[index + 1] = count;
+    });
+    for (std::size_t i = 1; i <= num_chunks; ++i) {
+        offsets[i] += offsets[i - 1];
+    }
+    co_await for_each_chunk_async(pool, length, num_chunks, token,
+                                  [first, output, &offsets, &pred, &token, interval](std::size_t index, N chunk_first,
+                                                                                     N chunk_last) {
+        auto out = output + offsets[index];
+        detail::for_each_block(chunk_first, chunk_last, interval, token, [first, &out, &pred](N block_first, N block_last) {
+            out = our_find_all_of(first + block_first, first + block_last, out, pred);
+            return true;
+        });
+    });
+    co_return output + offsets[num_chunks];
+}
+
+template <std::ranges::random_access_range R, std::random_access_iterator O, class Pred,
+          class I = std::ranges::iterator_t<R>>
+    requires std::indirect_unary_predicate<Pred &, I> and std::indirectly_copyable<I, O>
+async_task<O> async_find_all_of(R &&range, O output, Pred pred, std::stop_token token = {},
+                                thread_pool &pool = default_thread_pool(), partition_policy policy = {}) {
+    return async_find_all_of(std::ranges::begin(range), std::ranges::end(range), output, std::move(pred),
+                             std::move(token), pool, policy);
+}
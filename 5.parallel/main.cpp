@@ -1,16 +1,49 @@
 #include "parallel_algorithms.h"
+#include "async_algorithms.h"
 #include "timer.h"
 #include "random_init.h"
+#include "streaming.h"
+#include "parallel_sort.h"
+#include "../3.iterators/no_modules/mapped_array.h"
 
 #include <cstdint>
+#include <cstdlib>
 #include <execution>
+#include <filesystem>
+#include <format>
+#include <numeric>
+#include <random>
 #include <algorithm>
+#include <print>
+#include <span>
+#include <string>
+#include <thread>
 
 
 void do_not_optimize(auto x) {
     [[maybe_unused]] volatile auto y = x;
 }
 
+// The inputs of the find and copy benchmarks, from mapped::dataset. With BENCH_DATA they are generated once and mapped
+// from the files afterwards. The generators write in parallel, which places the pages of a generated input on the
+// nodes of the workers, and prefault does the same for the files that are not in the page cache yet.
+mapped::mapped_array<const std::int32_t> permutation_input(std::size_t size) {
+    auto input = mapped::dataset<std::int32_t>(std::format("permutation_i32_{}_seed3", size), size,
+                                               [](std::span<std::int32_t> out) {
+        random_permutation(out.begin(), static_cast<std::ptrdiff_t>(out.size()), 3);
+    });
+    prefault(input.begin(), static_cast<std::ptrdiff_t>(input.size()));
+    return input;
+}
+
+mapped::mapped_array<const float> floating_input(std::size_t size) {
+    auto input = mapped::dataset<float>(std::format("uniform_f32_{}_seed3", size), size, [](std::span<float> out) {
+        random_fill_floating(out.begin(), static_cast<std::ptrdiff_t>(out.size()), 3);
+    });
+    prefault(input.begin(), static_cast<std::ptrdiff_t>(input.size()));
+    return input;
+}
+
 void test_sort() {
     constexpr auto size = 10'000'000;
     auto vec = random_container<std::vector<std::int32_t>>(size);
@@ -35,35 +68,444 @@ void test_sort() {
         std::sort(std::execution::unseq, vec_copy.begin(), vec_copy.end());
         do_not_optimize(vec_copy.begin());
     };
+    // ours, on our thread pool: parallel_sort picks the radix sort for int32_t
+    auto sample_sort = [&vec_copy]() {
+        parallel_sample_sort(vec_copy.begin(), vec_copy.end());
+        do_not_optimize(vec_copy.begin());
+    };
+    auto radix_sort = [&vec_copy]() {
+        parallel_sort(vec_copy.begin(), vec_copy.end());
+        do_not_optimize(vec_copy.begin());
+    };
     
     timer::time_print(init, sort_seq, 5, "sequential sort");
     timer::time_print(init, sort_par, 5, "parallel sort");
     timer::time_print(init, sort_par_unseq, 5, "parallel unseq sort");
     timer::time_print(init, sort_unseq, 5, "unseq sort");
+    timer::time_print(init, sample_sort, 5, "parallel sample sort");
+    timer::time_print(init, radix_sort, 5, "parallel radix sort");
 }
 
 
 void test_find() {
+    // we generate the largest range only once and search in prefixes of it
+    constexpr std::size_t max_size = 500'000'000;
+    auto vec = permutation_input(max_size);
+    // the default policy falls back to our_find_if for short ranges, this one always runs in parallel
+    auto always_parallel = partition_policy{.sequential_threshold = 0, .grain_size = 1};
+
+    std::print("| size | sequential | parallel | parallel + fallback | speedup |\n");
+    std::print("|------|------------|----------|---------------------|---------|\n");
+    for (std::size_t size = 500; size <= max_size; size *= 10) {
+        // the elements are a permutation, so the last element of the prefix is found only at its end
+        auto last = vec[size - 1];
+        auto prefix_end = vec.begin() + size;
+        auto find_seq = [last, &vec, prefix_end]() {
+            do_not_optimize(our_find_if(vec.begin(), prefix_end, [last](auto elem) {
+                return elem == last;
+            }));
+        };
+        auto find_par = [last, &vec, prefix_end, always_parallel]() {
+            do_not_optimize(parallel_find_if(vec.begin(), prefix_end, [last](auto elem) {
+                return elem == last;
+            }, always_parallel));
+        };
+        auto find_par_fallback = [last, &vec, prefix_end]() {
+            do_not_optimize(parallel_find_if(vec.begin(), prefix_end, [last](auto elem) {
+                return elem == last;
+            }));
+        };
+        auto no_init = []() {};
+        auto seq = timer::time(no_init, find_seq, 10, std::format("find {} sequential", size));
+        auto par = timer::time(no_init, find_par, 10, std::format("find {} parallel", size));
+        auto par_fallback = timer::time(no_init, find_par_fallback, 10, std::format("find {} parallel + fallback", size));
+        std::print("| {} | {:.6f}s | {:.6f}s | {:.6f}s | {:.2f}x |\n", size, seq, par, par_fallback, seq / par);
+    }
+}
+
+void test_find_early() {
     constexpr auto size = 500'000'000;
-    auto vec = random_container<std::vector<std::int32_t>>(size);
-    auto last = vec.back();
+    auto vec = permutation_input(size);
+    // the match is at the start of the first chunk, the other chunks should stop almost immediately
+    auto early = vec[1'000];
 
-    auto find_seq = [last, &vec]() {
-        do_not_optimize(our_find_if(vec.begin(), vec.end(), [last](auto elem) {
-            return elem == last;
+    auto find_seq = [early, &vec]() {
+        do_not_optimize(our_find_if(vec.begin(), vec.end(), [early](auto elem) {
+            return elem == early;
         }));
     };
-    auto find_par = [last, &vec]() {
-        do_not_optimize(parallel_find_if(vec.begin(), vec.end(), [last](auto elem) {
-            return elem == last;
+    auto find_par = [early, &vec]() {
+        do_not_optimize(parallel_find_if(vec.begin(), vec.end(), [early](auto elem) {
+            return elem == early;
         }));
     };
-    timer::time_print(find_seq, 10, "Sequential find");
-    timer::time_print(find_par, 10, "Parallel find");
+    timer::time_print(find_seq, 10, "Sequential find, early match");
+    timer::time_print(find_par, 10, "Parallel find, early match");
+}
+
+void test_copy_transform_reduce() {
+    constexpr auto size = 250'000'000;
+    auto vec = floating_input(size);
+    auto out = std::vector<float>(size);
+    auto scale = [](float x) {
+        return x * 2.0f + 1.0f;
+    };
+
+    auto bench = [&vec, &out, scale](auto policy, std::string_view name) {
+        auto copy_fn = [&vec, &out, policy]() {
+            do_not_optimize(copy(policy, vec.begin(), vec.end(), out.begin()));
+        };
+        // the same copy with the stores through the cache, a lambda is not std::identity
+        auto cached_copy_fn = [&vec, &out, policy]() {
+            do_not_optimize(transform(policy, vec.begin(), vec.end(), out.begin(), [](float x) {
+                return x;
+            }));
+        };
+        auto transform_fn = [&vec, &out, policy, scale]() {
+            do_not_optimize(transform(policy, vec.begin(), vec.end(), out.begin(), scale));
+        };
+        auto reduce_fn = [&vec, policy]() {
+            do_not_optimize(reduce(policy, vec.begin(), vec.end()));
+        };
+        timer::time_print(copy_fn, 5, std::format("{} copy", name));
+        timer::time_print(cached_copy_fn, 5, std::format("{} copy through the cache", name));
+        timer::time_print(transform_fn, 5, std::format("{} transform", name));
+        timer::time_print(reduce_fn, 5, std::format("{} reduce", name));
+    };
+    bench(execution::seq, "sequential");
+    bench(execution::par, "parallel");
+    bench(execution::par_unseq, "parallel unseq");
+    bench(execution::unseq, "unseq");
+}
+
+// transform | filter | reduce, with the transformed elements written to memory and read again, and fused
+void test_pipeline() {
+    constexpr auto size = 250'000'000;
+    auto vec = floating_input(size);
+    auto out = std::vector<float>(size);
+    auto scale = [](float x) {
+        return x * 2.0f + 1.0f;
+    };
+    auto large = [](float x) {
+        return x > 1.5f;
+    };
+
+    auto materialized_fn = [&vec, &out, scale, large]() {
+        ::transform(vec.begin(), vec.end(), out.begin(), scale);
+        auto out_end = our_find_all_of(out.begin(), out.end(), out.begin(), large);
+        do_not_optimize(::reduce(out.begin(), out_end, 0.0f, std::plus<>{}));
+    };
+    timer::time_print(materialized_fn, 5, "materialized transform filter reduce");
+
+    auto expr = pipeline::transform(scale) | pipeline::filter(large) | pipeline::reduce(0.0f, std::plus<>{});
+    auto unrolled_fn = [&vec, &expr]() {
+        do_not_optimize(pipeline::run_unrolled(vec, expr));
+    };
+    timer::time_print(unrolled_fn, 5, "fused unrolled");
+    auto bench = [&vec, &expr](auto policy, std::string_view name) {
+        auto fused_fn = [&vec, &expr, policy]() {
+            do_not_optimize(pipeline::run(policy, vec, expr));
+        };
+        timer::time_print(fused_fn, 5, std::format("fused {}", name));
+    };
+    bench(execution::seq, "sequential");
+    bench(execution::unseq, "unseq");
+    bench(execution::par, "parallel");
+    bench(execution::par_unseq, "parallel unseq");
+}
+
+// One query against a row-major matrix of 256M floats, the rows split among the workers
+void test_batch_inner_product() {
+    constexpr std::size_t cols = 1'024;
+    constexpr std::size_t rows = 250'000;
+    auto matrix = floating_input(rows * cols);
+    auto query = std::vector<float>(matrix.begin(), matrix.begin() + cols);
+    auto scores = std::vector<float>(rows);
+
+    auto bench = [&matrix, &query, &scores](auto policy, std::string_view name) {
+        auto batch_fn = [&matrix, &query, &scores, policy]() {
+            batch_inner_product(policy, matrix, query, scores.begin());
+            do_not_optimize(scores[0]);
+        };
+        timer::time_print(batch_fn, 5, std::format("{} batch inner product", name));
+    };
+    bench(execution::seq, "sequential");
+    bench(execution::par, "parallel");
+}
+
+void test_find_last() {
+    constexpr auto size = 500'000'000;
+    auto vec = permutation_input(size);
+    // the latest entry of a log is usually close to its end
+    auto late = vec[size - 1'000];
+    auto is_late = [late](std::int32_t x) {
+        return x == late;
+    };
+
+    // the find_last_if of 6.search/README.md, which goes through the whole range and remembers the last match
+    auto find_last_forward = [&vec, is_late]() {
+        auto found = vec.end();
+        for (auto it = vec.begin(); it != vec.end(); ++it) {
+            if (is_late(*it)) {
+                found = it;
+            }
+        }
+        do_not_optimize(found);
+    };
+    auto find_last_backward = [&vec, is_late]() {
+        do_not_optimize(our_find_last_if(vec.begin(), vec.end(), is_late));
+    };
+    auto find_last_par = [&vec, is_late]() {
+        do_not_optimize(parallel_find_last_if(vec.begin(), vec.end(), is_late));
+    };
+    // no match, every element is checked
+    auto find_last_par_none = [&vec]() {
+        do_not_optimize(parallel_find_last_if(vec.begin(), vec.end(), [](std::int32_t x) {
+            return x < 0;
+        }));
+    };
+    timer::time_print(find_last_forward, 5, "Forward find_last_if, late match");
+    timer::time_print(find_last_backward, 5, "Backward find_last_if, late match");
+    timer::time_print(find_last_par, 5, "Parallel find_last_if, late match");
+    timer::time_print(find_last_par_none, 5, "Parallel find_last_if, no match");
+}
+
+void test_find_all() {
+    constexpr auto size = 500'000'000;
+    auto vec = permutation_input(size);
+    // the elements are a permutation, so exactly a tenth of them match and the output needs no more room than that
+    auto out = std::vector<std::int32_t>(size / 10);
+    auto small = [](std::int32_t x) {
+        return x < size / 10;
+    };
+
+    auto find_all_seq = [&vec, &out, small]() {
+        do_not_optimize(our_find_all_of(vec.begin(), vec.end(), out.begin(), small));
+    };
+    auto find_all_par = [&vec, &out, small]() {
+        do_not_optimize(parallel_find_all_of(vec.begin(), vec.end(), out.begin(), small));
+    };
+    timer::time_print(find_all_seq, 5, "Sequential find_all_of, 10% matches");
+    timer::time_print(find_all_par, 5, "Parallel find_all_of, 10% matches");
 }
 
+void test_partition() {
+    constexpr auto size = 100'000'000;
+    // a prefix of the input of test_find, half of the values are below the threshold
+    auto input = permutation_input(500'000'000);
+    auto vec = std::vector<std::int32_t>(input.begin(), input.begin() + size);
+    auto work = vec;
+    auto out = std::vector<std::int32_t>(size);
+    auto small = [](std::int32_t x) {
+        return x < 250'000'000;
+    };
+
+    auto init = [&vec, &work]() {
+        work = vec;
+    };
+    auto no_init = []() {};
+    auto partition_seq = [&work, small]() {
+        do_not_optimize(std::stable_partition(work.begin(), work.end(), small));
+    };
+    auto partition_par = [&work, small]() {
+        do_not_optimize(parallel_stable_partition(work.begin(), work.end(), small));
+    };
+    auto partition_copy_par = [&vec, &out, small]() {
+        do_not_optimize(parallel_stable_partition_copy(vec, out.begin(), small));
+    };
+    timer::time_print(init, partition_seq, 5, "Sequential std::stable_partition");
+    timer::time_print(init, partition_par, 5, "Parallel stable_partition");
+    timer::time_print(no_init, partition_copy_par, 5, "Parallel stable_partition_copy to a buffer");
+
+    // out is partitioned now, both check every element
+    auto is_partitioned_seq = [&out, small]() {
+        do_not_optimize(std::is_partitioned(out.begin(), out.end(), small));
+    };
+    auto is_partitioned_par = [&out, small]() {
+        do_not_optimize(parallel_is_partitioned(out, small));
+    };
+    // the input is not partitioned anywhere, the first chunk that notices stops the others after a block
+    auto stops_early = [&vec, small]() {
+        do_not_optimize(parallel_is_partitioned(vec, small));
+    };
+    timer::time_print(is_partitioned_seq, 5, "Sequential is_partitioned");
+    timer::time_print(is_partitioned_par, 5, "Parallel is_partitioned");
+    timer::time_print(stops_early, 5, "Parallel is_partitioned, not partitioned");
+}
+
+void test_async_find() {
+    constexpr auto size = 500'000'000;
+    constexpr auto num_queries = 8;
+    auto vec = permutation_input(size);
+    // the queries are spread over the range, so they stop at different points
+    auto keys = std::vector<std::int32_t>(num_queries);
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        keys[i] = vec[(i + 1) * size / (num_queries + 1)];
+    }
+
+    auto find_blocking = [&vec, &keys]() {
+        for (auto key : keys) {
+            do_not_optimize(parallel_find_if(vec.begin(), vec.end(), [key](auto elem) {
+                return elem == key;
+            }));
+        }
+    };
+    // all the queries are in flight at the same time, and no thread waits for them but this one
+    auto find_async = [&vec, &keys]() {
+        std::vector<async_task<decltype(vec.begin())>> queries;
+        for (auto key : keys) {
+            queries.push_back(async_find_if(vec, [key](auto elem) {
+                return elem == key;
+            }));
+        }
+        do_not_optimize(sync_wait(when_all(std::move(queries))).front());
+    };
+    // no match, stopped after 1ms
+    auto find_cancelled = [&vec]() {
+        std::stop_source source;
+        auto stopper = std::jthread([&source]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            source.request_stop();
+        });
+        try {
+            do_not_optimize(sync_wait(async_find_if(vec, [](auto elem) {
+                return elem < 0;
+            }, source.get_token())));
+        } catch (const operation_cancelled &) {
+        }
+    };
+    timer::time_print(find_blocking, 5, std::format("Blocking parallel_find_if, {} queries", num_queries));
+    timer::time_print(find_async, 5, std::format("async_find_if, {} queries in flight", num_queries));
+    timer::time_print(find_cancelled, 5, "async_find_if, cancelled after 1ms");
+}
+
+void test_minmax() {
+    constexpr auto size = 500'000'000;
+    auto vec = permutation_input(size);
+    // a lambda hides the comparison from the SIMD dispatch, so this is the 3n / 2 loop
+    auto less = [](std::int32_t x, std::int32_t y) {
+        return x < y;
+    };
+
+    auto std_minmax = [&vec]() {
+        do_not_optimize(std::minmax_element(vec.begin(), vec.end()).first);
+    };
+    auto naive = [&vec, less]() {
+        do_not_optimize(naive_minmax_element(vec.begin(), vec.end(), less).first);
+    };
+    auto pairwise = [&vec, less]() {
+        do_not_optimize(::minmax_element(vec.begin(), vec.end(), less).first);
+    };
+    auto simd_minmax = [&vec]() {
+        do_not_optimize(::minmax_element(vec.begin(), vec.end()).first);
+    };
+    auto parallel_pairwise = [&vec, less]() {
+        do_not_optimize(parallel_minmax_element(vec.begin(), vec.end(), less).first);
+    };
+    auto parallel_simd = [&vec]() {
+        do_not_optimize(parallel_minmax_element(vec.begin(), vec.end()).first);
+    };
+    timer::time_print(std_minmax, 5, "std::minmax_element");
+    timer::time_print(naive, 5, "min_element + max_element");
+    timer::time_print(pairwise, 5, "3n/2 minmax_element");
+    timer::time_print(simd_minmax, 5, "SIMD minmax_element");
+    timer::time_print(parallel_pairwise, 5, "parallel 3n/2 minmax_element");
+    timer::time_print(parallel_simd, 5, "parallel SIMD minmax_element");
+}
+
+void test_random_init() {
+    constexpr auto size = 500'000'000;
+    auto vec = std::vector<std::int32_t>(size);
+    auto floats = std::vector<float>(size);
+
+    // what random_init.h used to do: a temporary vector, a sequential shuffle and a copy
+    auto shuffle_seq = [&vec]() {
+        auto rand = std::default_random_engine(3);
+        auto v = std::vector<std::int32_t>(size);
+        std::iota(v.begin(), v.end(), 0);
+        std::ranges::shuffle(v, rand);
+        std::ranges::copy(v, vec.begin());
+    };
+    auto permutation_par = [&vec]() {
+        random_permutation(vec.begin(), size, 3);
+    };
+    auto uniform_seq = [&floats]() {
+        auto rand = std::default_random_engine(3);
+        std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+        for (auto &value : floats) {
+            value = dist(rand);
+        }
+    };
+    auto uniform_par = [&floats]() {
+        random_fill_floating(floats.begin(), size, 3);
+    };
+    timer::time_print(shuffle_seq, 3, "Sequential shuffle through a temporary");
+    timer::time_print(permutation_par, 3, "Parallel bucketed Fisher-Yates");
+    timer::time_print(uniform_seq, 3, "Sequential uniform floats");
+    timer::time_print(uniform_par, 3, "Parallel counter-based uniform floats");
+}
+
+void test_streaming() {
+    constexpr auto size = std::size_t{250'000'000};
+    // the file stays in BENCH_DATA, otherwise it is removed at the end
+    auto directory = std::getenv("BENCH_DATA");
+    auto keep = directory != nullptr and *directory != '\0';
+    auto path = (std::filesystem::path(keep ? directory : std::filesystem::temp_directory_path().string()) /
+                 std::format("stream_f32_{}_seed3.bin", size))
+                    .string();
+    auto vec = mapped::mapped_array<const float>(path);
+    if (vec.size() != size) {
+        auto file = mapped::mapped_array<float>::create(path, size);
+        if (not file.valid()) {
+            std::print(stderr, "{}, skipping the streaming benchmarks\n", file.error());
+            return;
+        }
+        random_fill_floating(file.begin(), static_cast<std::ptrdiff_t>(size), 3);
+        vec = mapped::mapped_array<const float>(std::move(file));
+    }
+    auto plus = [](float x, float y) {
+        return x + y;
+    };
+
+    auto bench = [&path, plus](auto policy, std::size_t block_size, std::string_view name) {
+        auto reduce_fn = [&path, plus, policy, block_size]() {
+            auto source = file_source(path);
+            auto reader = block_reader<float, file_source>(source, block_size);
+            do_not_optimize(stream_reduce(policy, reader, 0.0f, plus));
+        };
+        timer::time_print(reduce_fn, 3, std::format("{} stream reduce, blocks of {} floats", name, block_size));
+    };
+    bench(execution::seq, 1 << 20, "sequential");
+    bench(execution::par, 1 << 20, "parallel");
+    bench(execution::par, 1 << 24, "parallel");
+    // the same sum without the reads, for comparison
+    auto reduce_mapped = [&vec]() {
+        do_not_optimize(reduce(execution::par, vec.begin(), vec.end()));
+    };
+    timer::time_print(reduce_mapped, 3, "parallel reduce of the mapped file");
+    if (not keep) {
+        vec = {};
+        std::filesystem::remove(path);
+    }
+}
 
-int main() {
+int main(int argc, char *argv[]) {
+    // --output, --samples, --counters and --compare, see timer::handle_arguments
+    if (auto status = timer::handle_arguments(argc, argv)) {
+        return *status;
+    }
+    timer::report().set("threads", std::to_string(default_thread_pool().size()));
+    test_random_init();
     test_find();
+    test_find_early();
+    test_find_last();
+    test_find_all();
+    test_async_find();
+    test_partition();
+    test_minmax();
+    test_copy_transform_reduce();
+    test_pipeline();
+    test_batch_inner_product();
+    test_streaming();
     test_sort();
 }
\ No newline at end of file
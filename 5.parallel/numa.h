@@ -0,0 +1,135 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#define NUMA_HAS_AFFINITY
+#endif
+
+// The NUMA nodes of the machine and the cpus of each one, read from /sys without libnuma.
+// The memory of a multi-socket machine is split among the sockets, a cpu reads the memory of its own node faster than
+// the memory of the other nodes, which goes through the interconnect. Linux places a page on the node of the thread
+// that touches it first, so a range is best written for the first time by the threads that will process it, and those
+// threads should stay on their node. Machines with one node, and other systems, see a single node with all the cpus.
+namespace numa {
+
+struct node {
+    int id = 0;
+    std::vector<int> cpus;
+};
+
+namespace detail {
+
+// "0-3,8-11" in the format of /sys/devices/system/node/node*/cpulist
+inline std::vector<int> parse_cpu_list(std::string_view list) {
+    std::vector<int> cpus;
+    while (not list.empty()) {
+        auto comma = list.find(',');
+        auto range = list.substr(0, comma);
+        list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+        int first = 0;
+        int last = 0;
+        auto [end, error] = std::from_chars(range.data(), range.data() + range.size(), first);
+        if (error != std::errc{}) {
+            continue;
+        }
+        last = first;
+        if (end != range.data() + range.size() and *end == '-') {
+            std::from_chars(end + 1, range.data() + range.size(), last);
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+inline std::vector<node> read_topology() {
+    std::vector<node> nodes;
+#if defined(NUMA_HAS_AFFINITY)
+    // only the cpus we may run on, taskset and cgroups restrict them
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+        auto name = entry.path().filename().string();
+        int id = 0;
+        if (not name.starts_with("node") or
+            std::from_chars(name.data() + 4, name.data() + name.size(), id).ec != std::errc{}) {
+            continue;
+        }
+        std::string list;
+        std::getline(std::ifstream(entry.path() / "cpulist"), list);
+        auto cpus = parse_cpu_list(list);
+        std::erase_if(cpus, [&](int cpu) {
+            return restricted and (cpu >= CPU_SETSIZE or not CPU_ISSET(cpu, &allowed));
+        });
+        if (not cpus.empty()) {
+            nodes.push_back({id, std::move(cpus)});
+        }
+    }
+#endif
+    if (nodes.empty()) {
+        nodes.push_back({0, {}});
+        for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu) {
+            nodes.back().cpus.push_back(static_cast<int>(cpu));
+        }
+    }
+    std::ranges::sort(nodes, {}, &node::id);
+    return nodes;
+}
+
+} // namespace detail
+
+// The nodes with at least one cpu we may run on, in the order of their ids.
+inline const std::vector<node> &topology() {
+    static const auto nodes = detail::read_topology();
+    return nodes;
+}
+
+// The node of worker index of a pool of num_workers threads: the workers are spread over the nodes in proportion to
+// their cpus, consecutive workers share a node.
+inline const node &node_of_worker(std::size_t index, std::size_t num_workers) {
+    const auto &nodes = topology();
+    std::size_t total = 0;
+    for (const auto &n : nodes) {
+        total += n.cpus.size();
+    }
+    auto position = index * total / std::max<std::size_t>(num_workers, 1);
+    for (const auto &n : nodes) {
+        if (position < n.cpus.size()) {
+            return n;
+        }
+        position -= n.cpus.size();
+    }
+    return nodes.back();
+}
+
+// Lets the calling thread run only on the cpus of the node. Returns false where that is not supported.
+inline bool pin_current_thread(const node &target) {
+#if defined(NUMA_HAS_AFFINITY)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : target.cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)target;
+    return false;
+#endif
+}
+
+} // namespace numa
@@ -1,7 +1,24 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
 #include <future>
 #include <iterator>
+#include <optional>
+#include <ranges>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../3.iterators/no_modules/algorithms.h"
+#include "../3.iterators/no_modules/minmax.h"
+#include "../3.iterators/no_modules/pipeline.h"
+#include "thread_pool.h"
 
 template <std::input_iterator I, std::sentinel_for<I> S, class Pred>
     requires std::indirect_unary_predicate<Pred, I>
@@ -15,42 +32,838 @@ I our_find_if(I first, S last, Pred pred) {
     return first;
 }
 
+// Searches from the end and returns the last element that satisfies pred, last if there is none.
+template <std::bidirectional_iterator I, class Pred>
+    requires std::indirect_unary_predicate<Pred, I>
+I our_find_last_if(I first, I last, Pred pred) {
+    I it = last;
+    while (it != first) {
+        --it;
+        if (pred(*it)) {
+            return it;
+        }
+    }
+    return last;
+}
+
+// Copies the elements that satisfy pred to output, in order, and returns the end of the output, see 6.search/README.md.
+template <std::input_iterator I, std::sentinel_for<I> S, std::weakly_incrementable O, class Pred>
+    requires std::indirect_unary_predicate<Pred, I> and std::indirectly_copyable<I, O>
+O our_find_all_of(I first, S last, O output, Pred pred) {
+    while (first != last) {
+        if (pred(*first)) {
+            *output = *first;
+            ++output;
+        }
+        ++first;
+    }
+    return output;
+}
+
+// How a parallel algorithm splits its range into chunks.
+// The defaults are a reasonable starting point, but the best values depend on the machine and on the cost of the
+// operation applied to each element, so every parallel algorithm lets the caller tune them.
+struct partition_policy {
+    // ranges shorter than this are processed sequentially on the calling thread,
+    // the scheduling overhead would be larger than what we gain from parallelism
+    std::size_t sequential_threshold = 32'768;
+    // the minimum number of elements in a chunk
+    std::size_t grain_size = 16'384;
+    // the maximum number of chunks processed in parallel, 0 means one chunk for each worker of the pool
+    std::size_t max_workers = 0;
+    // algorithms that can stop early check every this many elements whether another chunk already made the rest of
+    // the work useless
+    std::size_t cancellation_interval = 4096;
+
+    // a single chunk means the algorithm should run sequentially on the calling thread
+    std::size_t num_chunks(std::size_t length, std::size_t pool_size) const noexcept {
+        if (length < sequential_threshold) {
+            return 1;
+        }
+        auto workers = max_workers == 0 ? pool_size : max_workers;
+        auto by_grain = length / std::max<std::size_t>(grain_size, 1);
+        return std::clamp<std::size_t>(by_grain, 1, std::max<std::size_t>(workers, 1));
+    }
+};
+
+// Returns the offset of the chunk with the given index when splitting [0, length) into num_chunks chunks whose sizes
+// differ by at most one element.
+template <std::integral N>
+N chunk_offset(N length, std::size_t num_chunks, std::size_t index) {
+    auto n = static_cast<std::size_t>(length);
+    return static_cast<N>(n / num_chunks * index + std::min(index, n % num_chunks));
+}
+
+// Calls fn(index, chunk_first, chunk_last) for each of the num_chunks chunks of [0, length). The first num_chunks - 1
+// chunks run on the pool and the last one on the calling thread. Returns after all the chunks finished, because they
+// usually reference the caller's stack, and rethrows the first exception thrown by a chunk.
+// A chunk goes to the worker at the same position in the pool as the chunk in the range, whatever the number of chunks:
+// the thread that writes a part of a range first, which places its pages (see numa.h), also processes it later.
+template <std::integral N, class Fn>
+void for_each_chunk(thread_pool &pool, N length, std::size_t num_chunks, Fn fn) {
+    std::vector<std::future<void>> chunks;
+    chunks.reserve(num_chunks - 1);
+    for (std::size_t i = 0; i + 1 < num_chunks; ++i) {
+        chunks.push_back(pool.submit_to(i * pool.size() / num_chunks, [&fn, i, length, num_chunks]() {
+            fn(i, chunk_offset(length, num_chunks, i), chunk_offset(length, num_chunks, i + 1));
+        }));
+    }
+    std::exception_ptr error;
+    try {
+        fn(num_chunks - 1, chunk_offset(length, num_chunks, num_chunks - 1), length);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    for (auto &future : chunks) {
+        try {
+            pool.wait(future);
+        } catch (...) {
+            if (not error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// Lowers value to desired if desired is smaller, returns true if it did.
+template <class T>
+bool atomic_fetch_min(std::atomic<T> &value, T desired) {
+    T current = value.load(std::memory_order_relaxed);
+    while (desired < current) {
+        if (value.compare_exchange_weak(current, desired, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Raises value to desired if desired is larger, returns true if it did.
+template <class T>
+bool atomic_fetch_max(std::atomic<T> &value, T desired) {
+    T current = value.load(std::memory_order_relaxed);
+    while (current < desired) {
+        if (value.compare_exchange_weak(current, desired, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 // this must be a random access iterator, otherwise we can't use fast traversal and the parallel algorithm would become useless
 template <std::random_access_iterator I, std::sentinel_for<I> S, class Pred>
     requires std::indirect_unary_predicate<Pred, I>
-I parallel_find_if(I first, S last, Pred pred) {
+I parallel_find_if(I first, S last, Pred pred, thread_pool &pool = default_thread_pool(), partition_policy policy = {}) {
     static_assert(!std::is_same_v<S, std::unreachable_sentinel_t>,
                   "parallel_find_if does not support std::unreachable_sentinel_t as the sentinel type.");
-    // normally, this would check the length of the sequence and split it into chunks dynamically using an heuristic
-    // based on the length of the sequence and the available cpu cores.
-    // it should also accept a threadpool if the user already has one
-    auto chunk_size = std::distance(first, last) / 4;
-    auto limit1 = std::next(first, chunk_size);
-    auto limit2 = std::next(limit1, chunk_size);
-    auto limit3 = std::next(limit2, chunk_size);
-
-    // we pass non-everlapping subranges to each thread
-    auto thread1 = std::async(std::launch::async, our_find_if<I, S, Pred>, first, limit1, pred);
-    auto thread2 = std::async(std::launch::async, our_find_if<I, S, Pred>, limit1, limit2, pred);
-    auto thread3 = std::async(std::launch::async, our_find_if<I, S, Pred>, limit2, limit3, pred);
-    auto thread4 = std::async(std::launch::async, our_find_if<I, S, Pred>, limit3, last, pred);
-
-    // now we wait and ge the values from each thread
-    auto found1 = thread1.get();
-    if (found1 != limit1) {
-        // we found a value in the first subrange!
-        return found1;
-    }
-    // we didn't find a value in the first subrange
-    auto found2 = thread2.get();
-    if (found2 != limit2) {
-        return found2;
-    }
-    auto found3 = thread3.get();
-    if (found3 != limit3) {
-        return found3;
-    }
-    // we didn't find what we searched for in none of the first 3 subranges
-    // this means it's either in the last subrange, or we should return last
-    return thread4.get();
+    using N = std::iter_difference_t<I>;
+    I end = std::ranges::next(first, last);
+    auto length = std::distance(first, end);
+    // the number of chunks depends on the length of the sequence, the grain size and the available workers
+    auto num_chunks = policy.num_chunks(static_cast<std::size_t>(length), pool.size());
+    if (num_chunks == 1) {
+        // short ranges are not worth a trip to the pool
+        return our_find_if(first, end, pred);
+    }
+
+    // the index of the first match found so far, shared by all the chunks
+    // a chunk stops as soon as it knows that a match exists before the elements it still has to check,
+    // this way the work done for an early match is close to the work done by the sequential version
+    std::atomic<N> best = length;
+    auto interval = static_cast<N>(std::max<std::size_t>(policy.cancellation_interval, 1));
+    auto search_chunk = [first, &best, &pred, interval](I chunk_first, I chunk_last) {
+        while (chunk_first != chunk_last) {
+            if (best.load(std::memory_order_relaxed) < chunk_first - first) {
+                // someone found a match before this block
+                return;
+            }
+            auto block_last = chunk_last - chunk_first > interval ? chunk_first + interval : chunk_last;
+            auto found = our_find_if(chunk_first, block_last, pred);
+            if (found != block_last) {
+                atomic_fetch_min(best, static_cast<N>(found - first));
+                return;
+            }
+            chunk_first = block_last;
+        }
+    };
+
+    // we pass non-everlapping subranges to each worker
+    // every chunk references best and pred, so we wait for all of them,
+    // the ones that are not needed anymore return after at most one block
+    for_each_chunk(pool, length, num_chunks, [first, &search_chunk](std::size_t, N chunk_first, N chunk_last) {
+        search_chunk(first + chunk_first, first + chunk_last);
+    });
+    return std::next(first, best.load(std::memory_order_relaxed));
+}
+
+template <std::random_access_iterator I, std::sentinel_for<I> S, class Pred>
+    requires std::indirect_unary_predicate<Pred, I>
+I parallel_find_if(I first, S last, Pred pred, partition_policy policy) {
+    return parallel_find_if(first, last, pred, default_thread_pool(), policy);
+}
+
+template <std::ranges::random_access_range R, class Pred, class I = std::ranges::iterator_t<R>>
+    requires std::indirect_unary_predicate<Pred, I>
+I parallel_find_if(R &&range, Pred pred, thread_pool &pool = default_thread_pool(), partition_policy policy = {}) {
+    return parallel_find_if(std::ranges::begin(range), std::ranges::end(range), pred, pool, policy);
+}
+
+// The counted versions of 6.search/README.md, with the same result: the first match and how many elements are left
+// from it to the end, 0 if there is none.
+template <std::random_access_iterator I, std::integral N, class Pred>
+    requires std::indirect_unary_predicate<Pred, I>
+std::pair<I, N> parallel_find_if_n(I first, N n, Pred pred, thread_pool &pool = default_thread_pool(),
+                                  partition_policy policy = {}) {
+    auto last = first + static_cast<std::iter_difference_t<I>>(n);
+    I found = parallel_find_if(first, last, pred, pool, policy);
+    return {found, static_cast<N>(last - found)};
+}
+
+template <std::random_access_iterator I, std::integral N, class Pred>
+    requires std::indirect_unary_predicate<Pred, I>
+std::pair<I, N> parallel_find_if_not_n(I first, N n, Pred pred, thread_pool &pool = default_thread_pool(),
+                                      partition_policy policy = {}) {
+    return parallel_find_if_n(first, n, std::not_fn(pred), pool, policy);
+}
+
+// parallel_find_if from the other end: every chunk searches its blocks from the last one to the first, and the index
+// of the last match found so far is shared. A chunk stops as soon as a match exists after all the elements it still
+// has to check, so a match close to the end stops all the chunks after a block, like the sequential version would.
+template <std::random_access_iterator I, std::sentinel_for<I> S, class Pred>
+    requires std::indirect_unary_predicate<Pred, I>
+I parallel_find_last_if(I first, S last, Pred pred, thread_pool &pool = default_thread_pool(),
+                        partition_policy policy = {}) {
+    static_assert(!std::is_same_v<S, std::unreachable_sentinel_t>,
+                  "parallel_find_last_if does not support std::unreachable_sentinel_t as the sentinel type.");
+    using N = std::iter_difference_t<I>;
+    I end = std::ranges::next(first, last);
+    auto length = std::distance(first, end);
+    auto num_chunks = policy.num_chunks(static_cast<std::size_t>(length), pool.size());
+    if (num_chunks == 1) {
+        return our_find_last_if(first, end, pred);
+    }
+
+    std::atomic<N> best = -1;
+    auto interval = static_cast<N>(std::max<std::size_t>(policy.cancellation_interval, 1));
+    auto search_chunk = [first, &best, &pred, interval](I chunk_first, I chunk_last) {
+        while (chunk_first != chunk_last) {
+            if (best.load(std::memory_order_relaxed) >= chunk_last - first) {
+                // someone found a match after this block
+                return;
+            }
+            auto block_first = chunk_last - chunk_first > interval ? chunk_last - interval : chunk_first;
+            auto found = our_find_last_if(block_first, chunk_last, pred);
+            if (found != chunk_last) {
+                atomic_fetch_max(best, static_cast<N>(found - first));
+                return;
+            }
+            chunk_last = block_first;
+        }
+    };
+    for_each_chunk(pool, length, num_chunks, [first, &search_chunk](std::size_t, N chunk_first, N chunk_last) {
+        search_chunk(first + chunk_first, first + chunk_last);
+    });
+    auto found = best.load(std::memory_order_relaxed);
+    return found < 0 ? end : first + found;
+}
+
+template <std::ranges::random_access_range R, class Pred, class I = std::ranges::iterator_t<R>>
+    requires std::indirect_unary_predicate<Pred, I>
+I parallel_find_last_if(R &&range, Pred pred, thread_pool &pool = default_thread_pool(), partition_policy policy = {}) {
+    return parallel_find_last_if(std::ranges::begin(range), std::ranges::end(range), pred, pool, policy);
+}
+
+// find_all_of in two passes over the chunks, without locks: the first counts the matches of every chunk, an exclusive
+// prefix sum of the counts gives each chunk the region of the output its matches go to, and the second pass copies
+// them there. The output is in the order of the input, as with the sequential version. pred is called twice for every
+// element, which std::indirect_unary_predicate allows, it must be equality preserving.
+// precondition: output has room for all the matches
+template <std::random_access_iterator I, std::sentinel_for<I> S, std::random_access_iterator O, class Pred>
+    requires std::indirect_unary_predicate<Pred &, I> and std::indirectly_copyable<I, O>
+O parallel_find_all_of(I first, S last, O output, Pred pred, thread_pool &pool = default_thread_pool(),
+                       partition_policy policy = {}) {
+    static_assert(!std::is_same_v<S, std::unreachable_sentinel_t>,
+                  "parallel_find_all_of does not support std::unreachable_sentinel_t as the sentinel type.");
+    using N = std::iter_difference_t<I>;
+    I end = std::ranges::next(first, last);
+    auto length = std::distance(first, end);
+    auto num_chunks = policy.num_chunks(static_cast<std::size_t>(length), pool.size());
+    if (num_chunks == 1) {
+        return our_find_all_of(first, end, output, pred);
+    }
+    // offsets[i + 1] is the number of matches in chunk i, then the prefix sum makes offsets[i] where chunk i starts
+    std::vector<std::iter_difference_t<O>> offsets(num_chunks + 1);
+    for_each_chunk(pool, length, num_chunks, [first, &offsets, &pred](std::size_t index, N chunk_first, N chunk_last) {
+        std::iter_difference_t<O> count = 0;
+        for (auto it = first + chunk_first; it != first + chunk_last; ++it) {
+            count += pred(*it) ? 1 : 0;
+        }
+        offsets[index + 1] = count;
+    });
+    for (std::size_t i = 1; i <= num_chunks; ++i) {
+        offsets[i] += offsets[i - 1];
+    }
+    for_each_chunk(pool, length, num_chunks, [first, output, &offsets, &pred](std::size_t index, N chunk_first, N chunk_last) {
+        our_find_all_of(first + chunk_first, first + chunk_last, output + offsets[index], pred);
+    });
+    return output + offsets[num_chunks];
+}
+
+template <std::random_access_iterator I, std::sentinel_for<I> S, std::random_access_iterator O, class Pred>
+    requires std::indirect_unary_predicate<Pred &, I> and std::indirectly_copyable<I, O>
+O parallel_find_all_of(I first, S last, O output, Pred pred, partition_policy policy) {
+    static_assert(!std::is_same_v<S, std::unreachable_sentinel_t>,
+                  "parallel_find_all_of does not support std::unreachable_sentinel_t as the sentinel type.");
+    return parallel_find_all_of(first, last, output, pred, default_thread_pool(), policy);
+}
+
+template <std::ranges::random_access_range R, std::random_access_iterator O, class Pred,
+          class I = std::ranges::iterator_t<R>>
+    requires std::indirect_unary_predicate<Pred &, I> and std::indirectly_copyable<I, O>
+O parallel_find_all_of(R &&range, O output, Pred pred, thread_pool &pool = default_thread_pool(),
+                       partition_policy policy = {}) {
+    return parallel_find_all_of(std::ranges::begin(range), std::ranges::end(range), output, pred, pool, policy);
+}
+
+// Every chunk checks that it is partitioned: a run of elements that satisfy pred, then a run of elements that don't.
+// The chunks share the index of the first element that doesn't satisfy pred found so far, so a chunk that still sees
+// elements satisfying pred after it stops at its next block, and a chunk that finds one after its own first false
+// stops everyone. Then the chunk boundaries are checked in order: after the first chunk with an element that doesn't
+// satisfy pred, every chunk must start with one.
+template <std::random_access_iterator I, std::sentinel_for<I> S, class Pred>
+    requires std::indirect_unary_predicate<Pred &, I>
+bool parallel_is_partitioned(I first, S last, Pred pred, thread_pool &pool = default_thread_pool(),
+                             partition_policy policy = {}) {
+    static_assert(!std::is_same_v<S, std::unreachable_sentinel_t>,
+                  "parallel_is_partitioned does not support std::unreachable_sentinel_t as the sentinel type.");
+    using N = std::iter_difference_t<I>;
+    I end = std::ranges::next(first, last);
+    auto length = std::distance(first, end);
+    auto num_chunks = policy.num_chunks(static_cast<std::size_t>(length), pool.size());
+    if (num_chunks == 1) {
+        return our_find_if(our_find_if(first, end, std::not_fn(pred)), end, pred) == end;
+    }
+    std::atomic<N> first_false = length;
+    std::atomic<bool> failed = false;
+    // where the first element of every chunk that doesn't satisfy pred is, the end of the chunk if there is none
+    std::vector<N> chunk_false(num_chunks);
+    auto interval = static_cast<N>(std::max<std::size_t>(policy.cancellation_interval, 1));
+    for_each_chunk(pool, length, num_chunks,
+                   [first, &first_false, &failed, &chunk_false, &pred, interval](std::size_t index, N chunk_first, N chunk_last) {
+        auto block_first = chunk_first;
+        auto found = chunk_last;
+        // the elements that satisfy pred
+        while (block_first != chunk_last and found == chunk_last) {
+            if (failed.load(std::memory_order_relaxed) or
+                (block_first != chunk_first and first_false.load(std::memory_order_relaxed) < chunk_first)) {
+                // elements that satisfy pred after one that doesn't
+                failed.store(true, std::memory_order_relaxed);
+                return;
+            }
+            auto block_last = chunk_last - block_first > interval ? block_first + interval : chunk_last;
+            found = our_find_if(first + block_first, first + block_last, std::not_fn(pred)) - first;
+            found = found == block_last ? chunk_last : found;
+            block_first = block_last;
+        }
+        chunk_false[index] = found;
+        if (found == chunk_last) {
+            return;
+        }
+        atomic_fetch_min(first_false, found);
+        // the elements that don't satisfy pred, until the end of the chunk
+        block_first = found + 1;
+        while (block_first != chunk_last) {
+            if (failed.load(std::memory_order_relaxed)) {
+                return;
+            }
+            auto block_last = chunk_last - block_first > interval ? block_first + interval : chunk_last;
+            if (our_find_if(first + block_first, first + block_last, pred) != first + block_last) {
+                failed.store(true, std::memory_order_relaxed);
+                return;
+            }
+            block_first = block_last;
+        }
+    });
+    if (failed.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    bool seen_false = false;
+    for (std::size_t i = 0; i < num_chunks; ++i) {
+        auto chunk_first = chunk_offset(length, num_chunks, i);
+        if (seen_false and chunk_false[i] != chunk_first) {
+            return false;
+        }
+        seen_false = chunk_false[i] != chunk_offset(length, num_chunks, i + 1);
+    }
+    return true;
+}
+
+template <std::ranges::random_access_range R, class Pred, class I = std::ranges::iterator_t<R>>
+    requires std::indirect_unary_predicate<Pred &, I>
+bool parallel_is_partitioned(R &&range, Pred pred, thread_pool &pool = default_thread_pool(),
+                             partition_policy policy = {}) {
+    return parallel_is_partitioned(std::ranges::begin(range), std::ranges::end(range), pred, pool, policy);
+}
+
+// Copies the elements of [first, last) to [output, output + (last - first)): the ones that satisfy pred first, then
+// the others, both in the order of the input, like std::stable_partition. Returns where the second group starts.
+// The same two passes as parallel_find_all_of: the first counts the elements of every chunk that satisfy pred, the
+// prefix sum of the counts gives each chunk where its two groups go, the elements before the chunk that don't satisfy
+// pred are the ones it didn't count, and the second pass scatters the elements there. pred is called twice for every
+// element, it must be equality preserving.
+// precondition: output has room for last - first elements and doesn't overlap [first, last)
+template <std::random_access_iterator I, std::sentinel_for<I> S, std::random_access_iterator O, class Pred>
+    requires std::indirect_unary_predicate<Pred &, I> and std::indirectly_copyable<I, O>
+O parallel_stable_partition_copy(I first, S last, O output, Pred pred, thread_pool &pool = default_thread_pool(),
+                                 partition_policy policy = {}) {
+    static_assert(!std::is_same_v<S, std::unreachable_sentinel_t>,
+                  "parallel_stable_partition_copy does not support std::unreachable_sentinel_t as the sentinel type.");
+    using N = std::iter_difference_t<I>;
+    using M = std::iter_difference_t<O>;
+    I end = std::ranges::next(first, last);
+    auto length = std::distance(first, end);
+    // a single chunk takes the same two passes on the calling thread
+    auto num_chunks = policy.num_chunks(static_cast<std::size_t>(length), pool.size());
+    // offsets[i + 1] is the number of elements of chunk i that satisfy pred, then the prefix sum makes offsets[i] where
+    // they start
+    std::vector<M> offsets(num_chunks + 1);
+    for_each_chunk(pool, length, num_chunks, [first, &offsets, &pred](std::size_t index, N chunk_first, N chunk_last) {
+        M count = 0;
+        for (auto it = first + chunk_first; it != first + chunk_last; ++it) {
+            count += pred(*it) ? 1 : 0;
+        }
+        offsets[index + 1] = count;
+    });
+    for (std::size_t i = 1; i <= num_chunks; ++i) {
+        offsets[i] += offsets[i - 1];
+    }
+    auto num_true = offsets[num_chunks];
+    for_each_chunk(pool, length, num_chunks, [first, output, &offsets, &pred, num_true](std::size_t index, N chunk_first, N chunk_last) {
+        auto out_true = output + offsets[index];
+        auto out_false = output + (num_true + static_cast<M>(chunk_first) - offsets[index]);
+        for (auto it = first + chunk_first; it != first + chunk_last; ++it) {
+            if (pred(*it)) {
+                *out_true = *it;
+                ++out_true;
+            } else {
+                *out_false = *it;
+                ++out_false;
+            }
+        }
+    });
+    return output + num_true;
+}
+
+template <std::ranges::random_access_range R, std::random_access_iterator O, class Pred,
+          class I = std::ranges::iterator_t<R>>
+    requires std::indirect_unary_predicate<Pred &, I> and std::indirectly_copyable<I, O>
+O parallel_stable_partition_copy(R &&range, O output, Pred pred, thread_pool &pool = default_thread_pool(),
+                                 partition_policy policy = {}) {
+    return parallel_stable_partition_copy(std::ranges::begin(range), std::ranges::end(range), output, pred, pool,
+                                          policy);
+}
+
+// In place, through a buffer of the same size like parallel_sort: the elements are copied to it and moved back.
+// Returns the partition point.
+template <std::random_access_iterator I, std::sentinel_for<I> S, class Pred, class T = std::iter_value_t<I>>
+    requires std::indirect_unary_predicate<Pred &, I> and std::permutable<I> and std::copyable<T> and
+             std::default_initializable<T>
+I parallel_stable_partition(I first, S last, Pred pred, thread_pool &pool = default_thread_pool(),
+                            partition_policy policy = {}) {
+    static_assert(!std::is_same_v<S, std::unreachable_sentinel_t>,
+                  "parallel_stable_partition does not support std::unreachable_sentinel_t as the sentinel type.");
+    using N = std::iter_difference_t<I>;
+    I end = std::ranges::next(first, last);
+    auto length = std::distance(first, end);
+    std::vector<T> buffer(static_cast<std::size_t>(length));
+    auto point = parallel_stable_partition_copy(first, end, buffer.begin(), pred, pool, policy);
+    for_each_chunk(pool, length, policy.num_chunks(static_cast<std::size_t>(length), pool.size()),
+                   [first, &buffer](std::size_t, N chunk_first, N chunk_last) {
+        std::move(buffer.begin() + chunk_first, buffer.begin() + chunk_last, first + chunk_first);
+    });
+    return first + (point - buffer.begin());
+}
+
+// Every chunk runs the 3n / 2 minmax_element (or its SIMD kernel), the results are merged in the order of the chunks.
+// A later chunk only takes the minimum if its minimum is strictly smaller, and always takes the maximum unless its
+// maximum is smaller, so the result is the first minimum and the last maximum, like the sequential version.
+template <std::random_access_iterator I, std::sentinel_for<I> S, class Compare, class T = std::iter_value_t<I>>
+    requires std::strict_weak_order<Compare &, T, T>
+std::pair<I, I> parallel_minmax_element(I first, S last, Compare comp, thread_pool &pool = default_thread_pool(),
+                                        partition_policy policy = {}) {
+    static_assert(!std::is_same_v<S, std::unreachable_sentinel_t>,
+                  "parallel_minmax_element does not support std::unreachable_sentinel_t as the sentinel type.");
+    using N = std::iter_difference_t<I>;
+    I end = std::ranges::next(first, last);
+    auto length = std::distance(first, end);
+    auto num_chunks = policy.num_chunks(static_cast<std::size_t>(length), pool.size());
+    if (num_chunks == 1) {
+        return ::minmax_element(first, end, comp);
+    }
+    std::vector<std::pair<I, I>> partial(num_chunks);
+    for_each_chunk(pool, length, num_chunks, [first, &partial, &comp](std::size_t index, N chunk_first, N chunk_last) {
+        partial[index] = ::minmax_element(first + chunk_first, first + chunk_last, comp);
+    });
+    auto [minimum, maximum] = partial[0];
+    for (std::size_t i = 1; i < num_chunks; ++i) {
+        if (comp(*partial[i].first, *minimum)) {
+            minimum = partial[i].first;
+        }
+        if (not comp(*partial[i].second, *maximum)) {
+            maximum = partial[i].second;
+        }
+    }
+    return {minimum, maximum};
+}
+
+template <std::random_access_iterator I, std::sentinel_for<I> S, class T = std::iter_value_t<I>>
+    requires std::strict_weak_order<std::less<>, T, T>
+std::pair<I, I> parallel_minmax_element(I first, S last, thread_pool &pool = default_thread_pool(),
+                                        partition_policy policy = {}) {
+    static_assert(!std::is_same_v<S, std::unreachable_sentinel_t>,
+                  "parallel_minmax_element does not support std::unreachable_sentinel_t as the sentinel type.");
+    return parallel_minmax_element(first, last, std::less<>{}, pool, policy);
+}
+
+template <std::ranges::random_access_range R, class Compare = std::less<>, class I = std::ranges::iterator_t<R>,
+          class T = std::iter_value_t<I>>
+    requires std::strict_weak_order<Compare &, T, T>
+std::pair<I, I> parallel_minmax_element(R &&range, Compare comp = {}, thread_pool &pool = default_thread_pool(),
+                                        partition_policy policy = {}) {
+    return parallel_minmax_element(std::ranges::begin(range), std::ranges::end(range), comp, pool, policy);
+}
+
+// Our own execution policies. The ones from <execution> can't be used here: for std iterators, ADL would also find the
+// std::copy / std::transform / std::reduce overloads that take a std execution policy, and those are preferred.
+namespace execution {
+
+struct sequenced_policy {};
+struct parallel_policy {};
+struct parallel_unsequenced_policy {};
+struct unsequenced_policy {};
+
+inline constexpr sequenced_policy seq{};
+inline constexpr parallel_policy par{};
+inline constexpr parallel_unsequenced_policy par_unseq{};
+inline constexpr unsequenced_policy unseq{};
+
+template <class T, class P = std::remove_cvref_t<T>>
+concept execution_policy = std::same_as<P, sequenced_policy> or std::same_as<P, parallel_policy> or
+                           std::same_as<P, parallel_unsequenced_policy> or std::same_as<P, unsequenced_policy>;
+
+template <class T, class P = std::remove_cvref_t<T>>
+concept parallel_execution_policy = std::same_as<P, parallel_policy> or std::same_as<P, parallel_unsequenced_policy>;
+
+template <class T, class P = std::remove_cvref_t<T>>
+concept unsequenced_execution_policy = std::same_as<P, unsequenced_policy> or std::same_as<P, parallel_unsequenced_policy>;
+
+} // namespace execution
+
+// Tells the compiler that the iterations of the next loop are independent, so it can vectorize it.
+#if defined(__clang__)
+#define UNSEQ_LOOP _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+#define UNSEQ_LOOP _Pragma("GCC ivdep")
+#else
+#define UNSEQ_LOOP
+#endif
+
+namespace detail {
+
+template <std::random_access_iterator I, std::random_access_iterator O, class Fn>
+O unseq_transform(I first, std::iter_difference_t<I> n, O output, Fn &fn) {
+    UNSEQ_LOOP
+    for (std::iter_difference_t<I> i = 0; i < n; ++i) {
+        output[i] = fn(first[i]);
+    }
+    return output + n;
+}
+
+// Keeps 8 independent accumulators, like faster_reduce, and combines them at the end.
+// This reorders the operations, so the result is exact only if fn is associative and commutative.
+template <std::random_access_iterator I, class T, class ReduceOp>
+T unseq_reduce(I first, std::iter_difference_t<I> n, T init, ReduceOp &fn) {
+    constexpr std::iter_difference_t<I> lanes = 8;
+    if (n < 2 * lanes) {
+        return ::reduce(first, first + n, init, fn);
+    }
+    auto acc = [first]<std::size_t... J>(std::index_sequence<J...>) {
+        return std::array<T, lanes>{T(first[J])...};
+    }(std::make_index_sequence<lanes>{});
+    std::iter_difference_t<I> i = lanes;
+    for (; i + lanes <= n; i += lanes) {
+        for (std::iter_difference_t<I> j = 0; j < lanes; ++j) {
+            acc[j] = fn(acc[j], first[i + j]);
+        }
+    }
+    for (std::iter_difference_t<I> width = lanes / 2; width > 0; width /= 2) {
+        for (std::iter_difference_t<I> j = 0; j < width; ++j) {
+            acc[j] = fn(acc[j], acc[j + width]);
+        }
+    }
+    return ::reduce(first + i, first + n, fn(init, acc[0]), fn);
+}
+
+// The range of a chunk processed by a single thread, vectorized if the policy allows it.
+template <class P, std::random_access_iterator I, std::random_access_iterator O, class Fn>
+O transform_chunk(I first, std::iter_difference_t<I> n, O output, Fn &fn) {
+    if constexpr (execution::unsequenced_execution_policy<P>) {
+        return unseq_transform(first, n, output, fn);
+    } else {
+        return ::transform(first, first + n, output, fn);
+    }
+}
+
+// A copy larger than simd::stream_copy_threshold, with the stream_copy kernel on every chunk. The chunks are split at
+// the cache lines of the output, so every line is written by one thread: the non-temporal stores of two threads to the
+// same line would each send a partial line to memory. The unaligned start of the output goes to the first chunk.
+template <class P, std::contiguous_iterator I, std::contiguous_iterator O>
+O stream_copy_chunks(I first, std::size_t n, O output, thread_pool &pool, partition_policy partition) {
+    constexpr std::size_t line = 64;
+    auto num_chunks = execution::parallel_execution_policy<P> ? partition.num_chunks(n, pool.size()) : 1;
+    auto source = reinterpret_cast<const unsigned char *>(std::to_address(first));
+    auto destination = reinterpret_cast<unsigned char *>(std::to_address(output));
+    auto bytes = n * sizeof(std::iter_value_t<I>);
+    auto head = std::min(bytes, (line - reinterpret_cast<std::uintptr_t>(destination) % line) % line);
+    auto lines = std::max<std::size_t>((bytes - head) / line, 1);
+    for_each_chunk(pool, lines, std::min(num_chunks, lines), [=](std::size_t, std::size_t chunk_first, std::size_t chunk_last) {
+        auto begin = chunk_first == 0 ? 0 : head + chunk_first * line;
+        auto end = chunk_last == lines ? bytes : head + chunk_last * line;
+        simd::kernels().stream_copy(destination + begin, source + begin, end - begin);
+    });
+    return output + static_cast<std::iter_difference_t<O>>(n);
+}
+
+template <class P, std::random_access_iterator I, class T, class ReduceOp>
+T reduce_chunk(I first, std::iter_difference_t<I> n, T init, ReduceOp &fn) {
+    if constexpr (execution::unsequenced_execution_policy<P>) {
+        return unseq_reduce(first, n, init, fn);
+    } else {
+        return ::reduce(first, first + n, init, fn);
+    }
+}
+
+} // namespace detail
+
+// Parallel overloads of copy, transform and reduce from algorithms.h.
+// par and par_unseq split random access ranges into chunks processed on the pool, unseq and par_unseq allow each thread
+// to vectorize its chunk. Input iterators, or policies that don't apply to the iterators, use the sequential versions.
+// Copies of contiguous ranges larger than simd::stream_copy_threshold (copy, or transform with std::identity) bypass the
+// caches with non-temporal stores, on every chunk.
+template <execution::execution_policy P, std::input_iterator I, std::sentinel_for<I> S, std::weakly_incrementable O,
+          class Fn, class T = std::iter_value_t<I>>
+    requires std::indirectly_writable<O, std::invoke_result_t<Fn, T>>
+O transform(P &&, I first, S last, O output, Fn fn, thread_pool &pool = default_thread_pool(), partition_policy partition = {}) {
+    if constexpr (std::same_as<Fn, std::identity> and simd_copyable<I, S, O>) {
+        auto n = static_cast<std::size_t>(last - first);
+        if (n * sizeof(std::iter_value_t<I>) >= simd::stream_copy_threshold) {
+            return detail::stream_copy_chunks<P>(first, n, output, pool, partition);
+        }
+    }
+    if constexpr (std::random_access_iterator<I> and std::random_access_iterator<O> and
+                  not std::same_as<std::remove_cvref_t<P>, execution::sequenced_policy>) {
+        using N = std::iter_difference_t<I>;
+        I end = std::ranges::next(first, last);
+        N length = std::distance(first, end);
+        auto num_chunks = execution::parallel_execution_policy<P> ? partition.num_chunks(static_cast<std::size_t>(length), pool.size()) : 1;
+        if (num_chunks == 1) {
+            return detail::transform_chunk<P>(first, length, output, fn);
+        }
+        for_each_chunk(pool, length, num_chunks, [first, output, &fn](std::size_t, N chunk_first, N chunk_last) {
+            detail::transform_chunk<P>(first + chunk_first, chunk_last - chunk_first, output + chunk_first, fn);
+        });
+        return output + length;
+    } else {
+        return ::transform(first, last, output, fn);
+    }
+}
+
+template <execution::execution_policy P, std::ranges::input_range R, std::weakly_incrementable O, class Fn,
+          class I = std::ranges::iterator_t<R>, class T = std::iter_value_t<I>>
+    requires std::indirectly_writable<O, std::invoke_result_t<Fn, T>>
+O transform(P &&policy, R &&range, O output, Fn fn, thread_pool &pool = default_thread_pool(), partition_policy partition = {}) {
+    return transform(policy, std::ranges::begin(range), std::ranges::end(range), output, fn, pool, partition);
+}
+
+template <execution::execution_policy P, std::input_iterator I, std::sentinel_for<I> S, std::weakly_incrementable O>
+    requires std::indirectly_copyable<I, O>
+O copy(P &&policy, I first, S last, O output, thread_pool &pool = default_thread_pool(), partition_policy partition = {}) {
+    if constexpr (std::random_access_iterator<I> and std::random_access_iterator<O>) {
+        // copying is a transform with the identity function
+        return transform(policy, first, last, output, std::identity{}, pool, partition);
+    } else {
+        return ::copy(first, last, output);
+    }
+}
+
+template <execution::execution_policy P, std::ranges::input_range R, std::weakly_incrementable O>
+    requires std::indirectly_copyable<std::ranges::iterator_t<R>, O>
+O copy(P &&policy, R &&range, O output, thread_pool &pool = default_thread_pool(), partition_policy partition = {}) {
+    return copy(policy, std::ranges::begin(range), std::ranges::end(range), output, pool, partition);
+}
+
+// The parallel versions assume that fn is associative: each chunk is reduced separately, and then the partial results
+// are reduced in order. The unsequenced versions also assume that fn is commutative.
+template <execution::execution_policy P, std::input_iterator I, std::sentinel_for<I> S, class ReduceOp, class T = std::iter_value_t<I>>
+    requires returns_t<ReduceOp, T, T, T>
+T reduce(P &&, I first, S last, T init, ReduceOp fn, thread_pool &pool = default_thread_pool(), partition_policy partition = {}) {
+    if constexpr (std::random_access_iterator<I> and not std::same_as<std::remove_cvref_t<P>, execution::sequenced_policy>) {
+        using N = std::iter_difference_t<I>;
+        I end = std::ranges::next(first, last);
+        N length = std::distance(first, end);
+        auto num_chunks = execution::parallel_execution_policy<P> ? partition.num_chunks(static_cast<std::size_t>(length), pool.size()) : 1;
+        if (num_chunks == 1) {
+            return detail::reduce_chunk<P>(first, length, init, fn);
+        }
+        // chunks are never empty, so each one starts from its first element and we don't need an identity element
+        std::vector<std::optional<T>> partial(num_chunks);
+        for_each_chunk(pool, length, num_chunks, [first, &partial, &fn](std::size_t index, N chunk_first, N chunk_last) {
+            partial[index] = detail::reduce_chunk<P>(first + chunk_first + 1, chunk_last - chunk_first - 1, first[chunk_first], fn);
+        });
+        for (auto &value : partial) {
+            init = fn(init, *value);
+        }
+        return init;
+    } else {
+        return ::reduce(first, last, init, fn);
+    }
+}
+
+template <execution::execution_policy P, std::input_iterator I, std::sentinel_for<I> S, class T = std::iter_value_t<I>>
+    requires reducible<T>
+T reduce(P &&policy, I first, S last, thread_pool &pool = default_thread_pool(), partition_policy partition = {}) {
+    return reduce(policy, first, last, T{}, std::plus<T>{}, pool, partition);
+}
+
+// batch_inner_product with the rows split among the chunks. The query is converted to float once, all the chunks read
+// the same copy. The partition counts the elements of the matrix, but a chunk always has whole rows.
+template <execution::execution_policy P, std::random_access_iterator I, std::sized_sentinel_for<I> S,
+          std::random_access_iterator Q, std::sized_sentinel_for<Q> QS, std::random_access_iterator O,
+          class T = std::iter_value_t<I>, class A = batch_accumulator_t<T>>
+    requires std::same_as<std::iter_value_t<Q>, T> and std::indirectly_writable<O, A>
+O batch_inner_product(P &&, I first, S last, Q query, QS query_last, O output, thread_pool &pool = default_thread_pool(),
+                      partition_policy partition = {}) {
+    auto n = static_cast<std::size_t>(query_last - query);
+    auto elements = static_cast<std::size_t>(last - first);
+    auto rows = n == 0 ? 0 : elements / n;
+    auto num_chunks = execution::parallel_execution_policy<P> ? std::min(partition.num_chunks(elements, pool.size()), rows) : 1;
+    if (num_chunks <= 1) {
+        return ::batch_inner_product(first, last, query, query_last, output);
+    }
+    if constexpr (simd_batch_inner_product<I, Q, T>) {
+        auto x = detail::widen_query(query, n);
+        auto matrix = std::to_address(first);
+        for_each_chunk(pool, rows, num_chunks, [matrix, n, &x, output](std::size_t, std::size_t lo, std::size_t hi) {
+            auto row = [matrix, n](std::size_t r) {
+                return matrix + r * n;
+            };
+            detail::batch_dot_rows<T>(row, lo, hi, n, x.data(), output + static_cast<std::iter_difference_t<O>>(lo));
+        });
+    } else {
+        for_each_chunk(pool, rows, num_chunks, [first, query, n, output](std::size_t, std::size_t lo, std::size_t hi) {
+            for (auto r = lo; r < hi; ++r) {
+                output[static_cast<std::iter_difference_t<O>>(r)] =
+                    detail::widened_inner_product<A>(first + static_cast<std::iter_difference_t<I>>(r * n), query, n);
+            }
+        });
+    }
+    return output + static_cast<std::iter_difference_t<O>>(rows);
+}
+
+template <execution::execution_policy P, std::ranges::random_access_range M, std::ranges::random_access_range Q,
+          std::random_access_iterator O, class T = std::ranges::range_value_t<M>, class A = batch_accumulator_t<T>>
+    requires std::ranges::sized_range<M> and std::ranges::sized_range<Q> and
+             std::same_as<std::ranges::range_value_t<Q>, T> and std::indirectly_writable<O, A>
+O batch_inner_product(P &&policy, M &&matrix, Q &&query, O output, thread_pool &pool = default_thread_pool(),
+                      partition_policy partition = {}) {
+    return batch_inner_product(policy, std::ranges::begin(matrix), std::ranges::end(matrix), std::ranges::begin(query),
+                               std::ranges::end(query), output, pool, partition);
+}
+
+template <execution::execution_policy P, std::ranges::random_access_range Rows, std::ranges::random_access_range Q,
+          std::random_access_iterator O, class Row = std::ranges::range_reference_t<Rows>,
+          class T = std::ranges::range_value_t<Q>, class A = batch_accumulator_t<T>>
+    requires std::ranges::random_access_range<Row> and std::same_as<std::ranges::range_value_t<Row>, T> and
+             std::ranges::sized_range<Q> and std::indirectly_writable<O, A>
+O batch_inner_product(P &&, Rows &&rows, Q &&query, O output, thread_pool &pool = default_thread_pool(),
+                      partition_policy partition = {}) {
+    auto n = static_cast<std::size_t>(std::ranges::size(query));
+    auto num_rows = static_cast<std::size_t>(std::ranges::distance(rows));
+    auto num_chunks =
+        execution::parallel_execution_policy<P> ? std::min(partition.num_chunks(num_rows * n, pool.size()), num_rows) : 1;
+    if (num_chunks <= 1) {
+        return ::batch_inner_product(rows, query, output);
+    }
+    using D = std::ranges::range_difference_t<Rows>;
+    auto first_row = std::ranges::begin(rows);
+    if constexpr (std::ranges::contiguous_range<Row> and std::ranges::contiguous_range<Q> and simd::dot_rows_element<T>) {
+        auto x = detail::widen_query(std::ranges::begin(query), n);
+        for_each_chunk(pool, num_rows, num_chunks, [first_row, n, &x, output](std::size_t, std::size_t lo, std::size_t hi) {
+            auto row = [first_row](std::size_t r) {
+                return std::ranges::data(first_row[static_cast<D>(r)]);
+            };
+            detail::batch_dot_rows<T>(row, lo, hi, n, x.data(), output + static_cast<std::iter_difference_t<O>>(lo));
+        });
+    } else {
+        auto first_query = std::ranges::begin(query);
+        for_each_chunk(pool, num_rows, num_chunks, [first_row, first_query, n, output](std::size_t, std::size_t lo, std::size_t hi) {
+            for (auto r = lo; r < hi; ++r) {
+                output[static_cast<std::iter_difference_t<O>>(r)] =
+                    detail::widened_inner_product<A>(std::ranges::begin(first_row[static_cast<D>(r)]), first_query, n);
+            }
+        });
+    }
+    return output + static_cast<std::iter_difference_t<O>>(num_rows);
 }
+
+namespace pipeline {
+
+// The backends of the fused pipelines for our execution policies: seq is pipeline::run, unseq is run_unrolled, and
+// par and par_unseq run them on the chunks of the range. A filter may drop every element of a chunk, so the chunks
+// can't start from their first element like in reduce above, they start from the identity of reduceOp.
+template <execution::execution_policy P, std::input_iterator I, std::sentinel_for<I> S, class Chain, class T,
+          class ReduceOp, class Identity>
+    requires runnable_on<fused_reduce<Chain, T, ReduceOp, Identity>, I>
+T run(P &&, I first, S last, const fused_reduce<Chain, T, ReduceOp, Identity> &expr,
+      thread_pool &pool = default_thread_pool(), partition_policy partition = {}) {
+    if constexpr (std::random_access_iterator<I> and not std::same_as<std::remove_cvref_t<P>, execution::sequenced_policy>) {
+        static_assert(fused_reduce<Chain, T, ReduceOp, Identity>::has_identity,
+                      "the unsequenced and parallel pipelines need the identity of reduceOp, pass it to pipeline::reduce");
+        using N = std::iter_difference_t<I>;
+        I end = std::ranges::next(first, last);
+        N length = std::distance(first, end);
+        auto reduce_part = [&expr](I part, N n, T acc) {
+            if constexpr (execution::unsequenced_execution_policy<P>) {
+                return unrolled_reduce_into(part, n, expr, std::move(acc));
+            } else {
+                return reduce_into(part, part + n, expr, std::move(acc));
+            }
+        };
+        auto num_chunks = execution::parallel_execution_policy<P> ? partition.num_chunks(static_cast<std::size_t>(length), pool.size()) : 1;
+        if (num_chunks == 1) {
+            return reduce_part(first, length, expr.reduction.init);
+        }
+        std::vector<T> partial(num_chunks, expr.reduction.identity);
+        for_each_chunk(pool, length, num_chunks, [first, &partial, &expr, &reduce_part](std::size_t index, N chunk_first, N chunk_last) {
+            partial[index] = reduce_part(first + chunk_first, chunk_last - chunk_first, expr.reduction.identity);
+        });
+        T acc = expr.reduction.init;
+        for (auto &value : partial) {
+            acc = expr.reduction.fn(acc, value);
+        }
+        return acc;
+    } else {
+        return reduce_into(first, last, expr, expr.reduction.init);
+    }
+}
+
+template <execution::execution_policy P, std::ranges::input_range R, class Chain, class T, class ReduceOp, class Identity>
+    requires runnable_on<fused_reduce<Chain, T, ReduceOp, Identity>, std::ranges::iterator_t<R>>
+T run(P &&policy, R &&range, const fused_reduce<Chain, T, ReduceOp, Identity> &expr,
+      thread_pool &pool = default_thread_pool(), partition_policy partition = {}) {
+    return run(policy, std::ranges::begin(range), std::ranges::end(range), expr, pool, partition);
+}
+
+} // namespace pipeline
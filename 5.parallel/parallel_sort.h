@@ -0,0 +1,213 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <ranges>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "parallel_algorithms.h"
+#include "random_init.h"
+#include "thread_pool.h"
+
+// Parallel sorts on our thread pool, without TBB. parallel_sort picks the LSD radix sort for contiguous ranges of 32
+// and 64 bit integers and floating point numbers ordered by operator<, and the sample sort for everything else.
+// Both move the elements to a buffer of the same size and back, and neither is stable, like std::sort.
+
+namespace detail {
+
+// More buckets than chunks, so a bucket that got more elements than the others doesn't keep a worker busy alone.
+inline constexpr std::size_t buckets_per_chunk = 4;
+// Samples for each splitter, more samples give buckets of more even sizes.
+inline constexpr std::size_t oversampling = 32;
+
+} // namespace detail
+
+// Sample sort: the splitters, taken from a sorted random sample, divide the values into buckets of about the same
+// size. Every chunk counts how many of its elements go to each bucket, the prefix sum of the counts gives each chunk
+// and bucket its region of the buffer, every chunk moves its elements there, and then the buckets are sorted in
+// parallel with std::sort and moved back. The elements of a bucket only depend on the values, many equal values end
+// up in the same bucket, which is then sorted by one worker. The samples are copies of elements, so T must be copyable.
+template <std::random_access_iterator I, std::sentinel_for<I> S, class Compare = std::less<>,
+          class T = std::iter_value_t<I>>
+    requires std::sortable<I, Compare> and std::copyable<T> and std::default_initializable<T>
+void parallel_sample_sort(I first, S last, Compare comp = {}, thread_pool &pool = default_thread_pool(),
+                          partition_policy policy = {}) {
+    using N = std::iter_difference_t<I>;
+    I end = std::ranges::next(first, last);
+    auto length = std::distance(first, end);
+    auto n = static_cast<std::size_t>(length);
+    auto num_chunks = policy.num_chunks(n, pool.size());
+    if (num_chunks == 1) {
+        std::sort(first, end, comp);
+        return;
+    }
+    // the bucket of every element is kept in 16 bits
+    auto num_buckets = std::min<std::size_t>(num_chunks * detail::buckets_per_chunk, 1 << 16);
+
+    // the random positions only depend on n, the splitters on the values
+    std::vector<T> samples(num_buckets * detail::oversampling);
+    for (std::size_t i = 0; i < samples.size(); ++i) {
+        samples[i] = first[static_cast<N>(random_bits(n, i) % n)];
+    }
+    std::sort(samples.begin(), samples.end(), comp);
+    std::vector<T> splitters(num_buckets - 1);
+    for (std::size_t i = 0; i + 1 < num_buckets; ++i) {
+        splitters[i] = std::move(samples[(i + 1) * detail::oversampling]);
+    }
+
+    // counts[chunk * num_buckets + bucket], then where the elements of the chunk in the bucket start
+    std::vector<std::size_t> counts(num_chunks * num_buckets);
+    std::vector<std::uint16_t> buckets(n);
+    for_each_chunk(pool, length, num_chunks,
+                   [first, &splitters, &counts, &buckets, &comp, num_buckets](std::size_t chunk, N lo, N hi) {
+        auto chunk_counts = counts.begin() + static_cast<std::ptrdiff_t>(chunk * num_buckets);
+        for (auto i = lo; i < hi; ++i) {
+            // elements equal to a splitter go to the bucket after it
+            auto bucket = std::upper_bound(splitters.begin(), splitters.end(), first[i], comp) - splitters.begin();
+            buckets[static_cast<std::size_t>(i)] = static_cast<std::uint16_t>(bucket);
+            ++chunk_counts[bucket];
+        }
+    });
+    std::vector<std::size_t> bucket_starts(num_buckets + 1);
+    std::size_t offset = 0;
+    for (std::size_t bucket = 0; bucket < num_buckets; ++bucket) {
+        bucket_starts[bucket] = offset;
+        for (std::size_t chunk = 0; chunk < num_chunks; ++chunk) {
+            offset += std::exchange(counts[chunk * num_buckets + bucket], offset);
+        }
+    }
+    bucket_starts[num_buckets] = offset;
+
+    std::vector<T> buffer(n);
+    for_each_chunk(pool, length, num_chunks, [first, &counts, &buckets, &buffer, num_buckets](std::size_t chunk, N lo, N hi) {
+        auto next = counts.begin() + static_cast<std::ptrdiff_t>(chunk * num_buckets);
+        for (auto i = lo; i < hi; ++i) {
+            buffer[next[buckets[static_cast<std::size_t>(i)]]++] = std::ranges::iter_move(first + i);
+        }
+    });
+
+    for_each_chunk(pool, num_buckets, std::min(num_buckets, pool.size()),
+                   [first, &buffer, &bucket_starts, &comp](std::size_t, std::size_t lo, std::size_t hi) {
+        for (auto bucket = lo; bucket < hi; ++bucket) {
+            auto bucket_first = buffer.begin() + static_cast<std::ptrdiff_t>(bucket_starts[bucket]);
+            auto bucket_last = buffer.begin() + static_cast<std::ptrdiff_t>(bucket_starts[bucket + 1]);
+            std::sort(bucket_first, bucket_last, comp);
+            std::move(bucket_first, bucket_last, first + static_cast<N>(bucket_starts[bucket]));
+        }
+    });
+}
+
+// The unsigned integer whose order is the order of x: the sign bit of signed integers is flipped, and negative floating
+// point numbers, which are stored as sign and magnitude, have all their bits flipped. NaN has no place in the order.
+template <class T>
+using radix_key_t = std::conditional_t<sizeof(T) == 4, std::uint32_t, std::uint64_t>;
+
+template <class T>
+constexpr radix_key_t<T> radix_key(T x) noexcept {
+    using K = radix_key_t<T>;
+    constexpr K sign = K{1} << (8 * sizeof(T) - 1);
+    auto bits = std::bit_cast<K>(x);
+    if constexpr (std::floating_point<T>) {
+        return (bits & sign) != 0 ? ~bits : bits | sign;
+    } else if constexpr (std::signed_integral<T>) {
+        return bits ^ sign;
+    } else {
+        return bits;
+    }
+}
+
+template <class T>
+concept radix_element = (std::integral<T> or (std::floating_point<T> and std::numeric_limits<T>::is_iec559)) and
+                        (sizeof(T) == 4 or sizeof(T) == 8) and not std::same_as<T, bool>;
+
+template <class I, class S, class Compare, class T>
+concept radix_sortable = std::contiguous_iterator<I> and std::sized_sentinel_for<S, I> and
+                         std::same_as<std::iter_value_t<I>, T> and radix_element<T> and less_op<Compare, T>;
+
+// LSD radix sort with 8 bit digits, from the least significant one to the most significant one. Every pass is a
+// counting sort of the elements by one digit, in parallel like the sample sort: the chunks count their digits, the
+// prefix sum over (digit, chunk) gives every chunk its regions of the buffer, and the chunks move their elements
+// there. Each pass is stable, so after the last one the elements are sorted by all the digits. A pass where all the
+// elements have the same digit doesn't move anything and is skipped, small integers need fewer passes.
+template <std::contiguous_iterator I, std::sized_sentinel_for<I> S, class T = std::iter_value_t<I>>
+    requires radix_element<T> and std::permutable<I>
+void parallel_radix_sort(I first, S last, thread_pool &pool = default_thread_pool(), partition_policy policy = {}) {
+    constexpr std::size_t radix = 256;
+    auto n = static_cast<std::size_t>(last - first);
+    if (n < policy.sequential_threshold) {
+        std::sort(first, first + static_cast<std::iter_difference_t<I>>(n));
+        return;
+    }
+    // unlike the comparison sorts, one chunk is still much faster than std::sort, it needs no comparisons
+    auto num_chunks = policy.num_chunks(n, pool.size());
+    T *data = std::to_address(first);
+    std::vector<T> buffer(n);
+    T *source = data;
+    T *target = buffer.data();
+    std::vector<std::size_t> counts(num_chunks * radix);
+    for (std::size_t shift = 0; shift < 8 * sizeof(T); shift += 8) {
+        auto digit = [shift](T x) {
+            return static_cast<std::size_t>((radix_key(x) >> shift) & (radix - 1));
+        };
+        std::fill(counts.begin(), counts.end(), 0);
+        for_each_chunk(pool, n, num_chunks, [source, &counts, digit](std::size_t chunk, std::size_t lo, std::size_t hi) {
+            auto chunk_counts = counts.data() + chunk * radix;
+            for (auto i = lo; i < hi; ++i) {
+                ++chunk_counts[digit(source[i])];
+            }
+        });
+        std::size_t offset = 0;
+        bool one_digit = false;
+        for (std::size_t d = 0; d < radix; ++d) {
+            auto digit_start = offset;
+            for (std::size_t chunk = 0; chunk < num_chunks; ++chunk) {
+                offset += std::exchange(counts[chunk * radix + d], offset);
+            }
+            one_digit = one_digit or offset - digit_start == n;
+        }
+        if (one_digit) {
+            continue;
+        }
+        for_each_chunk(pool, n, num_chunks, [source, target, &counts, digit](std::size_t chunk, std::size_t lo, std::size_t hi) {
+            auto next = counts.data() + chunk * radix;
+            for (auto i = lo; i < hi; ++i) {
+                target[next[digit(source[i])]++] = source[i];
+            }
+        });
+        std::swap(source, target);
+    }
+    if (source != data) {
+        // an odd number of passes moved the elements, so they are in the buffer
+        for_each_chunk(pool, n, num_chunks, [source, data](std::size_t, std::size_t lo, std::size_t hi) {
+            std::copy(source + lo, source + hi, data + lo);
+        });
+    }
+}
+
+template <std::random_access_iterator I, std::sentinel_for<I> S, class Compare = std::less<>,
+          class T = std::iter_value_t<I>>
+    requires std::sortable<I, Compare> and std::copyable<T> and std::default_initializable<T>
+void parallel_sort(I first, S last, Compare comp = {}, thread_pool &pool = default_thread_pool(),
+                   partition_policy policy = {}) {
+    if constexpr (radix_sortable<I, S, Compare, T>) {
+        parallel_radix_sort(first, last, pool, policy);
+    } else {
+        parallel_sample_sort(first, last, comp, pool, policy);
+    }
+}
+
+template <std::ranges::random_access_range R, class Compare = std::less<>, class I = std::ranges::iterator_t<R>,
+          class T = std::iter_value_t<I>>
+    requires std::sortable<I, Compare> and std::copyable<T> and std::default_initializable<T>
+void parallel_sort(R &&range, Compare comp = {}, thread_pool &pool = default_thread_pool(),
+                   partition_policy policy = {}) {
+    parallel_sort(std::ranges::begin(range), std::ranges::end(range), comp, pool, policy);
+}
@@ -1,27 +1,217 @@
 #pragma once
 #include <algorithm>
-#include <random>
-#include <numeric>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <ranges>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "parallel_algorithms.h"
+#include "thread_pool.h"
 
-template <class T, class Dtype = typename T::value_type>
-T random_container(int size) {
-    auto rand = std::default_random_engine(3);
-    auto v = std::vector<Dtype>(size);
-    std::iota(v.begin(), v.end(), Dtype{0});
-    std::ranges::shuffle(v, rand);
-    return T(v.begin(), v.end());
+// The benchmark inputs are generated straight into the container, in parallel. The random numbers come from
+// counter-based streams, the n-th number of a stream only depends on the seed and n, so the contents don't depend on
+// the number of threads or on how the range is split into chunks.
+
+// Linux places every page on the NUMA node of the thread that writes it first (see numa.h). The parallel algorithms run
+// the same part of a range on the same worker (see for_each_chunk), so memory that is first written with for_each_chunk
+// is processed later on the node that holds it.
+
+// std::allocator with default initialization instead of value initialization: first_touch_vector<int>(n) leaves the
+// ints uninitialized and its pages untouched, where std::vector<int>(n) writes all of them from the calling thread.
+template <class T>
+struct first_touch_allocator : std::allocator<T> {
+    template <class U>
+    struct rebind {
+        using other = first_touch_allocator<U>;
+    };
+
+    first_touch_allocator() = default;
+
+    template <class U>
+    first_touch_allocator(const first_touch_allocator<U> &) noexcept {}
+
+    template <class U>
+    void construct(U *p) noexcept(std::is_nothrow_default_constructible_v<U>) {
+        ::new (static_cast<void *>(p)) U;
+    }
+
+    template <class U, class... Args>
+    void construct(U *p, Args &&...args) {
+        std::construct_at(p, std::forward<Args>(args)...);
+    }
+};
+
+template <class T>
+using first_touch_vector = std::vector<T, first_touch_allocator<T>>;
+
+// Writes T{} to [first, first + n) in the chunks of for_each_chunk, which places the pages that nobody wrote yet, like
+// those of a first_touch_vector or of an anonymous mapped_array.
+template <std::random_access_iterator I, class T = std::iter_value_t<I>>
+    requires std::default_initializable<T> and std::indirectly_writable<I, T>
+void first_touch(I first, std::iter_difference_t<I> n, thread_pool &pool = default_thread_pool(),
+                 const partition_policy &policy = {}) {
+    auto num_chunks = policy.num_chunks(static_cast<std::size_t>(n), pool.size());
+    for_each_chunk(pool, n, num_chunks, [first](std::size_t, auto chunk_first, auto chunk_last) {
+        std::fill(first + chunk_first, first + chunk_last, T{});
+    });
 }
 
-template <class T, class Dtype = typename T::value_type>
-T random_container_floating(int size) {
-    auto rand = std::default_random_engine(3);
-    std::uniform_real_distribution<Dtype> dist(static_cast<Dtype>(0.0), static_cast<Dtype>(1.0));
+// Reads one byte of every page of [first, first + n) in the chunks of for_each_chunk. The pages of a mapped file that
+// is not in the page cache yet are read from the disk on the node of the worker, so a loaded input is placed like a
+// generated one. Pages that are in memory already stay where they are.
+template <std::contiguous_iterator I>
+void prefault(I first, std::iter_difference_t<I> n, thread_pool &pool = default_thread_pool(),
+              const partition_policy &policy = {}) {
+    auto data = reinterpret_cast<const volatile unsigned char *>(std::to_address(first));
+    auto num_chunks = policy.num_chunks(static_cast<std::size_t>(n), pool.size());
+    // the chunks split the elements, like the algorithms that process them
+    for_each_chunk(pool, n, num_chunks, [data](std::size_t, auto chunk_first, auto chunk_last) {
+        constexpr std::iter_difference_t<I> page = 4096;
+        constexpr auto size = static_cast<std::iter_difference_t<I>>(sizeof(std::iter_value_t<I>));
+        for (auto offset = chunk_first * size; offset < chunk_last * size; offset += page) {
+            (void)data[offset];
+        }
+    });
+}
+
+// The splitmix64 finalizer, a bijection of the 64 bit integers where every input bit changes every output bit.
+constexpr std::uint64_t splitmix64(std::uint64_t x) noexcept {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
 
-    std::vector<Dtype> v(size);
-    for (auto &val : v) {
-        val = dist(rand);
+// The index-th number of the splitmix64 generator started at seed.
+constexpr std::uint64_t random_bits(std::uint64_t seed, std::uint64_t index) noexcept {
+    return splitmix64(seed + (index + 1) * 0x9e3779b97f4a7c15ull);
+}
+
+// The numbers of one stream one after the other, for the sequential parts.
+struct splitmix_stream {
+    std::uint64_t seed;
+    std::uint64_t index = 0;
+
+    std::uint64_t operator()() noexcept {
+        return random_bits(seed, index++);
     }
-    return T(v.begin(), v.end());
+};
+
+// Uniform in [0, bound), multiply and shift with rejection of the few values that would make it biased (Lemire).
+inline std::uint64_t random_below(std::uint64_t bound, splitmix_stream &next) noexcept {
+    auto product = static_cast<unsigned __int128>(next()) * bound;
+    if (static_cast<std::uint64_t>(product) < bound) {
+        auto threshold = -bound % bound;
+        while (static_cast<std::uint64_t>(product) < threshold) {
+            product = static_cast<unsigned __int128>(next()) * bound;
+        }
+    }
+    return static_cast<std::uint64_t>(product >> 64);
+}
+
+// Uniform in [0, 1), as many random bits as the type has digits so it never rounds up to 1.
+template <std::floating_point T>
+constexpr T unit_interval(std::uint64_t bits) noexcept {
+    constexpr int digits = std::min(std::numeric_limits<T>::digits, 53);
+    return static_cast<T>(bits >> (64 - digits)) * (T{1} / static_cast<T>(std::uint64_t{1} << digits));
+}
+
+// Fills [first, first + n) with uniform numbers in [0, 1), element i gets the i-th number of the stream.
+template <std::random_access_iterator I>
+    requires std::floating_point<std::iter_value_t<I>>
+void random_fill_floating(I first, std::iter_difference_t<I> n, std::uint64_t seed,
+                          thread_pool &pool = default_thread_pool(), const partition_policy &policy = {}) {
+    using T = std::iter_value_t<I>;
+    auto num_chunks = policy.num_chunks(static_cast<std::size_t>(n), pool.size());
+    for_each_chunk(pool, n, num_chunks, [first, seed](std::size_t, auto chunk_first, auto chunk_last) {
+        for (auto i = chunk_first; i < chunk_last; ++i) {
+            first[i] = unit_interval<T>(random_bits(seed, static_cast<std::uint64_t>(i)));
+        }
+    });
+}
+
+// Writes a uniformly random permutation of 0, 1, ..., n - 1 to [first, first + n), without a temporary copy.
+// Fisher-Yates is sequential, each swap may touch any element. Here every value goes to one of a few buckets at
+// random, the buckets are written in parallel as in a counting sort, and Fisher-Yates shuffles each bucket on its own.
+// The bucket sizes are multinomial and every bucket is a uniform permutation of its values, so the whole is uniform.
+// The numbers of buckets and chunks only depend on n, and each bucket shuffles with its own stream.
+template <std::random_access_iterator I>
+    requires std::integral<std::iter_value_t<I>>
+void random_permutation(I first, std::iter_difference_t<I> n, std::uint64_t seed,
+                        thread_pool &pool = default_thread_pool()) {
+    using T = std::iter_value_t<I>;
+    auto length = static_cast<std::size_t>(n);
+    // about a million elements in a bucket, a bucket of int32 fits in most L3 caches while it is shuffled
+    auto num_buckets = std::clamp<std::size_t>(length >> 20, 1, 1024);
+    auto num_chunks = std::clamp<std::size_t>(length >> 16, 1, 256);
+    auto bucket_seed = splitmix64(seed ^ 0x5bd1e995ull);
+    auto bucket_of = [bucket_seed, num_buckets](std::size_t value) {
+        auto product = static_cast<unsigned __int128>(random_bits(bucket_seed, value)) * num_buckets;
+        return static_cast<std::size_t>(product >> 64);
+    };
+
+    // the values are written to random positions, so their pages would be placed at random
+    first_touch(first, n, pool);
+
+    // counts[chunk * num_buckets + bucket] is how many values of the chunk go to the bucket, then where they start
+    std::vector<std::size_t> counts(num_chunks * num_buckets);
+    for_each_chunk(pool, length, num_chunks, [&counts, bucket_of, num_buckets](std::size_t chunk, auto lo, auto hi) {
+        auto chunk_counts = counts.begin() + chunk * num_buckets;
+        for (auto value = lo; value < hi; ++value) {
+            ++chunk_counts[bucket_of(value)];
+        }
+    });
+    std::vector<std::size_t> bucket_starts(num_buckets + 1);
+    std::size_t offset = 0;
+    for (std::size_t bucket = 0; bucket < num_buckets; ++bucket) {
+        bucket_starts[bucket] = offset;
+        for (std::size_t chunk = 0; chunk < num_chunks; ++chunk) {
+            offset += std::exchange(counts[chunk * num_buckets + bucket], offset);
+        }
+    }
+    bucket_starts[num_buckets] = offset;
+
+    for_each_chunk(pool, length, num_chunks, [&counts, first, bucket_of, num_buckets](std::size_t chunk, auto lo, auto hi) {
+        auto next = counts.begin() + chunk * num_buckets;
+        for (auto value = lo; value < hi; ++value) {
+            first[next[bucket_of(value)]++] = static_cast<T>(value);
+        }
+    });
+
+    auto shuffle_chunks = std::min(num_buckets, pool.size());
+    for_each_chunk(pool, num_buckets, shuffle_chunks, [&bucket_starts, first, seed](std::size_t, auto lo, auto hi) {
+        for (auto bucket = lo; bucket < hi; ++bucket) {
+            auto next = splitmix_stream{splitmix64(seed + bucket)};
+            auto bucket_first = first + bucket_starts[bucket];
+            auto size = bucket_starts[bucket + 1] - bucket_starts[bucket];
+            for (std::size_t i = size; i > 1; --i) {
+                std::iter_swap(bucket_first + (i - 1), bucket_first + random_below(i, next));
+            }
+        }
+    });
+}
+
+// A random permutation of 0, 1, ..., size - 1. For first_touch_vector the pages are placed by the workers, see
+// first_touch.
+template <class T, class Dtype = typename T::value_type>
+    requires std::ranges::random_access_range<T>
+T random_container(int size, std::uint64_t seed = 3, thread_pool &pool = default_thread_pool()) {
+    auto container = T(size);
+    random_permutation(std::ranges::begin(container), size, seed, pool);
+    return container;
+}
+
+// Uniform numbers in [0, 1)
+template <class T, class Dtype = typename T::value_type>
+    requires std::ranges::random_access_range<T>
+T random_container_floating(int size, std::uint64_t seed = 3, thread_pool &pool = default_thread_pool()) {
+    auto container = T(size);
+    random_fill_floating(std::ranges::begin(container), size, seed, pool);
+    return container;
 }
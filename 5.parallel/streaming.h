@@ -0,0 +1,346 @@
+#pragma once
+#include <cerrno>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#define STREAMING_HAS_POSIX
+#endif
+
+#include "parallel_algorithms.h"
+#include "thread_pool.h"
+
+// Algorithms over inputs that don't fit in memory: files, pipes and sockets are read in blocks of a fixed size into
+// two buffers. While the algorithm works on one block, the pool reads the next one into the other buffer, so the
+// reads overlap with the computation and the memory stays at two blocks however long the input is.
+
+// Something that fills a buffer with the next bytes of the input, returns how many, 0 at the end and -1 on an error
+// (with errno set), like ::read.
+template <class S>
+concept byte_source = requires(S &source, std::span<std::byte> buffer) {
+    { source.read(buffer) } -> std::convertible_to<std::ptrdiff_t>;
+};
+
+// Something that takes the next bytes of the output, returns false on an error (with errno set).
+template <class S>
+concept byte_sink = requires(S &sink, std::span<const std::byte> buffer) {
+    { sink.write(buffer) } -> std::convertible_to<bool>;
+};
+
+// A file descriptor that belongs to the caller: a pipe, a socket, standard input or output.
+class fd_stream {
+public:
+    explicit fd_stream(int fd) noexcept : fd_(fd) {}
+
+    std::ptrdiff_t read(std::span<std::byte> buffer) {
+#if defined(STREAMING_HAS_POSIX)
+        std::ptrdiff_t result;
+        do {
+            result = ::read(fd_, buffer.data(), buffer.size());
+        } while (result < 0 and errno == EINTR);
+        return result;
+#else
+        (void)buffer;
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+
+    // writes all of buffer, a pipe or a socket may take it in pieces
+    bool write(std::span<const std::byte> buffer) {
+#if defined(STREAMING_HAS_POSIX)
+        while (not buffer.empty()) {
+            auto written = ::write(fd_, buffer.data(), buffer.size());
+            if (written < 0 and errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            buffer = buffer.subspan(static_cast<std::size_t>(written));
+        }
+        return true;
+#else
+        (void)buffer;
+        errno = ENOSYS;
+        return false;
+#endif
+    }
+
+protected:
+    int fd_;
+};
+
+// A file we open, read from the start to the end. The pages we have read are dropped from the page cache, so a pass
+// over a file larger than memory doesn't push everything else out of it.
+// Like mapped_array, a file that could not be opened has valid() false and error() tells why.
+class file_source : public fd_stream {
+public:
+    explicit file_source(const std::string &path) : fd_stream(-1) {
+#if defined(STREAMING_HAS_POSIX)
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) {
+            error_ = path + ": " + std::strerror(errno);
+            return;
+        }
+#if defined(POSIX_FADV_SEQUENTIAL)
+        posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#else
+        error_ = path + ": streaming needs POSIX files";
+#endif
+    }
+
+    file_source(const file_source &) = delete;
+    file_source &operator=(const file_source &) = delete;
+
+    ~file_source() {
+#if defined(STREAMING_HAS_POSIX)
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+#endif
+    }
+
+    bool valid() const noexcept {
+        return error_.empty();
+    }
+
+    const std::string &error() const noexcept {
+        return error_;
+    }
+
+    std::ptrdiff_t read(std::span<std::byte> buffer) {
+        auto result = fd_stream::read(buffer);
+#if defined(STREAMING_HAS_POSIX) && defined(POSIX_FADV_DONTNEED)
+        if (result > 0) {
+            posix_fadvise(fd_, static_cast<off_t>(offset_), result, POSIX_FADV_DONTNEED);
+            offset_ += static_cast<std::uint64_t>(result);
+        }
+#endif
+        return result;
+    }
+
+private:
+    std::uint64_t offset_ = 0;
+    std::string error_;
+};
+
+// Splits a byte source into blocks of block_size elements of T, the last block may be shorter. The next block is read
+// on the pool while the caller works on the current one. A read error ends the input early, error() tells why.
+template <class T, byte_source Source>
+    requires std::is_trivially_copyable_v<T>
+class block_reader {
+public:
+    block_reader(Source &source, std::size_t block_size, thread_pool &pool = default_thread_pool())
+        : source_(source), pool_(pool) {
+        for (auto &buffer : buffers_) {
+            buffer.resize(std::max<std::size_t>(block_size, 1));
+        }
+        read_ahead(0);
+    }
+
+    block_reader(const block_reader &) = delete;
+    block_reader &operator=(const block_reader &) = delete;
+
+    ~block_reader() {
+        // the read in flight writes into our buffer
+        if (pending_.valid()) {
+            pool_.wait(pending_);
+        }
+    }
+
+    // The next block, empty at the end of the input. It stays valid until the next call, which also starts reading
+    // into its buffer again.
+    std::span<const T> next() {
+        if (not pending_.valid()) {
+            return {};
+        }
+        auto elements = pool_.wait(pending_);
+        auto current = next_buffer_;
+        if (elements == buffers_[current].size()) {
+            read_ahead(1 - current);
+        }
+        return {buffers_[current].data(), elements};
+    }
+
+    const std::string &error() const noexcept {
+        return error_;
+    }
+
+    // The elements one by one, for the algorithms that take input iterators. Reading the elements consumes the input,
+    // so the range can only be traversed once. The algorithms below work on whole blocks and are much faster.
+    class iterator {
+    public:
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+
+        explicit iterator(block_reader *reader) : reader_(reader), block_(reader->next()) {}
+
+        const T &operator*() const noexcept {
+            return block_[position_];
+        }
+
+        iterator &operator++() {
+            if (++position_ == block_.size()) {
+                block_ = reader_->next();
+                position_ = 0;
+            }
+            return *this;
+        }
+
+        void operator++(int) {
+            ++*this;
+        }
+
+        bool operator==(std::default_sentinel_t) const noexcept {
+            return block_.empty();
+        }
+
+    private:
+        block_reader *reader_ = nullptr;
+        std::span<const T> block_;
+        std::size_t position_ = 0;
+    };
+
+    iterator begin() {
+        return iterator(this);
+    }
+
+    std::default_sentinel_t end() const noexcept {
+        return {};
+    }
+
+private:
+    // Reads until the buffer is full or the input ends, a socket or a pipe returns what it has so far.
+    // Returns the number of whole elements read, a partial element at the end of the input is an error.
+    void read_ahead(std::size_t index) {
+        next_buffer_ = index;
+        pending_ = pool_.submit([this, index]() {
+            auto bytes = std::as_writable_bytes(std::span(buffers_[index]));
+            std::size_t filled = 0;
+            while (filled < bytes.size()) {
+                auto result = source_.read(bytes.subspan(filled));
+                if (result < 0) {
+                    error_ = std::string("read: ") + std::strerror(errno);
+                    break;
+                }
+                if (result == 0) {
+                    break;
+                }
+                filled += static_cast<std::size_t>(result);
+            }
+            if (filled % sizeof(T) != 0 and error_.empty()) {
+                error_ = "the input ends in the middle of an element";
+            }
+            return filled / sizeof(T);
+        });
+    }
+
+    Source &source_;
+    thread_pool &pool_;
+    std::vector<T> buffers_[2];
+    std::size_t next_buffer_ = 0;
+    std::future<std::size_t> pending_;
+    std::string error_;
+};
+
+// reduce over every block, the result of each block is the initial value of the next one. The blocks are reduced in
+// order, so like the parallel reduce this only assumes fn is associative (and commutative with unseq).
+template <execution::execution_policy P, class T, byte_source Source, class ReduceOp>
+    requires returns_t<ReduceOp, T, T, T>
+T stream_reduce(P &&policy, block_reader<T, Source> &reader, T init, ReduceOp fn,
+                thread_pool &pool = default_thread_pool(), partition_policy partition = {}) {
+    for (auto block = reader.next(); not block.empty(); block = reader.next()) {
+        init = reduce(policy, block.begin(), block.end(), init, fn, pool, partition);
+    }
+    return init;
+}
+
+template <execution::execution_policy P, class T, byte_source Source>
+    requires reducible<T>
+T stream_reduce(P &&policy, block_reader<T, Source> &reader, thread_pool &pool = default_thread_pool(),
+                partition_policy partition = {}) {
+    return stream_reduce(policy, reader, T{}, std::plus<T>{}, pool, partition);
+}
+
+// The position of the first element equal to value in the whole input, nullopt if there is none. Stops reading at the
+// block that contains it. The sequential policies use find and its SIMD kernels, the parallel ones parallel_find_if.
+template <execution::execution_policy P, class T, byte_source Source>
+std::optional<std::uint64_t> stream_find(P &&, block_reader<T, Source> &reader, const T &value,
+                                         thread_pool &pool = default_thread_pool(), partition_policy partition = {}) {
+    std::uint64_t offset = 0;
+    for (auto block = reader.next(); not block.empty(); block = reader.next()) {
+        const T *found;
+        if constexpr (execution::parallel_execution_policy<P>) {
+            found = parallel_find_if(block.data(), block.data() + block.size(), [&value](const T &x) {
+                return x == value;
+            }, pool, partition);
+        } else {
+            found = ::find(block.data(), block.data() + block.size(), value);
+        }
+        if (found != block.data() + block.size()) {
+            return offset + static_cast<std::uint64_t>(found - block.data());
+        }
+        offset += block.size();
+    }
+    return std::nullopt;
+}
+
+// transform of every block into one of two output buffers. While a block is transformed, the previous one is written
+// to sink on the pool. Returns the number of elements written, or nullopt if writing failed (errno tells why).
+template <execution::execution_policy P, class T, byte_source Source, byte_sink Sink, class Fn,
+          class U = std::invoke_result_t<Fn &, const T &>>
+    requires std::is_trivially_copyable_v<U>
+std::optional<std::uint64_t> stream_transform(P &&policy, block_reader<T, Source> &reader, Sink &sink, Fn fn,
+                                              thread_pool &pool = default_thread_pool(),
+                                              partition_policy partition = {}) {
+    std::vector<U> outputs[2];
+    std::future<bool> pending;
+    std::size_t current = 0;
+    std::uint64_t written = 0;
+    auto wait_pending = [&pool, &pending]() {
+        return not pending.valid() or pool.wait(pending);
+    };
+    try {
+        for (auto block = reader.next(); not block.empty(); block = reader.next()) {
+            auto &output = outputs[current];
+            output.resize(block.size());
+            transform(policy, block.data(), block.data() + block.size(), output.data(), fn, pool, partition);
+            if (not wait_pending()) {
+                // the first failed write ends the stream, the next blocks would not be written either
+                return std::nullopt;
+            }
+            pending = pool.submit([&sink, &output]() {
+                return sink.write(std::as_bytes(std::span(output)));
+            });
+            written += block.size();
+            current = 1 - current;
+        }
+    } catch (...) {
+        // the write in flight refers to outputs, it has to finish before they are destroyed
+        if (pending.valid()) {
+            try {
+                pool.wait(pending);
+            } catch (...) {
+            }
+        }
+        throw;
+    }
+    return wait_pending() ? std::optional(written) : std::nullopt;
+}
@@ -0,0 +1,212 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "numa.h"
+
+// A persistent pool of worker threads. Each worker owns a deque of tasks: it pushes and pops its own work at the back
+// (LIFO, good for cache locality) and, when its deque is empty, steals from the front of the other deques (FIFO, the
+// oldest and usually the largest pieces of work). Creating the threads once and reusing them removes the thread
+// creation and join cost that std::async pays on every call.
+class thread_pool {
+public:
+    using task = std::move_only_function<void()>;
+
+    // Where the workers run. nodes pins every worker to the cpus of one NUMA node (numa::node_of_worker), so a worker
+    // that touched a chunk of a range first, and placed its pages on its node, reads them from there later.
+    enum class pinning { none, nodes };
+
+    explicit thread_pool(std::size_t num_threads = std::max(1u, std::thread::hardware_concurrency()),
+                         pinning pin = pinning::none)
+        : queues_(std::max<std::size_t>(num_threads, 1)) {
+        workers_.reserve(queues_.size());
+        for (std::size_t i = 0; i < queues_.size(); ++i) {
+            workers_.emplace_back([this, i, pin]() {
+                if (pin == pinning::nodes) {
+                    numa::pin_current_thread(numa::node_of_worker(i, queues_.size()));
+                }
+                worker_loop(i);
+            });
+        }
+    }
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    ~thread_pool() {
+        {
+            std::lock_guard lock(sleep_mutex_);
+            stop_ = true;
+        }
+        sleep_cv_.notify_all();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    std::size_t size() const noexcept {
+        return workers_.size();
+    }
+
+    // Schedules fn on the pool. Tasks submitted from a worker go to that worker's own deque, tasks submitted from
+    // outside the pool are distributed round-robin.
+    template <class Fn, class R = std::invoke_result_t<std::decay_t<Fn>>>
+        requires std::invocable<std::decay_t<Fn>>
+    std::future<R> submit(Fn &&fn) {
+        auto packaged = std::packaged_task<R()>(std::forward<Fn>(fn));
+        auto future = packaged.get_future();
+        push(task(std::move(packaged)));
+        return future;
+    }
+
+    // Schedules fn on the deque of the given worker. The worker runs it unless it is busy and another one steals it,
+    // so submitting the same part of every range to the same worker keeps it on the same node.
+    template <class Fn, class R = std::invoke_result_t<std::decay_t<Fn>>>
+        requires std::invocable<std::decay_t<Fn>>
+    std::future<R> submit_to(std::size_t worker, Fn &&fn) {
+        auto packaged = std::packaged_task<R()>(std::forward<Fn>(fn));
+        auto future = packaged.get_future();
+        push(task(std::move(packaged)), worker % queues_.size());
+        return future;
+    }
+
+    // As submit_to, without a future, for tasks that signal their end themselves. fn must not throw.
+    template <class Fn>
+        requires std::invocable<std::decay_t<Fn>>
+    void post_to(std::size_t worker, Fn &&fn) {
+        push(task(std::forward<Fn>(fn)), worker % queues_.size());
+    }
+
+    // Runs one pending task on the calling thread. Returns false if there was nothing to run.
+    bool run_pending_task() {
+        auto index = current_worker_index();
+        auto found = pop(index == no_worker ? next_queue_.load(std::memory_order_relaxed) % queues_.size() : index);
+        if (not found) {
+            return false;
+        }
+        (*found)();
+        return true;
+    }
+
+    // Waits for the future while helping with the pending tasks. A worker that blocked in future::get() on a task that
+    // sits in its own deque would deadlock, helping avoids that and keeps the calling thread busy.
+    template <class T>
+    T wait(std::future<T> &future) {
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            if (not run_pending_task()) {
+                future.wait_for(std::chrono::microseconds(50));
+            }
+        }
+        return future.get();
+    }
+
+private:
+    static constexpr std::size_t no_worker = static_cast<std::size_t>(-1);
+
+    struct worker_queue {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    // Each thread remembers which pool it belongs to, so nested submissions can use the local deque.
+    std::size_t current_worker_index() const noexcept {
+        return current_pool_ == this ? current_index_ : no_worker;
+    }
+
+    void push(task t) {
+        auto index = current_worker_index();
+        if (index == no_worker) {
+            index = next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+        }
+        push(std::move(t), index);
+    }
+
+    void push(task t, std::size_t index) {
+        {
+            auto &queue = queues_[index];
+            std::lock_guard lock(queue.mutex);
+            queue.tasks.push_back(std::move(t));
+        }
+        pending_.fetch_add(1, std::memory_order_release);
+        // taking the lock orders this notification after a worker that checked pending_ is already waiting
+        { std::lock_guard lock(sleep_mutex_); }
+        sleep_cv_.notify_one();
+    }
+
+    std::optional<task> pop(std::size_t index) {
+        {
+            // our own deque, newest first
+            auto &queue = queues_[index];
+            std::lock_guard lock(queue.mutex);
+            if (not queue.tasks.empty()) {
+                auto t = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+                pending_.fetch_sub(1, std::memory_order_relaxed);
+                return t;
+            }
+        }
+        for (std::size_t i = 1; i < queues_.size(); ++i) {
+            // steal from the other deques, oldest first
+            auto &queue = queues_[(index + i) % queues_.size()];
+            std::lock_guard lock(queue.mutex);
+            if (not queue.tasks.empty()) {
+                auto t = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                pending_.fetch_sub(1, std::memory_order_relaxed);
+                return t;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void worker_loop(std::size_t index) {
+        current_pool_ = this;
+        current_index_ = index;
+        while (true) {
+            if (auto t = pop(index)) {
+                (*t)();
+                continue;
+            }
+            std::unique_lock lock(sleep_mutex_);
+            sleep_cv_.wait(lock, [this]() { return stop_ or pending_.load(std::memory_order_acquire) != 0; });
+            if (stop_ and pending_.load(std::memory_order_acquire) == 0) {
+                return;
+            }
+        }
+    }
+
+    std::vector<worker_queue> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<std::size_t> pending_{0};
+    std::atomic<std::size_t> next_queue_{0};
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cv_;
+    bool stop_ = false;
+
+    static inline thread_local const thread_pool *current_pool_ = nullptr;
+    static inline thread_local std::size_t current_index_ = no_worker;
+};
+
+// The pool used by the parallel algorithms when the caller does not provide one. With THREAD_POOL_PINNING=nodes in the
+// environment its workers are pinned to the NUMA nodes.
+inline thread_pool &default_thread_pool() {
+    static thread_pool pool(std::max(1u, std::thread::hardware_concurrency()), []() {
+        auto requested = std::getenv("THREAD_POOL_PINNING");
+        return requested != nullptr and std::string_view(requested) == "nodes" ? thread_pool::pinning::nodes
+                                                                                : thread_pool::pinning::none;
+    }());
+    return pool;
+}
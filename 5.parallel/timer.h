@@ -1,34 +1,75 @@
 #pragma once
+#include <algorithm>
 #include <chrono>
 #include <concepts>
 #include <print>
 #include <cstdint>
+#include <numeric>
+#include <string>
 #include <string_view>
+#include <vector>
+
+#include "../3.iterators/no_modules/report.h"
 
 namespace timer {
 
 using clock = std::chrono::high_resolution_clock;
 
-double time(std::invocable auto init, std::invocable auto fn, std::uint32_t repeats) {
-    auto total = 0.0;
+// One sample for each call of fn, init is not timed. With --counters, events gets the sum of the counters of the calls.
+std::vector<double> time_samples(std::invocable auto init, std::invocable auto fn, std::uint32_t repeats,
+                                 counters *events = nullptr) {
+    auto hw = events ? hardware_counters() : nullptr;
+    std::vector<double> samples;
+    samples.reserve(repeats);
     while (repeats--) {
         init();
+        auto before = hw ? hw->read() : counters{};
         auto start = clock::now();
         fn();
         auto end = clock::now();
-        total += std::chrono::duration<double>(end - start).count();
-    }   
-    return total; 
+        if (hw) {
+            *events += hw->read() - before;
+        }
+        samples.push_back(std::chrono::duration<double>(end - start).count());
+    }
+    return samples;
+}
+
+double time(std::invocable auto init, std::invocable auto fn, std::uint32_t repeats) {
+    auto samples = time_samples(init, fn, repeats);
+    return std::accumulate(samples.begin(), samples.end(), 0.0);
+}
+
+// The statistics of repeats calls (at least --samples), also added to the report under name so they end up in the
+// --output file. The counters follow the worker threads if they were enabled before the threads were created.
+statistics measure(std::invocable auto init, std::invocable auto fn, std::uint32_t repeats, std::string_view name) {
+    repeats = std::max(repeats, minimum_samples());
+    counters events;
+    auto stats = summarize(time_samples(init, fn, repeats, &events), 1);
+    if (hardware_counters()) {
+        stats.events = events /= repeats;
+    }
+    report().add(std::string(name), stats);
+    return stats;
+}
+
+// Like time, but the samples are recorded, see measure.
+double time(std::invocable auto init, std::invocable auto fn, std::uint32_t repeats, std::string_view name) {
+    auto stats = measure(init, fn, repeats, name);
+    return std::accumulate(stats.samples.begin(), stats.samples.end(), 0.0);
 }
 
 void time_print(std::invocable auto init, std::invocable auto fn, std::uint32_t repeats, std::string_view string) {
-    auto elapsed = time(init, fn, repeats);
-    std::print("Executing {} {} times took {:.6f} seconds.\n", string, repeats, elapsed);
+    auto stats = measure(init, fn, repeats, string);
+    auto elapsed = std::accumulate(stats.samples.begin(), stats.samples.end(), 0.0);
+    std::print("Executing {} {} times took {:.6f} seconds.\n", string, stats.samples.size(), elapsed);
+    if (stats.events) {
+        std::print("    per call: {}\n", describe(*stats.events));
+    }
 }
 
 void time_print(std::invocable auto fn, std::uint32_t repeats, std::string_view string) {
-    auto elapsed = time([](){}, fn, repeats);
-    std::print("Executing {} {} times took {:.6f} seconds.\n", string, repeats, elapsed);
+    time_print([](){}, fn, repeats, string);
 }
 
 } // namespace timer
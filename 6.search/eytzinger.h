@@ -0,0 +1,133 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <ranges>
+#include <vector>
+
+#include "search.h"
+
+// Allocates on Alignment byte boundaries, so a block of Alignment bytes at a multiple of Alignment from the start of a
+// vector is one cache line.
+template <class T, std::size_t Alignment>
+    requires(std::has_single_bit(Alignment) and Alignment >= alignof(T))
+struct aligned_allocator {
+    using value_type = T;
+
+    template <class U>
+    struct rebind {
+        using other = aligned_allocator<U, Alignment>;
+    };
+
+    aligned_allocator() = default;
+
+    template <class U>
+    aligned_allocator(const aligned_allocator<U, Alignment> &) noexcept {}
+
+    T *allocate(std::size_t n) {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t{Alignment}));
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept {
+        ::operator delete(p, n * sizeof(T), std::align_val_t{Alignment});
+    }
+
+    template <class U>
+    bool operator==(const aligned_allocator<U, Alignment> &) const noexcept {
+        return true;
+    }
+};
+
+// A copy of a sorted range in Eytzinger (breadth first) order: node 1 is the median, the children of node k are 2k and
+// 2k + 1, as in a binary heap. A binary search visits nodes 1, 2 or 3, 4 to 7, ..., so the first levels share a few
+// cache lines that stay in the cache, and the 2^d descendants of a node d levels below it are next to each other, one
+// prefetch loads the nodes of the next levels while we compare with the current one.
+// The queries return positions in the sorted range, like lower_bound - first.
+template <class T, class Compare = std::less<>>
+    requires std::strict_weak_order<Compare &, const T &, const T &>
+class eytzinger_index {
+public:
+    eytzinger_index() = default;
+
+    // precondition: sorted is sorted by comp
+    template <std::ranges::random_access_range R>
+        requires std::convertible_to<std::ranges::range_reference_t<R>, T>
+    explicit eytzinger_index(R &&sorted, Compare comp = {})
+        : values_(std::ranges::size(sorted) + 1), ranks_(std::ranges::size(sorted) + 1), comp_(comp) {
+        fill(std::ranges::begin(sorted), 0, 1);
+        // node 0 is where the searches end when the partition point is the end of the range
+        ranks_[0] = size();
+    }
+
+    std::size_t size() const noexcept {
+        return values_.size() - 1;
+    }
+
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    // The position of the partition point of the sorted range for pred, the first element that doesn't satisfy it.
+    // precondition: the sorted range is partitioned by pred
+    template <class Pred>
+        requires std::predicate<Pred &, const T &>
+    std::size_t partition_point(Pred pred) const {
+        return ranks_[node(pred)];
+    }
+
+    // The position of the first element that is not less than value, size() if there is none.
+    std::size_t lower_bound(const T &value) const {
+        return partition_point([this, &value](const T &x) {
+            return comp_(x, value);
+        });
+    }
+
+    bool contains(const T &value) const {
+        auto k = node([this, &value](const T &x) {
+            return comp_(x, value);
+        });
+        return k != 0 and not comp_(value, values_[k]);
+    }
+
+private:
+    // a cache line of descendants, 16 for 4 byte elements, which are 4 levels below. values_ starts on a cache line,
+    // so the descendants of k, from k * prefetch_stride, are on one line.
+    static constexpr std::size_t prefetch_stride = std::bit_floor(std::max<std::size_t>(64 / sizeof(T), 1));
+
+    // in order traversal of the tree, which visits the nodes in sorted order
+    template <class It>
+    std::size_t fill(It sorted, std::size_t i, std::size_t k) {
+        if (k < values_.size()) {
+            i = fill(sorted, i, 2 * k);
+            values_[k] = sorted[i];
+            ranks_[k] = i++;
+            i = fill(sorted, i, 2 * k + 1);
+        }
+        return i;
+    }
+
+    // Goes left where pred is false and right where it is true, until it falls off the tree. The partition point is
+    // the last node where we went left: the trailing ones of k are the right turns after it, and removing them and the
+    // left turn gives the node. Without a left turn, k becomes 0.
+    template <class Pred>
+    std::size_t node(Pred pred) const {
+        std::size_t k = 1;
+        auto n = values_.size();
+        while (k < n) {
+            if (k * prefetch_stride < n) {
+                prefetch_read(values_.data() + k * prefetch_stride);
+            }
+            k = 2 * k + static_cast<std::size_t>(pred(values_[k]));
+        }
+        return k >> (std::countr_one(k) + 1);
+    }
+
+    using aligned_vector = std::vector<T, aligned_allocator<T, 64>>;
+
+    aligned_vector values_ = aligned_vector(1); // values_[0] is not used
+    std::vector<std::size_t> ranks_ = std::vector<std::size_t>(1);
+    Compare comp_;
+};
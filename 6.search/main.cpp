@@ -0,0 +1,134 @@
+#include "search.h"
+#include "eytzinger.h"
+#include "../5.parallel/timer.h"
+#include "../5.parallel/random_init.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <format>
+#include <print>
+#include <string>
+#include <vector>
+
+
+void do_not_optimize(auto x) {
+    [[maybe_unused]] volatile auto y = x;
+}
+
+// The even numbers 0, 2, ..., 2 * (size - 1), and queries uniform in [0, 2 * size), half of them are in the range.
+// The values don't matter for the memory accesses of a binary search, only the positions of the queries do.
+std::vector<std::int32_t> sorted_input(std::size_t size) {
+    auto sorted = std::vector<std::int32_t>(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        sorted[i] = static_cast<std::int32_t>(2 * i);
+    }
+    return sorted;
+}
+
+std::vector<std::int32_t> random_queries(std::size_t count, std::size_t size) {
+    auto queries = std::vector<std::int32_t>(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        queries[i] = static_cast<std::int32_t>(random_bits(7, i) % (2 * size));
+    }
+    return queries;
+}
+
+void test_partition_point() {
+    constexpr std::size_t num_queries = 1 << 20;
+    std::print("| size | bytes | std::partition_point | partition_point_n | branchless | speedup |\n");
+    std::print("|------|-------|----------------------|-------------------|------------|---------|\n");
+    // 1 KB in L1 to 256 MB in memory
+    for (std::size_t size = 1 << 8; size <= 1 << 26; size <<= 3) {
+        auto sorted = sorted_input(size);
+        auto queries = random_queries(num_queries, size);
+        auto n = static_cast<std::ptrdiff_t>(size);
+        auto results = std::vector<std::vector<std::int32_t>::const_iterator>(num_queries);
+
+        auto std_search = [&sorted, &queries, &results]() {
+            for (std::size_t i = 0; i < queries.size(); ++i) {
+                auto value = queries[i];
+                results[i] = std::partition_point(sorted.cbegin(), sorted.cend(), [value](std::int32_t x) {
+                    return x < value;
+                });
+            }
+            do_not_optimize(results.back());
+        };
+        auto branchy = [&sorted, &queries, &results, n]() {
+            for (std::size_t i = 0; i < queries.size(); ++i) {
+                auto value = queries[i];
+                results[i] = partition_point_n(sorted.cbegin(), n, [value](std::int32_t x) {
+                    return x < value;
+                }).first;
+            }
+            do_not_optimize(results.back());
+        };
+        auto branchless = [&sorted, &queries, &results, n]() {
+            for (std::size_t i = 0; i < queries.size(); ++i) {
+                auto value = queries[i];
+                results[i] = branchless_partition_point_n(sorted.cbegin(), n, [value](std::int32_t x) {
+                    return x < value;
+                }).first;
+            }
+            do_not_optimize(results.back());
+        };
+        auto no_init = []() {};
+        auto std_time = timer::time(no_init, std_search, 5, std::format("std::partition_point {}", size));
+        auto branchy_time = timer::time(no_init, branchy, 5, std::format("partition_point_n {}", size));
+        auto branchless_time = timer::time(no_init, branchless, 5, std::format("branchless partition_point_n {}", size));
+        std::print("| {} | {} | {:.6f}s | {:.6f}s | {:.6f}s | {:.2f}x |\n", size, size * sizeof(std::int32_t), std_time,
+                   branchy_time, branchless_time, branchy_time / branchless_time);
+    }
+}
+
+void test_batched_search() {
+    constexpr std::size_t num_queries = 1 << 20;
+    std::print("| size | std::lower_bound | lower_bound | batched | eytzinger | speedup |\n");
+    std::print("|------|------------------|-------------|---------|-----------|---------|\n");
+    // from a range that fits in L1 to one that only fits in memory
+    for (std::size_t size = 1 << 10; size <= 1 << 26; size <<= 4) {
+        auto sorted = sorted_input(size);
+        auto queries = random_queries(num_queries, size);
+        auto index = eytzinger_index<std::int32_t>(sorted);
+        auto results = std::vector<std::vector<std::int32_t>::const_iterator>(num_queries);
+        auto positions = std::vector<std::size_t>(num_queries);
+
+        auto std_search = [&sorted, &queries, &results]() {
+            for (std::size_t i = 0; i < queries.size(); ++i) {
+                results[i] = std::lower_bound(sorted.cbegin(), sorted.cend(), queries[i]);
+            }
+            do_not_optimize(results.back());
+        };
+        auto our_search = [&sorted, &queries, &results]() {
+            for (std::size_t i = 0; i < queries.size(); ++i) {
+                results[i] = ::lower_bound(sorted.cbegin(), sorted.cend(), queries[i]);
+            }
+            do_not_optimize(results.back());
+        };
+        auto batched = [&sorted, &queries, &results]() {
+            lower_bound_batch(sorted.cbegin(), sorted.cend(), queries.begin(), queries.end(), results.begin());
+            do_not_optimize(results.back());
+        };
+        auto eytzinger = [&index, &queries, &positions]() {
+            for (std::size_t i = 0; i < queries.size(); ++i) {
+                positions[i] = index.lower_bound(queries[i]);
+            }
+            do_not_optimize(positions.back());
+        };
+        auto no_init = []() {};
+        auto std_time = timer::time(no_init, std_search, 5, std::format("std::lower_bound {}", size));
+        auto our_time = timer::time(no_init, our_search, 5, std::format("lower_bound {}", size));
+        auto batched_time = timer::time(no_init, batched, 5, std::format("batched lower_bound {}", size));
+        auto eytzinger_time = timer::time(no_init, eytzinger, 5, std::format("eytzinger lower_bound {}", size));
+        std::print("| {} | {:.6f}s | {:.6f}s | {:.6f}s | {:.6f}s | {:.2f}x |\n", size, std_time, our_time, batched_time,
+                   eytzinger_time, std_time / std::min(batched_time, eytzinger_time));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    // --output, --samples, --counters and --compare, see timer::handle_arguments
+    if (auto status = timer::handle_arguments(argc, argv)) {
+        return *status;
+    }
+    test_partition_point();
+    test_batched_search();
+}
@@ -0,0 +1,225 @@
+#pragma once
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+// The searches of README.md: the linear searches, the binary searches with a branchless one, and a batched version for
+// many queries against the same range.
+
+// Asks the cpu to start loading the cache line of address, a hint that never faults, even for an invalid address.
+inline void prefetch_read([[maybe_unused]] const void *address) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address, 0, 3);
+#endif
+}
+
+// The first element of the counted range [first, first + n) that satisfies pred, and how many elements are left from
+// it to the end, 0 if there is none. With the count, the caller can search again after the element.
+template <std::input_iterator I, std::integral N, class Pred>
+    requires std::indirect_unary_predicate<Pred &, I>
+std::pair<I, N> find_if_n(I first, N n, Pred pred) {
+    while (n != 0) {
+        if (pred(*first)) {
+            break;
+        }
+        --n;
+        ++first;
+    }
+    return {first, n};
+}
+
+template <std::input_iterator I, std::integral N, class Pred>
+    requires std::indirect_unary_predicate<Pred &, I>
+std::pair<I, N> find_if_not_n(I first, N n, Pred pred) {
+    return find_if_n(first, n, std::not_fn(pred));
+}
+
+// The last element that satisfies pred, last if there is none.
+// Forward iterators can only go forward, so we look at every element and remember the last match. When we can get to
+// the end in constant time and go back from there (a bidirectional iterator with itself as the sentinel, or a random
+// access iterator with a sized sentinel), we search from the end and stop at the first match, which for the latest
+// entry of an append-only log is close to the end.
+template <std::forward_iterator I, std::sentinel_for<I> S, class Pred>
+    requires std::indirect_unary_predicate<Pred &, I>
+I find_last_if(I first, S last, Pred pred) {
+    if constexpr (std::bidirectional_iterator<I> and
+                  (std::same_as<I, S> or (std::random_access_iterator<I> and std::sized_sentinel_for<S, I>))) {
+        I end = std::ranges::next(first, last);
+        I it = end;
+        while (it != first) {
+            --it;
+            if (pred(*it)) {
+                return it;
+            }
+        }
+        return end;
+    } else {
+        I found = first;
+        bool matched = false;
+        while (first != last) {
+            if (pred(*first)) {
+                found = first;
+                matched = true;
+            }
+            ++first;
+        }
+        // first is the end now, we only get it as an I by walking there
+        return matched ? found : first;
+    }
+}
+
+template <std::forward_iterator I, std::sentinel_for<I> S, class Pred>
+    requires std::indirect_unary_predicate<Pred &, I>
+I find_last_if_not(I first, S last, Pred pred) {
+    return ::find_last_if(first, last, std::not_fn(pred));
+}
+
+// Whether the elements that satisfy pred all come before the ones that don't.
+template <std::input_iterator I, std::sentinel_for<I> S, class Pred>
+    requires std::indirect_unary_predicate<Pred &, I>
+bool is_partitioned(I first, S last, Pred pred) {
+    while (first != last and pred(*first)) {
+        ++first;
+    }
+    while (first != last and not pred(*first)) {
+        ++first;
+    }
+    // if we stopped before the end, an element that satisfies pred comes after one that doesn't
+    return first == last;
+}
+
+template <std::input_iterator I, std::integral N, class Pred>
+    requires std::indirect_unary_predicate<Pred &, I>
+bool is_partitioned_n(I first, N n, Pred pred) {
+    auto [first_false, n_false] = find_if_not_n(first, n, pred);
+    return find_if_n(first_false, n_false, pred).second == 0;
+}
+
+// The partition point of the counted range [first, first + n), and how many elements are left after it.
+// precondition: [first, first + n) is partitioned by pred, the elements that satisfy it come first
+template <std::forward_iterator I, std::integral N, class Pred>
+    requires std::indirect_unary_predicate<Pred &, I>
+std::pair<I, N> partition_point_n(I first, N n, Pred pred) {
+    N after = 0; // the elements we dropped from the end, they are all after the partition point
+    while (n != 0) {
+        N half = n / 2;
+        I mid = std::ranges::next(first, half);
+        if (pred(*mid)) {
+            first = std::ranges::next(mid);
+            n -= half + 1;
+        } else {
+            after += n - half;
+            n = half;
+        }
+    }
+    return {first, after};
+}
+
+// The same result as partition_point_n without a branch on pred. On random data the branch of partition_point_n goes
+// either way with the same probability and the cpu guesses wrong half of the time, here each step is a conditional
+// add. Without the speculation the cpu can't start loading the next element before the comparison finished, so for
+// contiguous ranges both elements the next step may compare with are prefetched.
+// It always takes ceil(log2(n)) + 1 comparisons, at most one more than partition_point_n.
+template <std::random_access_iterator I, std::integral N, class Pred>
+    requires std::indirect_unary_predicate<Pred &, I>
+std::pair<I, N> branchless_partition_point_n(I first, N n, Pred pred) {
+    if (n == 0) {
+        return {first, 0};
+    }
+    // the partition point is in [base, base + length]
+    I base = first;
+    N length = n;
+    while (length > 1) {
+        N half = length / 2;
+        if constexpr (std::contiguous_iterator<I>) {
+            N next_half = (length - half) / 2;
+            prefetch_read(std::to_address(base + next_half));
+            prefetch_read(std::to_address(base + half + next_half));
+        }
+        base += pred(base[half]) ? half : N{0};
+        length -= half;
+    }
+    base += pred(*base) ? N{1} : N{0};
+    return {base, static_cast<N>(n - (base - first))};
+}
+
+template <std::forward_iterator I, std::sentinel_for<I> S, class Pred>
+    requires std::indirect_unary_predicate<Pred &, I>
+I partition_point(I first, S last, Pred pred) {
+    return partition_point_n(first, std::ranges::distance(first, last), pred).first;
+}
+
+template <std::forward_iterator I, std::sentinel_for<I> S, class T = std::iter_value_t<I>, class Compare = std::less<>>
+    requires std::indirect_binary_predicate<Compare &, I, const T *>
+I lower_bound(I first, S last, const T &value, Compare comp = {}) {
+    return ::partition_point(first, last, [&value, &comp](const auto &x) {
+        return comp(x, value);
+    });
+}
+
+template <std::forward_iterator I, std::sentinel_for<I> S, class T = std::iter_value_t<I>, class Compare = std::less<>>
+    requires std::indirect_binary_predicate<Compare &, I, const T *>
+bool binary_search(I first, S last, const T &value, Compare comp = {}) {
+    I found = ::lower_bound(first, last, value, comp);
+    return found != last and not comp(value, *found);
+}
+
+// How many queries partition_point_batch interleaves. Each one has a cache miss in flight, so 16 is about as many as
+// the line fill buffers of a core can track.
+inline constexpr std::size_t search_batch_size = 16;
+
+// For every query q in [queries, queries_last), writes to output the partition point of [first, first + n) for
+// pred(x, q), the iterator lower_bound would return for comp(x, q).
+// One binary search waits for a cache miss at almost every step, and the next step depends on it. Here
+// search_batch_size searches take their steps in turns: all of them have the same length n, so they halve it the same
+// number of times, and each step is a conditional add instead of a branch that fails half of the time. After each step
+// the next probe of that query is prefetched, it has loaded by the time the other queries took their step.
+// precondition: [first, first + n) is partitioned by pred(x, q) for every q
+template <std::random_access_iterator I, std::integral N, std::input_iterator Q, std::sentinel_for<Q> QS,
+          std::weakly_incrementable O, class Pred, class V = std::iter_value_t<Q>>
+    requires std::indirectly_writable<O, I> and std::semiregular<V> and
+             std::predicate<Pred &, std::iter_reference_t<I>, const V &>
+O partition_point_batch(I first, N n, Q queries, QS queries_last, O output, Pred pred) {
+    std::array<V, search_batch_size> values;
+    std::array<I, search_batch_size> bases;
+    while (queries != queries_last) {
+        std::size_t count = 0;
+        for (; count < search_batch_size and queries != queries_last; ++count, ++queries) {
+            values[count] = *queries;
+            bases[count] = first;
+        }
+        // the partition point of query j is in [bases[j], bases[j] + length]
+        N length = n;
+        while (length > 1) {
+            N half = length / 2;
+            N next_half = (length - half) / 2;
+            for (std::size_t j = 0; j < count; ++j) {
+                bases[j] += pred(bases[j][half], values[j]) ? half : N{0};
+                if constexpr (std::contiguous_iterator<I>) {
+                    prefetch_read(std::to_address(bases[j] + next_half));
+                }
+            }
+            length -= half;
+        }
+        for (std::size_t j = 0; j < count; ++j) {
+            if (length == 1 and pred(*bases[j], values[j])) {
+                ++bases[j];
+            }
+            *output = bases[j];
+            ++output;
+        }
+    }
+    return output;
+}
+
+template <std::random_access_iterator I, std::sized_sentinel_for<I> S, std::input_iterator Q, std::sentinel_for<Q> QS,
+          std::weakly_incrementable O, class Compare = std::less<>, class V = std::iter_value_t<Q>>
+    requires std::indirectly_writable<O, I> and std::semiregular<V> and
+             std::predicate<Compare &, std::iter_reference_t<I>, const V &>
+O lower_bound_batch(I first, S last, Q queries, QS queries_last, O output, Compare comp = {}) {
+    return partition_point_batch(first, last - first, queries, queries_last, output, comp);
+}